@@ -0,0 +1,257 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include "blake3.h"
+
+#define CHUNK_START (1 << 0)
+#define CHUNK_END (1 << 1)
+#define PARENT (1 << 2)
+#define ROOT (1 << 3)
+
+static const uint32_t iv[8] = {
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+    0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19,
+};
+
+static const uint8_t msg_schedule[7][16] = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8},
+    {3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1},
+    {10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6},
+    {12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4},
+    {9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7},
+    {11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13},
+};
+
+#define ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+#define G(a, b, c, d, mx, my) do { \
+    s[a] = s[a] + s[b] + (mx); s[d] = ROR(s[d] ^ s[a], 16); \
+    s[c] = s[c] + s[d];        s[b] = ROR(s[b] ^ s[c], 12); \
+    s[a] = s[a] + s[b] + (my); s[d] = ROR(s[d] ^ s[a], 8); \
+    s[c] = s[c] + s[d];        s[b] = ROR(s[b] ^ s[c], 7); \
+} while (0)
+
+static void load_words(uint32_t m[16], const uint8_t block[BLAKE3_BLOCK_LEN]) {
+    int i;
+    for (i=0; i<16; i++) {
+        m[i] = (uint32_t)block[4*i] | ((uint32_t)block[4*i+1] << 8) |
+               ((uint32_t)block[4*i+2] << 16) | ((uint32_t)block[4*i+3] << 24);
+    }
+}
+
+static void compress(
+    const uint32_t cv[8],
+    const uint32_t m[16],
+    uint64_t counter,
+    uint32_t block_len,
+    uint32_t flags,
+    uint32_t out[16]
+) {
+    uint32_t s[16] = {
+        cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7],
+        iv[0], iv[1], iv[2], iv[3],
+        (uint32_t)counter, (uint32_t)(counter >> 32), block_len, flags,
+    };
+    int r, i;
+#pragma GCC unroll 7
+    for (r=0; r<7; r++) {
+        const uint8_t *ms = msg_schedule[r];
+        G(0, 4, 8, 12, m[ms[0]], m[ms[1]]);
+        G(1, 5, 9, 13, m[ms[2]], m[ms[3]]);
+        G(2, 6, 10, 14, m[ms[4]], m[ms[5]]);
+        G(3, 7, 11, 15, m[ms[6]], m[ms[7]]);
+        G(0, 5, 10, 15, m[ms[8]], m[ms[9]]);
+        G(1, 6, 11, 12, m[ms[10]], m[ms[11]]);
+        G(2, 7, 8, 13, m[ms[12]], m[ms[13]]);
+        G(3, 4, 9, 14, m[ms[14]], m[ms[15]]);
+    }
+    for (i=0; i<8; i++) {
+        out[i] = s[i] ^ s[i+8];
+        out[i+8] = s[i+8] ^ cv[i];
+    }
+}
+
+/*
+ * An "output" is a compression that hasn't happened yet: either the
+ * chaining value of a node, or (with the ROOT flag) the final hash.
+ */
+typedef struct output_s {
+    uint32_t cv[8];
+    uint32_t m[16];
+    uint64_t counter;
+    uint32_t block_len;
+    uint32_t flags;
+} output_t;
+
+static void output_cv(const output_t *o, uint32_t cv[8]) {
+    uint32_t out[16];
+    compress(o->cv, o->m, o->counter, o->block_len, o->flags, out);
+    memcpy(cv, out, 8*sizeof(uint32_t));
+}
+
+static void parent_output(const uint32_t left[8], const uint32_t right[8], output_t *o) {
+    memcpy(o->cv, iv, sizeof(iv));
+    memcpy(o->m, left, 8*sizeof(uint32_t));
+    memcpy(o->m + 8, right, 8*sizeof(uint32_t));
+    o->counter = 0;
+    o->block_len = BLAKE3_BLOCK_LEN;
+    o->flags = PARENT;
+}
+
+static void chunk_init(blake3_chunk_state_t *c, uint64_t chunk_counter) {
+    memcpy(c->cv, iv, sizeof(iv));
+    c->chunk_counter = chunk_counter;
+    memset(c->block, 0, sizeof(c->block));
+    c->block_len = 0;
+    c->blocks_compressed = 0;
+}
+
+static size_t chunk_len(const blake3_chunk_state_t *c) {
+    return BLAKE3_BLOCK_LEN * (size_t)c->blocks_compressed + c->block_len;
+}
+
+static uint32_t chunk_start_flag(const blake3_chunk_state_t *c) {
+    return c->blocks_compressed == 0 ? CHUNK_START : 0;
+}
+
+static void chunk_update(blake3_chunk_state_t *c, const uint8_t *p, size_t len) {
+    while (len) {
+        if (c->block_len == BLAKE3_BLOCK_LEN) {
+            uint32_t m[16], out[16];
+            load_words(m, c->block);
+            compress(c->cv, m, c->chunk_counter, BLAKE3_BLOCK_LEN,
+                     chunk_start_flag(c), out);
+            memcpy(c->cv, out, 8*sizeof(uint32_t));
+            c->blocks_compressed++;
+            memset(c->block, 0, sizeof(c->block));
+            c->block_len = 0;
+        }
+        size_t take = BLAKE3_BLOCK_LEN - c->block_len;
+        if (take > len) {
+            take = len;
+        }
+        memcpy(c->block + c->block_len, p, take);
+        c->block_len += take;
+        p += take;
+        len -= take;
+    }
+}
+
+static void chunk_output(const blake3_chunk_state_t *c, output_t *o) {
+    memcpy(o->cv, c->cv, sizeof(o->cv));
+    load_words(o->m, c->block);
+    o->counter = c->chunk_counter;
+    o->block_len = c->block_len;
+    o->flags = chunk_start_flag(c) | CHUNK_END;
+}
+
+/*
+ * Push a finished chunk's chaining value, first merging every completed
+ * subtree it closes.  total_chunks is the count including this one.
+ */
+static void add_chunk_cv(blake3_hasher_t *h, uint32_t cv[8], uint64_t total_chunks) {
+    while ((total_chunks & 1) == 0) {
+        output_t o;
+        h->cv_stack_len--;
+        parent_output(h->cv_stack[h->cv_stack_len], cv, &o);
+        output_cv(&o, cv);
+        total_chunks >>= 1;
+    }
+    memcpy(h->cv_stack[h->cv_stack_len], cv, 8*sizeof(uint32_t));
+    h->cv_stack_len++;
+}
+
+void blake3_init(blake3_hasher_t *h) {
+    blake3_init_at(h, 0);
+}
+
+void blake3_init_at(blake3_hasher_t *h, uint64_t chunk_counter) {
+    chunk_init(&h->chunk, chunk_counter);
+    h->cv_stack_len = 0;
+}
+
+void blake3_update(blake3_hasher_t *h, const void *data, size_t len) {
+    const uint8_t *p = data;
+    while (len) {
+        if (chunk_len(&h->chunk) == BLAKE3_CHUNK_LEN) {
+            output_t o;
+            uint32_t cv[8];
+            uint64_t total_chunks = h->chunk.chunk_counter + 1;
+            chunk_output(&h->chunk, &o);
+            output_cv(&o, cv);
+            add_chunk_cv(h, cv, total_chunks);
+            chunk_init(&h->chunk, total_chunks);
+        }
+        size_t take = BLAKE3_CHUNK_LEN - chunk_len(&h->chunk);
+        if (take > len) {
+            take = len;
+        }
+        chunk_update(&h->chunk, p, take);
+        p += take;
+        len -= take;
+    }
+}
+
+/*
+ * Fold the CV stack into the pending chunk, leaving the output of the
+ * top node of everything hashed so far.
+ */
+static void top_output(const blake3_hasher_t *h, output_t *o) {
+    int remaining = h->cv_stack_len;
+    chunk_output(&h->chunk, o);
+    while (remaining > 0) {
+        uint32_t cv[8];
+        remaining--;
+        output_cv(o, cv);
+        parent_output(h->cv_stack[remaining], cv, o);
+    }
+}
+
+void blake3_final_cv(const blake3_hasher_t *h, uint32_t cv[8]) {
+    output_t o;
+    top_output(h, &o);
+    output_cv(&o, cv);
+}
+
+void blake3_push_cv(blake3_hasher_t *h, const uint32_t cv[8], uint64_t nchunks) {
+    uint32_t new_cv[8];
+    uint64_t chunk_counter = h->chunk.chunk_counter;
+    memcpy(new_cv, cv, sizeof(new_cv));
+    add_chunk_cv(h, new_cv, chunk_counter / nchunks + 1);
+    chunk_init(&h->chunk, chunk_counter + nchunks);
+}
+
+void blake3_final(const blake3_hasher_t *h, uint8_t out[BLAKE3_OUT_LEN]) {
+    output_t o;
+    top_output(h, &o);
+
+    uint32_t words[16];
+    int i;
+    compress(o.cv, o.m, 0, o.block_len, o.flags | ROOT, words);
+    for (i=0; i<BLAKE3_OUT_LEN/4; i++) {
+        out[4*i] = words[i];
+        out[4*i+1] = words[i] >> 8;
+        out[4*i+2] = words[i] >> 16;
+        out[4*i+3] = words[i] >> 24;
+    }
+}
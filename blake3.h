@@ -0,0 +1,72 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * A small, portable BLAKE3 implementation (unkeyed hashing, 32-byte
+ * output), following the structure of the reference implementation.
+ */
+
+#ifndef BLAKE3_H
+#define BLAKE3_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BLAKE3_OUT_LEN 32
+#define BLAKE3_BLOCK_LEN 64
+#define BLAKE3_CHUNK_LEN 1024
+#define BLAKE3_MAX_DEPTH 54
+
+typedef struct blake3_chunk_state_s {
+    uint32_t cv[8];
+    uint64_t chunk_counter;
+    uint8_t block[BLAKE3_BLOCK_LEN];
+    uint8_t block_len;
+    uint8_t blocks_compressed;
+} blake3_chunk_state_t;
+
+typedef struct blake3_hasher_s {
+    blake3_chunk_state_t chunk;
+    uint32_t cv_stack[BLAKE3_MAX_DEPTH][8];
+    uint8_t cv_stack_len;
+} blake3_hasher_t;
+
+void blake3_init(blake3_hasher_t *hasher);
+void blake3_update(blake3_hasher_t *hasher, const void *data, size_t len);
+void blake3_final(const blake3_hasher_t *hasher, uint8_t out[BLAKE3_OUT_LEN]);
+
+/*
+ * BLAKE3 is a tree hash, so any aligned, power-of-two run of chunks
+ * forms a subtree whose chaining value can be computed independently
+ * (e.g. on another core) and later grafted into the hasher of the
+ * whole input.
+ *
+ * blake3_init_at() starts a hasher for the subtree beginning at the
+ * given chunk, and blake3_final_cv() yields its chaining value once all
+ * of the subtree's input has been added.  blake3_push_cv() then adds
+ * that subtree of nchunks chunks to a hasher which has consumed exactly
+ * the input preceding it.  The subtree holding the last byte of the
+ * input must be hashed normally, since its root node is special.
+ */
+void blake3_init_at(blake3_hasher_t *hasher, uint64_t chunk_counter);
+void blake3_final_cv(const blake3_hasher_t *hasher, uint32_t cv[8]);
+void blake3_push_cv(blake3_hasher_t *hasher, const uint32_t cv[8], uint64_t nchunks);
+
+#endif
@@ -0,0 +1,264 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+
+#define CACHE_MAGIC "TFCACHE1"
+#define INITIAL_CAPACITY 1024
+
+/*
+ * The file is a header followed by an array of records.  A record is
+ * written in full before the header's count is bumped to include it,
+ * so a crash can lose the last record but not corrupt the cache.
+ */
+typedef struct cache_header_s {
+    char magic[8];
+    uint32_t record_size;
+    uint32_t reserved;
+    uint64_t count;
+    uint64_t capacity;
+} cache_header_t;
+
+typedef struct cache_record_s {
+    cache_key_t key;
+    uint32_t len;
+    uint32_t reserved;
+    uint8_t data[CACHE_DATA_MAX];
+} cache_record_t;
+
+static int cache_fd = -1;
+static cache_header_t *header = NULL;
+static cache_record_t *records = NULL;
+static size_t map_size = 0;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * An in-memory hash index over the records, rebuilt whenever the file
+ * is mapped.  Each bucket heads a chain of record numbers, linked
+ * through chain[].
+ */
+static uint32_t *buckets = NULL;
+static uint32_t *chain = NULL;
+static uint32_t nbuckets = 0;
+#define NO_RECORD UINT32_MAX
+
+static uint32_t key_hash(const cache_key_t *key) {
+    uint64_t h = 14695981039346656037ULL;
+    const uint8_t *p = (const uint8_t *)key;
+    size_t i;
+    for (i=0; i<sizeof(cache_key_t); i++) {
+        h = (h ^ p[i]) * 1099511628211ULL;
+    }
+    return h ^ (h >> 32);
+}
+
+static void index_add(uint32_t n) {
+    uint32_t b = key_hash(&records[n].key) % nbuckets;
+    chain[n] = buckets[b];
+    buckets[b] = n;
+}
+
+/*
+ * (Re)build the index sized for the current capacity.
+ */
+static int index_build(void) {
+    uint32_t *new_buckets = malloc(header->capacity * sizeof(uint32_t));
+    uint32_t *new_chain = malloc(header->capacity * sizeof(uint32_t));
+    if (new_buckets == NULL || new_chain == NULL) {
+        free(new_buckets);
+        free(new_chain);
+        return -ENOMEM;
+    }
+    free(buckets);
+    free(chain);
+    buckets = new_buckets;
+    chain = new_chain;
+    nbuckets = header->capacity;
+
+    uint32_t n;
+    for (n=0; n<nbuckets; n++) {
+        buckets[n] = NO_RECORD;
+    }
+    for (n=0; n<header->count; n++) {
+        index_add(n);
+    }
+    return 0;
+}
+
+static cache_record_t *find(const cache_key_t *key) {
+    if (header == NULL) {
+        return NULL;
+    }
+    uint32_t n = buckets[key_hash(key) % nbuckets];
+    while (n != NO_RECORD) {
+        if (memcmp(&records[n].key, key, sizeof(cache_key_t)) == 0) {
+            return &records[n];
+        }
+        n = chain[n];
+    }
+    return NULL;
+}
+
+static int map(size_t size) {
+    void *addr = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, cache_fd, 0);
+    if (addr == MAP_FAILED) {
+        return -errno;
+    }
+    if (header) {
+        munmap(header, map_size);
+    }
+    header = addr;
+    records = (cache_record_t *)(header + 1);
+    map_size = size;
+    return 0;
+}
+
+/*
+ * Double the capacity of the file and remap it.
+ */
+static int grow(void) {
+    uint64_t capacity = header->capacity * 2;
+    size_t size = sizeof(cache_header_t) + capacity * sizeof(cache_record_t);
+    if (ftruncate(cache_fd, size) == -1) {
+        return -errno;
+    }
+    int ret = map(size);
+    if (ret) {
+        return ret;
+    }
+    header->capacity = capacity;
+    return index_build();
+}
+
+int cache_open(const char *path) {
+    int ret;
+
+    cache_fd = open(path, O_RDWR|O_CREAT|O_CLOEXEC, 0644);
+    if (cache_fd == -1) {
+        return -errno;
+    }
+
+    // the records aren't safe to share between writers
+    if (flock(cache_fd, LOCK_EX|LOCK_NB) == -1) {
+        ret = -errno;
+        goto fail;
+    }
+
+    struct stat st;
+    if (fstat(cache_fd, &st) == -1) {
+        ret = -errno;
+        goto fail;
+    }
+    if (st.st_size < sizeof(cache_header_t)) {
+        // new (or hopelessly truncated) cache file
+        size_t size = sizeof(cache_header_t) + INITIAL_CAPACITY * sizeof(cache_record_t);
+        if (ftruncate(cache_fd, 0) == -1 || ftruncate(cache_fd, size) == -1) {
+            ret = -errno;
+            goto fail;
+        }
+        if ((ret = map(size))) {
+            goto fail;
+        }
+        memcpy(header->magic, CACHE_MAGIC, sizeof(header->magic));
+        header->record_size = sizeof(cache_record_t);
+        header->count = 0;
+        header->capacity = INITIAL_CAPACITY;
+    } else {
+        if ((ret = map(st.st_size))) {
+            goto fail;
+        }
+        if (memcmp(header->magic, CACHE_MAGIC, sizeof(header->magic)) != 0 ||
+            header->record_size != sizeof(cache_record_t) ||
+            sizeof(cache_header_t) + header->capacity * sizeof(cache_record_t) > st.st_size ||
+            header->count > header->capacity) {
+            ret = -EINVAL;
+            goto fail;
+        }
+    }
+
+    if ((ret = index_build())) {
+        goto fail;
+    }
+    return 0;
+
+fail:
+    if (header) {
+        munmap(header, map_size);
+        header = NULL;
+    }
+    close(cache_fd);
+    cache_fd = -1;
+    return ret;
+}
+
+int cache_get(const cache_key_t *key, void *data, size_t len) {
+    int ret = -ENOENT;
+    pthread_mutex_lock(&cache_lock);
+    cache_record_t *record = find(key);
+    if (record && record->len == len) {
+        memcpy(data, record->data, len);
+        ret = 0;
+    }
+    pthread_mutex_unlock(&cache_lock);
+    return ret;
+}
+
+int cache_put(const cache_key_t *key, const void *data, size_t len) {
+    int ret = 0;
+    if (len > CACHE_DATA_MAX) {
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&cache_lock);
+    if (header == NULL) {
+        goto out;
+    }
+    cache_record_t *record = find(key);
+    if (record == NULL) {
+        if (header->count == header->capacity && (ret = grow())) {
+            goto out;
+        }
+        record = &records[header->count];
+        memset(record, 0, sizeof(cache_record_t));
+        record->key = *key;
+        record->len = len;
+        memcpy(record->data, data, len);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        index_add(header->count);
+        header->count++;
+    } else {
+        record->len = len;
+        memcpy(record->data, data, len);
+    }
+out:
+    pthread_mutex_unlock(&cache_lock);
+    return ret;
+}
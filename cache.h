@@ -0,0 +1,67 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * A persistent cache of hashing results, kept in a memory-mapped file
+ * of fixed-size records so that nothing has to be recomputed when the
+ * daemon restarts.
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* the kinds of records kept in the cache */
+enum {
+    CACHE_DIGEST = 1,       /* key1 = stream size */
+    CACHE_MIDSTATE = 2,     /* key1 = offset of the checkpoint */
+    CACHE_PIECE = 3         /* key1 = piece length, key2 = piece number */
+};
+
+#define CACHE_DATA_MAX 96
+
+typedef struct cache_key_s {
+    uint32_t type;
+    uint32_t algo;
+    uint32_t format;
+    uint32_t seed;
+    uint64_t key1;
+    uint64_t key2;
+} cache_key_t;
+
+/*
+ * Open (creating if necessary) and map the cache file.  Without a
+ * successful cache_open(), lookups miss and stores are discarded.
+ */
+int cache_open(const char *path);
+
+/*
+ * Fetch the data stored under a key.  Returns 0, or -ENOENT on a miss.
+ */
+int cache_get(const cache_key_t *key, void *data, size_t len);
+
+/*
+ * Store data under a key, replacing any previous data.
+ */
+int cache_put(const cache_key_t *key, const void *data, size_t len);
+
+#endif
@@ -0,0 +1,104 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <pthread.h>
+#include <string.h>
+
+#include "crc32c.h"
+
+#define POLY 0x82F63B78U
+
+static uint32_t table[8][256];
+static pthread_once_t table_once = PTHREAD_ONCE_INIT;
+static int have_sse42;
+
+static void crc32c_setup(void) {
+    uint32_t i, j;
+    for (i=0; i<256; i++) {
+        uint32_t c = i;
+        for (j=0; j<8; j++) {
+            c = (c & 1) ? (c >> 1) ^ POLY : (c >> 1);
+        }
+        table[0][i] = c;
+    }
+    for (i=0; i<256; i++) {
+        for (j=1; j<8; j++) {
+            table[j][i] = (table[j-1][i] >> 8) ^ table[0][table[j-1][i] & 0xff];
+        }
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    have_sse42 = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+static uint32_t crc32c_sw(uint32_t c, const uint8_t *p, size_t len) {
+    while (len && ((uintptr_t)p & 7)) {
+        c = (c >> 8) ^ table[0][(c ^ *p++) & 0xff];
+        len--;
+    }
+    while (len >= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        v ^= c;
+        c = table[7][v & 0xff] ^ table[6][(v >> 8) & 0xff] ^
+            table[5][(v >> 16) & 0xff] ^ table[4][(v >> 24) & 0xff] ^
+            table[3][(v >> 32) & 0xff] ^ table[2][(v >> 40) & 0xff] ^
+            table[1][(v >> 48) & 0xff] ^ table[0][v >> 56];
+        p += 8;
+        len -= 8;
+    }
+    while (len--) {
+        c = (c >> 8) ^ table[0][(c ^ *p++) & 0xff];
+    }
+    return c;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t c, const uint8_t *p, size_t len) {
+    uint64_t c64 = c;
+    while (len && ((uintptr_t)p & 7)) {
+        c64 = __builtin_ia32_crc32qi(c64, *p++);
+        len--;
+    }
+    while (len >= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        c64 = __builtin_ia32_crc32di(c64, v);
+        p += 8;
+        len -= 8;
+    }
+    while (len--) {
+        c64 = __builtin_ia32_crc32qi(c64, *p++);
+    }
+    return c64;
+}
+#endif
+
+uint32_t crc32c_update(uint32_t crc, const void *data, size_t len) {
+    pthread_once(&table_once, crc32c_setup);
+    uint32_t c = ~crc;
+#if defined(__x86_64__)
+    if (have_sse42) {
+        return ~crc32c_hw(c, data, len);
+    }
+#endif
+    return ~crc32c_sw(c, data, len);
+}
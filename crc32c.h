@@ -0,0 +1,39 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * CRC-32C (Castagnoli), using the SSE4.2 crc32 instruction when the CPU
+ * has it and a slicing-by-8 table otherwise.
+ */
+
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Continue a CRC-32C over another buffer.  Start with crc=0; the
+ * pre- and post-conditioning is handled internally, so the return
+ * value is the finished CRC of everything seen so far.
+ */
+uint32_t crc32c_update(uint32_t crc, const void *data, size_t len);
+
+#endif
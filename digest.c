@@ -0,0 +1,577 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "digest.h"
+#include "gen.h"
+#include "cache.h"
+#include "sha1.h"
+#include "sha256.h"
+#include "crc32c.h"
+#include "blake3.h"
+
+static const char *digest_names[DIGEST_COUNT] = {
+    [DIGEST_SHA256] = "sha256",
+    [DIGEST_CRC32C] = "crc32c",
+    [DIGEST_BLAKE3] = "blake3",
+    [DIGEST_SHA1] = "sha1",
+};
+
+/* the digests which can only be computed front to back */
+#define SERIAL_DIGESTS ((1 << DIGEST_SHA1) | (1 << DIGEST_SHA256) | (1 << DIGEST_CRC32C))
+
+/*
+ * While hashing a stream from its start, the state of each serial
+ * digest is checkpointed into the cache at this interval, so that the
+ * digest of any prefix of the stream can be finished from the nearest
+ * checkpoint.  Since a stream's content doesn't depend on the file's
+ * size, this also covers larger files of the same stream.
+ */
+#define MIDSTATE_INTERVAL (1ULL << 30)
+
+/*
+ * BLAKE3 ranges are split into subtrees of this size, each generated
+ * and hashed independently by whichever thread claims it.  It must be
+ * a power-of-two multiple of the BLAKE3 chunk size.
+ */
+#define BLAKE3_TASK_SIZE (16*1024*1024)
+
+typedef enum {
+    ENTRY_IDLE,
+    ENTRY_QUEUED,
+    ENTRY_RUNNING
+} entry_state_t;
+
+/*
+ * Digests depend only on the stream and the size, so files which share
+ * both share an entry.  Each digest is published as soon as it's done,
+ * so the fast parallel BLAKE3 digest doesn't wait for the serial ones.
+ */
+typedef struct digest_entry_s {
+    uint64_t size;
+    gen_stream_t stream;
+    entry_state_t state;
+    int ready;
+    char hex[DIGEST_COUNT][DIGEST_HEX_MAX];
+    struct digest_entry_s *next;
+} digest_entry_t;
+
+static digest_entry_t *entry_list = NULL;
+static pthread_mutex_t entry_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t entry_cond = PTHREAD_COND_INITIALIZER;
+static int blake3_threads = 1;
+
+/*
+ * Recently computed range digests, so that re-reading a range digest
+ * (or reading it in pieces) doesn't recompute it.
+ */
+#define RANGE_LRU_SIZE 64
+typedef struct range_entry_s {
+    gen_stream_t stream;
+    uint64_t offset;
+    uint64_t length;
+    int algo;
+    uint64_t last_used;
+    char hex[DIGEST_HEX_MAX];
+} range_entry_t;
+static range_entry_t range_lru[RANGE_LRU_SIZE];
+static uint64_t range_clock = 0;
+static pthread_mutex_t range_lock = PTHREAD_MUTEX_INITIALIZER;
+
+const char *digest_name(int algo) {
+    return digest_names[algo];
+}
+
+size_t digest_hex_len(int algo) {
+    switch (algo) {
+    case DIGEST_CRC32C:
+        return 8;
+    case DIGEST_SHA1:
+        return 40;
+    default:
+        return 64;
+    }
+}
+
+static void to_hex(char *hex, const uint8_t *bytes, size_t len) {
+    size_t i;
+    for (i=0; i<len; i++) {
+        sprintf(hex + 2*i, "%02x", bytes[i]);
+    }
+}
+
+static int same_stream(const gen_stream_t *a, const gen_stream_t *b) {
+    return a->format == b->format && a->seed == b->seed;
+}
+
+/*
+ * Find the entry for a stream, creating an idle one if needed.  Must be
+ * called with entry_lock held.
+ */
+static digest_entry_t *get_entry(uint64_t size, const gen_stream_t *stream) {
+    digest_entry_t *entry;
+    for (entry = entry_list; entry!=NULL; entry=entry->next) {
+        if (entry->size == size && same_stream(&entry->stream, stream)) {
+            return entry;
+        }
+    }
+    entry = calloc(1, sizeof(digest_entry_t));
+    if (entry == NULL) {
+        return NULL;
+    }
+    entry->size = size;
+    entry->stream = *stream;
+    entry->state = ENTRY_IDLE;
+    entry->next = entry_list;
+    entry_list = entry;
+    return entry;
+}
+
+static cache_key_t digest_key(uint64_t size, const gen_stream_t *stream, int algo) {
+    cache_key_t key = {
+        .type = CACHE_DIGEST,
+        .algo = algo,
+        .format = stream->format,
+        .seed = stream->seed,
+        .key1 = size,
+    };
+    return key;
+}
+
+/*
+ * Publish a finished digest, and remember it in the cache.  Must be
+ * called with entry_lock held.
+ */
+static void publish(digest_entry_t *entry, int algo, const char *hex) {
+    strcpy(entry->hex[algo], hex);
+    entry->ready |= 1 << algo;
+    cache_key_t key = digest_key(entry->size, &entry->stream, algo);
+    cache_put(&key, hex, strlen(hex) + 1);
+}
+
+typedef struct blake3_job_s {
+    const gen_stream_t *stream;
+    uint64_t offset;
+    uint64_t ntasks;
+    uint64_t next_task;
+    uint32_t (*cvs)[8];
+} blake3_job_t;
+
+/*
+ * Claim BLAKE3_TASK_SIZE subtrees of a range until there are none left,
+ * generating each one a block at a time and recording its chaining
+ * value.
+ */
+static void *blake3_worker(void *arg) {
+    blake3_job_t *job = arg;
+    char *buf = malloc(BLOCK_SIZE);
+    if (buf == NULL) {
+        return NULL;
+    }
+    for (;;) {
+        uint64_t task = __atomic_fetch_add(&job->next_task, 1, __ATOMIC_RELAXED);
+        if (task >= job->ntasks) {
+            break;
+        }
+        blake3_hasher_t hasher;
+        uint64_t pos;
+        blake3_init_at(&hasher, task * (BLAKE3_TASK_SIZE / BLAKE3_CHUNK_LEN));
+        for (pos = 0; pos < BLAKE3_TASK_SIZE; pos += BLOCK_SIZE) {
+            gen_stream_range(job->stream, buf, BLOCK_SIZE, job->offset + task*BLAKE3_TASK_SIZE + pos);
+            blake3_update(&hasher, buf, BLOCK_SIZE);
+        }
+        blake3_final_cv(&hasher, job->cvs[task]);
+    }
+    free(buf);
+    return NULL;
+}
+
+void digest_blake3_range(const gen_stream_t *stream, uint64_t offset, uint64_t length,
+    int threads, uint8_t out[32]
+) {
+    blake3_hasher_t hasher;
+    blake3_job_t job;
+    pthread_t *workers = NULL;
+    int nworkers = 0;
+    uint64_t i;
+
+    // every subtree but the one holding the final byte can be hashed
+    // out of order; if we can't get memory for that, it's all serial
+    job.stream = stream;
+    job.offset = offset;
+    job.ntasks = length ? (length - 1) / BLAKE3_TASK_SIZE : 0;
+    job.next_task = 0;
+    job.cvs = malloc(job.ntasks * sizeof(*job.cvs));
+    if (job.cvs == NULL) {
+        job.ntasks = 0;
+    }
+
+    if (threads > job.ntasks) {
+        threads = job.ntasks;
+    }
+    if (threads > 1) {
+        workers = malloc((threads-1) * sizeof(pthread_t));
+    }
+    if (workers) {
+        for (nworkers = 0; nworkers < threads-1; nworkers++) {
+            if (pthread_create(&workers[nworkers], NULL, blake3_worker, &job)) {
+                break;
+            }
+        }
+    }
+    blake3_worker(&job);
+    for (i=0; i<nworkers; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+
+    blake3_init(&hasher);
+    for (i=0; i<job.ntasks; i++) {
+        blake3_push_cv(&hasher, job.cvs[i], BLAKE3_TASK_SIZE / BLAKE3_CHUNK_LEN);
+    }
+    free(job.cvs);
+
+    // the final subtree is hashed in order
+    char buf[BLOCK_SIZE];
+    uint64_t pos = job.ntasks * BLAKE3_TASK_SIZE;
+    while (pos < length) {
+        size_t len = BLOCK_SIZE;
+        if (length - pos < len) {
+            len = length - pos;
+        }
+        gen_stream_range(stream, buf, len, offset + pos);
+        blake3_update(&hasher, buf, len);
+        pos += len;
+    }
+    blake3_final(&hasher, out);
+}
+
+/*
+ * The running state of the serial digests.
+ */
+typedef struct serial_state_s {
+    sha1_ctx_t sha1;
+    sha256_ctx_t sha256;
+    uint32_t crc32c;
+} serial_state_t;
+
+static cache_key_t midstate_key(const gen_stream_t *stream, int algo, uint64_t offset) {
+    cache_key_t key = {
+        .type = CACHE_MIDSTATE,
+        .algo = algo,
+        .format = stream->format,
+        .seed = stream->seed,
+        .key1 = offset,
+    };
+    return key;
+}
+
+/*
+ * Checkpoint one digest's state, which must be at a hash block
+ * boundary.
+ */
+static void save_midstate(const gen_stream_t *stream, int algo, uint64_t offset, const serial_state_t *state) {
+    cache_key_t key = midstate_key(stream, algo, offset);
+    switch (algo) {
+    case DIGEST_SHA1:
+        cache_put(&key, state->sha1.h, sizeof(state->sha1.h));
+        break;
+    case DIGEST_SHA256:
+        cache_put(&key, state->sha256.h, sizeof(state->sha256.h));
+        break;
+    case DIGEST_CRC32C:
+        cache_put(&key, &state->crc32c, sizeof(state->crc32c));
+        break;
+    }
+}
+
+/*
+ * Restore one digest's state from the latest checkpoint at or before
+ * limit, returning the checkpoint's offset (or 0 if there isn't one).
+ */
+static uint64_t load_midstate(const gen_stream_t *stream, int algo, uint64_t limit, serial_state_t *state) {
+    uint64_t offset;
+    for (offset = limit - limit % MIDSTATE_INTERVAL; offset > 0; offset -= MIDSTATE_INTERVAL) {
+        cache_key_t key = midstate_key(stream, algo, offset);
+        switch (algo) {
+        case DIGEST_SHA1:
+            if (cache_get(&key, state->sha1.h, sizeof(state->sha1.h)) == 0) {
+                state->sha1.length = offset;
+                return offset;
+            }
+            break;
+        case DIGEST_SHA256:
+            if (cache_get(&key, state->sha256.h, sizeof(state->sha256.h)) == 0) {
+                state->sha256.length = offset;
+                return offset;
+            }
+            break;
+        case DIGEST_CRC32C:
+            if (cache_get(&key, &state->crc32c, sizeof(state->crc32c)) == 0) {
+                return offset;
+            }
+            break;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Compute the serial digests selected by the algos bitmask over a byte
+ * range of a stream in a single pass.  The range is generated a block
+ * at a time into a buffer which stays in cache, and each block is fed
+ * to every digest before the next is generated, so the range is never
+ * materialized.  Ranges from the start of the stream resume from, and
+ * leave behind, midstate checkpoints.
+ */
+static void serial_digests(const gen_stream_t *stream, uint64_t offset, uint64_t length,
+    int algos, char hex[DIGEST_COUNT][DIGEST_HEX_MAX]
+) {
+    char buf[BLOCK_SIZE];
+    serial_state_t state;
+    uint64_t start[DIGEST_COUNT];
+    uint8_t out[SHA256_DIGEST_SIZE];
+    uint64_t pos = length;
+    int algo;
+
+    sha1_init(&state.sha1);
+    sha256_init(&state.sha256);
+    state.crc32c = 0;
+    for (algo=0; algo<DIGEST_COUNT; algo++) {
+        start[algo] = 0;
+        if (!(algos & (1 << algo))) {
+            continue;
+        }
+        if (offset == 0) {
+            start[algo] = load_midstate(stream, algo, length, &state);
+        }
+        if (start[algo] < pos) {
+            pos = start[algo];
+        }
+    }
+
+    while (pos < length) {
+        // keep to block boundaries so that the generator can write
+        // straight into the buffer
+        size_t len = BLOCK_SIZE - ((offset + pos) & OFFSET_MASK);
+        if (length - pos < len) {
+            len = length - pos;
+        }
+        gen_stream_range(stream, buf, len, offset + pos);
+        for (algo=0; algo<DIGEST_COUNT; algo++) {
+            if (!(algos & (1 << algo)) || pos < start[algo]) {
+                continue;
+            }
+            switch (algo) {
+            case DIGEST_SHA1:
+                sha1_update(&state.sha1, buf, len);
+                break;
+            case DIGEST_SHA256:
+                sha256_update(&state.sha256, buf, len);
+                break;
+            case DIGEST_CRC32C:
+                state.crc32c = crc32c_update(state.crc32c, buf, len);
+                break;
+            }
+            if (offset == 0 && (pos + len) % MIDSTATE_INTERVAL == 0) {
+                save_midstate(stream, algo, pos + len, &state);
+            }
+        }
+        pos += len;
+    }
+
+    if (algos & (1 << DIGEST_SHA1)) {
+        sha1_final(&state.sha1, out);
+        to_hex(hex[DIGEST_SHA1], out, SHA1_DIGEST_SIZE);
+    }
+    if (algos & (1 << DIGEST_SHA256)) {
+        sha256_final(&state.sha256, out);
+        to_hex(hex[DIGEST_SHA256], out, SHA256_DIGEST_SIZE);
+    }
+    if (algos & (1 << DIGEST_CRC32C)) {
+        sprintf(hex[DIGEST_CRC32C], "%08" PRIx32, state.crc32c);
+    }
+}
+
+/*
+ * Compute whichever digests of an entry are still missing.  BLAKE3 is
+ * done first since it's spread over many cores; the others are
+ * inherently serial, so they share a single generator pass.
+ */
+static void compute(digest_entry_t *entry, int ready) {
+    char hex[DIGEST_COUNT][DIGEST_HEX_MAX];
+    uint8_t out[BLAKE3_OUT_LEN];
+
+    if (!(ready & (1 << DIGEST_BLAKE3))) {
+        digest_blake3_range(&entry->stream, 0, entry->size, blake3_threads, out);
+        to_hex(hex[DIGEST_BLAKE3], out, BLAKE3_OUT_LEN);
+        pthread_mutex_lock(&entry_lock);
+        publish(entry, DIGEST_BLAKE3, hex[DIGEST_BLAKE3]);
+        pthread_mutex_unlock(&entry_lock);
+    }
+
+    int algos = ~ready & SERIAL_DIGESTS;
+    if (algos == 0) {
+        return;
+    }
+    serial_digests(&entry->stream, 0, entry->size, algos, hex);
+    pthread_mutex_lock(&entry_lock);
+    int algo;
+    for (algo=0; algo<DIGEST_COUNT; algo++) {
+        if (algos & (1 << algo)) {
+            publish(entry, algo, hex[algo]);
+        }
+    }
+    pthread_mutex_unlock(&entry_lock);
+}
+
+static void *digest_thread(void *arg) {
+    // stay out of the way of the threads serving reads
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), 10);
+
+    pthread_mutex_lock(&entry_lock);
+    for (;;) {
+        digest_entry_t *entry;
+        for (entry = entry_list; entry!=NULL; entry=entry->next) {
+            if (entry->state == ENTRY_QUEUED) {
+                break;
+            }
+        }
+        if (entry == NULL) {
+            pthread_cond_wait(&entry_cond, &entry_lock);
+            continue;
+        }
+
+        entry->state = ENTRY_RUNNING;
+        int ready = entry->ready;
+        pthread_mutex_unlock(&entry_lock);
+        compute(entry, ready);
+        pthread_mutex_lock(&entry_lock);
+        entry->state = ENTRY_IDLE;
+    }
+    return NULL;
+}
+
+int digest_start(const char *cache_path, int threads) {
+    blake3_threads = threads;
+    if (cache_path) {
+        int ret = cache_open(cache_path);
+        if (ret) {
+            fprintf(stderr, "warning: can't use digest cache %s: %s\n",
+                cache_path, strerror(-ret));
+        }
+    }
+
+    int i;
+    for (i=0; i<threads; i++) {
+        pthread_t thread;
+        int ret = pthread_create(&thread, NULL, digest_thread, NULL);
+        if (ret) {
+            return -ret;
+        }
+        pthread_detach(thread);
+    }
+    return 0;
+}
+
+int digest_lookup(uint64_t size, const gen_stream_t *stream, int algo, char *hex) {
+    int ret = -ENODATA;
+    pthread_mutex_lock(&entry_lock);
+    digest_entry_t *entry = get_entry(size, stream);
+    if (entry == NULL) {
+        pthread_mutex_unlock(&entry_lock);
+        return -ENOMEM;
+    }
+
+    // pick up anything computed by a previous run before queueing the
+    // entry, so that only the missing digests are computed
+    if (!(entry->ready & (1 << algo))) {
+        int a;
+        for (a=0; a<DIGEST_COUNT; a++) {
+            cache_key_t key = digest_key(size, stream, a);
+            if (cache_get(&key, entry->hex[a], digest_hex_len(a) + 1) == 0) {
+                entry->ready |= 1 << a;
+            }
+        }
+    }
+
+    if (entry->ready & (1 << algo)) {
+        strcpy(hex, entry->hex[algo]);
+        ret = 0;
+    } else if (entry->state == ENTRY_IDLE) {
+        entry->state = ENTRY_QUEUED;
+        pthread_cond_signal(&entry_cond);
+    }
+    pthread_mutex_unlock(&entry_lock);
+    return ret;
+}
+
+int digest_range(const gen_stream_t *stream, uint64_t offset, uint64_t length, int algo, char *hex) {
+    int i;
+
+    pthread_mutex_lock(&range_lock);
+    for (i=0; i<RANGE_LRU_SIZE; i++) {
+        range_entry_t *r = &range_lru[i];
+        if (r->last_used && same_stream(&r->stream, stream) && r->offset == offset &&
+            r->length == length && r->algo == algo) {
+            r->last_used = ++range_clock;
+            strcpy(hex, r->hex);
+            pthread_mutex_unlock(&range_lock);
+            return 0;
+        }
+    }
+    pthread_mutex_unlock(&range_lock);
+
+    if (algo == DIGEST_BLAKE3) {
+        uint8_t out[BLAKE3_OUT_LEN];
+        digest_blake3_range(stream, offset, length, blake3_threads, out);
+        to_hex(hex, out, BLAKE3_OUT_LEN);
+    } else {
+        char all[DIGEST_COUNT][DIGEST_HEX_MAX];
+        serial_digests(stream, offset, length, 1 << algo, all);
+        strcpy(hex, all[algo]);
+    }
+
+    // replace the least recently used entry
+    pthread_mutex_lock(&range_lock);
+    range_entry_t *victim = &range_lru[0];
+    for (i=1; i<RANGE_LRU_SIZE; i++) {
+        if (range_lru[i].last_used < victim->last_used) {
+            victim = &range_lru[i];
+        }
+    }
+    victim->stream = *stream;
+    victim->offset = offset;
+    victim->length = length;
+    victim->algo = algo;
+    victim->last_used = ++range_clock;
+    strcpy(victim->hex, hex);
+    pthread_mutex_unlock(&range_lock);
+    return 0;
+}
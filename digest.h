@@ -0,0 +1,86 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Whole-file reference digests of test files, computed lazily by a pool
+ * of background threads and remembered in a persistent cache across
+ * runs.
+ */
+
+#ifndef DIGEST_H
+#define DIGEST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gen.h"
+
+/* these numbers are stored in the cache file, so only append to them */
+enum {
+    DIGEST_SHA256,
+    DIGEST_CRC32C,
+    DIGEST_BLAKE3,
+    DIGEST_SHA1,
+    DIGEST_COUNT
+};
+
+/* large enough for the hex form of any digest, plus a NUL */
+#define DIGEST_HEX_MAX 65
+
+/*
+ * Return the short name ("sha256", ...) of a digest algorithm.
+ */
+const char *digest_name(int algo);
+
+/*
+ * Return the length of the hex form of a digest.
+ */
+size_t digest_hex_len(int algo);
+
+/*
+ * Load the cache file (if any) and start the hashing threads.  This
+ * must be called after FUSE has daemonized, since fork() doesn't carry
+ * threads along with it.
+ */
+int digest_start(const char *cache_path, int threads);
+
+/*
+ * Fetch the hex digest of the given size of a stream.  Never
+ * blocks on computation: if the digest isn't known yet, it's queued for
+ * the background threads and -ENODATA is returned.
+ */
+int digest_lookup(uint64_t size, const gen_stream_t *stream, int algo, char *hex);
+
+/*
+ * Compute the hex digest of an arbitrary byte range of a stream.  This
+ * blocks for as long as the computation takes; the most recent results
+ * are remembered.
+ */
+int digest_range(const gen_stream_t *stream, uint64_t offset, uint64_t length, int algo, char *hex);
+
+/*
+ * Compute the BLAKE3 digest of a byte range of a stream, spreading the
+ * generation and hashing of the range over the given number of threads
+ * (including the calling thread).
+ */
+void digest_blake3_range(const gen_stream_t *stream, uint64_t offset, uint64_t length,
+    int threads, uint8_t out[32]);
+
+#endif
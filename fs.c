@@ -0,0 +1,789 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <pthread.h>
+
+#include "fs.h"
+#include "gen.h"
+#include "digest.h"
+#include "torrent.h"
+#include "spec.h"
+#include "ring.h"
+#include "plugin.h"
+#include "pool.h"
+#include "node.h"
+#include "prio.h"
+
+/*
+ * A testfile_t structure details a specific test file which will be
+ * visible in the filesystem.
+ */
+typedef struct testfile_s {
+    char *name;
+    uint64_t size;
+    gen_stream_t stream;
+    char *generator;        // the plugin's spec field, or NULL
+    torrent_t *torrent;
+    int torrent_hashing;    // whether a thread is hashing its pieces
+    struct testfile_s *next;
+} testfile_t;
+static testfile_t *testfile_list = NULL;
+
+fs_config_t fs_config;
+
+/*
+ * Find the test file corresponding to a path, or NULL.
+ */
+static testfile_t *lookup_testfile(const char *path) {
+    // skip the leading slash
+    if (path[0] == '/') {
+        path++;
+    }
+
+    testfile_t *testfile;
+    for (testfile = testfile_list; testfile!=NULL; testfile=testfile->next) {
+        if (strcmp(path, testfile->name) == 0) {
+            break;
+        }
+    }
+    return testfile;
+}
+
+/*
+ * The /.hash directory holds a subdirectory for each test file, in
+ * which any file named "<offset>-<length>.<algo>" can be opened to read
+ * the digest of that byte range of the test file.  Digests are computed
+ * when first read.
+ */
+#define HASH_DIR "/.hash"
+
+typedef enum {
+    HASH_PATH_NONE,
+    HASH_PATH_ROOT,
+    HASH_PATH_FILE_DIR,
+    HASH_PATH_RANGE
+} hash_path_type_t;
+
+typedef struct hash_path_s {
+    testfile_t *testfile;
+    uint64_t offset;
+    uint64_t length;
+    int algo;
+} hash_path_t;
+
+static hash_path_type_t parse_hash_path(const char *path, hash_path_t *hp) {
+    size_t len = strlen(HASH_DIR);
+    if (strncmp(path, HASH_DIR, len) != 0) {
+        return HASH_PATH_NONE;
+    }
+    path += len;
+    if (path[0] == '\0') {
+        return HASH_PATH_ROOT;
+    }
+    if (path[0] != '/') {
+        return HASH_PATH_NONE;
+    }
+    path++;
+
+    // test file names can't contain a slash
+    const char *range = strchr(path, '/');
+    char name[PATH_MAX];
+    len = range ? range - path : strlen(path);
+    if (len >= sizeof(name)) {
+        return HASH_PATH_NONE;
+    }
+    memcpy(name, path, len);
+    name[len] = '\0';
+    hp->testfile = lookup_testfile(name);
+    if (hp->testfile == NULL) {
+        return HASH_PATH_NONE;
+    }
+    if (range == NULL) {
+        return HASH_PATH_FILE_DIR;
+    }
+    range++;
+
+    char *endptr;
+    if (*range < '0' || *range > '9') {
+        return HASH_PATH_NONE;
+    }
+    hp->offset = parse_size(range, &endptr);
+    if (*endptr != '-' || endptr[1] < '0' || endptr[1] > '9') {
+        return HASH_PATH_NONE;
+    }
+    hp->length = parse_size(endptr+1, &endptr);
+    if (*endptr != '.') {
+        return HASH_PATH_NONE;
+    }
+    for (hp->algo=0; hp->algo<DIGEST_COUNT; hp->algo++) {
+        if (strcmp(endptr+1, digest_name(hp->algo)) == 0) {
+            break;
+        }
+    }
+    if (hp->algo == DIGEST_COUNT) {
+        return HASH_PATH_NONE;
+    }
+    if (hp->offset > hp->testfile->size ||
+        hp->length > hp->testfile->size - hp->offset) {
+        return HASH_PATH_NONE;
+    }
+    return HASH_PATH_RANGE;
+}
+
+/*
+ * The /.torrent directory holds "<name>.torrent" BitTorrent metainfo
+ * for each test file.  The layout (and so the size) of the metainfo is
+ * known up front, but the piece hashes are computed on first open.
+ */
+#define TORRENT_DIR "/.torrent"
+#define TORRENT_SUFFIX ".torrent"
+static pthread_mutex_t torrent_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t torrent_hashed = PTHREAD_COND_INITIALIZER;
+
+typedef enum {
+    TORRENT_PATH_NONE,
+    TORRENT_PATH_ROOT,
+    TORRENT_PATH_FILE
+} torrent_path_type_t;
+
+static torrent_path_type_t parse_torrent_path(const char *path, testfile_t **testfile) {
+    size_t len = strlen(TORRENT_DIR);
+    if (strncmp(path, TORRENT_DIR, len) != 0) {
+        return TORRENT_PATH_NONE;
+    }
+    path += len;
+    if (path[0] == '\0') {
+        return TORRENT_PATH_ROOT;
+    }
+    if (path[0] != '/') {
+        return TORRENT_PATH_NONE;
+    }
+    path++;
+
+    char name[PATH_MAX];
+    len = strlen(path);
+    if (len <= strlen(TORRENT_SUFFIX) || len >= sizeof(name) ||
+        strcmp(path + len - strlen(TORRENT_SUFFIX), TORRENT_SUFFIX) != 0) {
+        return TORRENT_PATH_NONE;
+    }
+    len -= strlen(TORRENT_SUFFIX);
+    memcpy(name, path, len);
+    name[len] = '\0';
+    *testfile = lookup_testfile(name);
+    return *testfile ? TORRENT_PATH_FILE : TORRENT_PATH_NONE;
+}
+
+/*
+ * Get the metainfo for a test file, laying it out on first use and
+ * hashing the pieces if asked to.  Must be called with torrent_lock
+ * held, which is dropped while hashing (which can take minutes for a
+ * large file) so that other torrents aren't held up; anyone else after
+ * the same file's hashes waits for them.
+ */
+static torrent_t *get_torrent(testfile_t *testfile, int hash) {
+    if (testfile->torrent == NULL) {
+        torrent_t *torrent = malloc(sizeof(torrent_t));
+        if (torrent == NULL) {
+            return NULL;
+        }
+        uint32_t len = fs_config.piece_length ? fs_config.piece_length :
+            torrent_piece_length(testfile->size);
+        if (torrent_init(torrent, testfile->name, testfile->size, &testfile->stream,
+                len, fs_config.announce)) {
+            free(torrent);
+            return NULL;
+        }
+        testfile->torrent = torrent;
+    }
+    while (hash && testfile->torrent_hashing) {
+        pthread_cond_wait(&torrent_hashed, &torrent_lock);
+    }
+    if (hash && !testfile->torrent->hashed) {
+        testfile->torrent_hashing = 1;
+        pthread_mutex_unlock(&torrent_lock);
+        int ret = torrent_hash(testfile->torrent, fs_config.hash_threads);
+        pthread_mutex_lock(&torrent_lock);
+        testfile->torrent_hashing = 0;
+        pthread_cond_broadcast(&torrent_hashed);
+        if (ret) {
+            return NULL;
+        }
+    }
+    return testfile->torrent;
+}
+
+/*
+ * /.stats is a text snapshot of the daemon's counters (how much each
+ * generator plugin has generated, ...), taken when it's opened.  Its
+ * length isn't known until then, so it's read with direct I/O.
+ */
+#define STATS_PATH "/.stats"
+#define STATS_MAX (64*1024)
+
+typedef struct stats_snapshot_s {
+    size_t len;
+    char text[STATS_MAX];
+} stats_snapshot_t;
+
+static void render_stats(stats_snapshot_t *snap) {
+    snap->len = pool_stats(snap->text, sizeof(snap->text));
+    snap->len += plugin_stats(snap->text + snap->len, sizeof(snap->text) - snap->len);
+    snap->len += node_stats(snap->text + snap->len, sizeof(snap->text) - snap->len);
+    snap->len += prio_stats(snap->text + snap->len, sizeof(snap->text) - snap->len);
+}
+
+/*
+ * FUSE operation for delivering stat(2) data about our files.
+ */
+static int fop_getattr(const char *path, struct stat *st) {
+    int ret = 0;
+
+    memset(st, 0, sizeof(struct stat));
+    if (strcmp(path, "/") == 0) {
+        st->st_mode = S_IFDIR | 0755;
+        st->st_nlink = 2;
+        return 0;
+    }
+    if (strcmp(path, STATS_PATH) == 0) {
+        st->st_mode = S_IFREG | 0444;
+        st->st_nlink = 1;
+        return 0;
+    }
+
+    hash_path_t hp;
+    switch (parse_hash_path(path, &hp)) {
+    case HASH_PATH_NONE:
+        break;
+    case HASH_PATH_RANGE:
+        st->st_mode = S_IFREG | 0444;
+        st->st_nlink = 1;
+        st->st_size = digest_hex_len(hp.algo) + 1;
+        return 0;
+    default:
+        st->st_mode = S_IFDIR | 0555;
+        st->st_nlink = 2;
+        return 0;
+    }
+
+    testfile_t *testfile;
+    switch (parse_torrent_path(path, &testfile)) {
+    case TORRENT_PATH_NONE:
+        break;
+    case TORRENT_PATH_ROOT:
+        st->st_mode = S_IFDIR | 0555;
+        st->st_nlink = 2;
+        return 0;
+    case TORRENT_PATH_FILE:
+        pthread_mutex_lock(&torrent_lock);
+        torrent_t *torrent = get_torrent(testfile, 0);
+        if (torrent) {
+            st->st_mode = S_IFREG | 0444;
+            st->st_nlink = 1;
+            st->st_size = torrent->len;
+        }
+        pthread_mutex_unlock(&torrent_lock);
+        return torrent ? 0 : -ENOMEM;
+    }
+
+    // skip the leading slash
+    if (path[0] == '/') {
+        path++;
+    }
+
+    for (testfile = testfile_list; testfile!=NULL; testfile=testfile->next) {
+        if (strcmp(path, testfile->name) == 0) {
+            st->st_mode = S_IFREG | 0444;
+            st->st_nlink = 1;
+            st->st_size = testfile->size;
+            return ret;
+        }
+    }
+
+    return -ENOENT;
+}
+
+/*
+ * The FUSE operation for delivering the directory list.
+ */
+static int fop_readdir(
+    const char *path,
+    void *buf,
+    fuse_fill_dir_t filler,
+    off_t offset,
+    struct fuse_file_info *fi
+) {
+    hash_path_t hp;
+    switch (parse_hash_path(path, &hp)) {
+    case HASH_PATH_NONE:
+        break;
+    case HASH_PATH_ROOT:
+        filler(buf, ".", NULL, 0);
+        filler(buf, "..", NULL, 0);
+        testfile_t *testfile;
+        for (testfile = testfile_list; testfile!=NULL; testfile=testfile->next) {
+            filler(buf, testfile->name, NULL, 0);
+        }
+        return 0;
+    case HASH_PATH_FILE_DIR:
+        // range digests can't be listed, only looked up
+        filler(buf, ".", NULL, 0);
+        filler(buf, "..", NULL, 0);
+        return 0;
+    default:
+        return -ENOTDIR;
+    }
+
+    testfile_t *testfile;
+    switch (parse_torrent_path(path, &testfile)) {
+    case TORRENT_PATH_NONE:
+        break;
+    case TORRENT_PATH_ROOT:
+        filler(buf, ".", NULL, 0);
+        filler(buf, "..", NULL, 0);
+        for (testfile = testfile_list; testfile!=NULL; testfile=testfile->next) {
+            char name[PATH_MAX];
+            snprintf(name, sizeof(name), "%s" TORRENT_SUFFIX, testfile->name);
+            filler(buf, name, NULL, 0);
+        }
+        return 0;
+    default:
+        return -ENOTDIR;
+    }
+
+    if (strcmp(path, "/") != 0) {
+        return -ENOENT;
+    }
+
+    filler(buf, ".", NULL, 0);
+    filler(buf, "..", NULL, 0);
+    for (testfile = testfile_list; testfile!=NULL; testfile=testfile->next) {
+        filler(buf, testfile->name, NULL, 0);
+    }
+
+    return 0;
+}
+
+/*
+ * The FUSE operation for open().
+ */
+static int fop_open(const char *path, struct fuse_file_info *fi) {
+    if (strcmp(path, STATS_PATH) == 0) {
+        if ((fi->flags & 3) != O_RDONLY) {
+            return -EACCES;
+        }
+        stats_snapshot_t *snap = malloc(sizeof(stats_snapshot_t));
+        if (snap == NULL) {
+            return -ENOMEM;
+        }
+        render_stats(snap);
+        fi->fh = (uintptr_t)snap;
+        fi->direct_io = 1;
+        return 0;
+    }
+
+    hash_path_t hp;
+    switch (parse_hash_path(path, &hp)) {
+    case HASH_PATH_NONE:
+        break;
+    case HASH_PATH_RANGE:
+        return ((fi->flags & 3) != O_RDONLY) ? -EACCES : 0;
+    default:
+        return -EISDIR;
+    }
+
+    testfile_t *testfile;
+    switch (parse_torrent_path(path, &testfile)) {
+    case TORRENT_PATH_NONE:
+        break;
+    case TORRENT_PATH_ROOT:
+        return -EISDIR;
+    case TORRENT_PATH_FILE:
+        if ((fi->flags & 3) != O_RDONLY) {
+            return -EACCES;
+        }
+        // hash the pieces now, so that reads are quick
+        pthread_mutex_lock(&torrent_lock);
+        torrent_t *torrent = get_torrent(testfile, 1);
+        pthread_mutex_unlock(&torrent_lock);
+        return torrent ? 0 : -ENOMEM;
+    }
+
+    // skip the leading slash
+    if (path[0] == '/') {
+        path++;
+    }
+
+    for (testfile = testfile_list; testfile!=NULL; testfile=testfile->next) {
+        if (strcmp(path, testfile->name) == 0) {
+            if ((fi->flags & 3) != O_RDONLY) {
+                return -EACCES;
+            } else {
+                return 0;
+            }
+        }
+    }
+    return -ENOENT;
+}
+
+/*
+ * Deliver the content of a /.hash range file: the hex digest and a
+ * newline.
+ */
+static int read_range_digest(hash_path_t *hp, char *buf, size_t size, off_t offset) {
+    char hex[DIGEST_HEX_MAX + 1];
+    int ret = digest_range(&hp->testfile->stream, hp->offset, hp->length, hp->algo, hex);
+    if (ret) {
+        return ret;
+    }
+    strcat(hex, "\n");
+
+    size_t len = strlen(hex);
+    if (offset >= len) {
+        return 0;
+    }
+    if (size > len - offset) {
+        size = len - offset;
+    }
+    memcpy(buf, hex + offset, size);
+    return size;
+}
+
+/*
+ * Deliver the content of a /.torrent file.
+ */
+static int read_torrent(testfile_t *testfile, char *buf, size_t size, off_t offset) {
+    pthread_mutex_lock(&torrent_lock);
+    torrent_t *torrent = get_torrent(testfile, 1);
+    if (torrent == NULL) {
+        pthread_mutex_unlock(&torrent_lock);
+        return -ENOMEM;
+    }
+    if (offset >= torrent->len) {
+        size = 0;
+    } else if (size > torrent->len - offset) {
+        size = torrent->len - offset;
+    }
+    memcpy(buf, torrent->data + offset, size);
+    pthread_mutex_unlock(&torrent_lock);
+    return size;
+}
+
+/*
+ * FUSE operation for fulfilling read() requests.
+ */
+static int fop_read(
+    const char *path,
+    char *buf,
+    size_t size,
+    off_t abs_offset,
+    struct fuse_file_info *fi
+) {
+    if (strcmp(path, STATS_PATH) == 0) {
+        stats_snapshot_t *snap = (stats_snapshot_t *)(uintptr_t)fi->fh;
+        if (abs_offset >= snap->len) {
+            return 0;
+        }
+        if (size > snap->len - abs_offset) {
+            size = snap->len - abs_offset;
+        }
+        memcpy(buf, snap->text + abs_offset, size);
+        return size;
+    }
+
+    hash_path_t hp;
+    if (parse_hash_path(path, &hp) == HASH_PATH_RANGE) {
+        return read_range_digest(&hp, buf, size, abs_offset);
+    }
+
+    testfile_t *testfile;
+    if (parse_torrent_path(path, &testfile) == TORRENT_PATH_FILE) {
+        return read_torrent(testfile, buf, size, abs_offset);
+    }
+
+    // lookup the file
+    testfile = lookup_testfile(path);
+    if (testfile == NULL) {
+        return -ENOENT;
+    }
+
+    // limit to the size of the file
+    if (abs_offset >= testfile->size) {
+        return 0;
+    }
+    if (abs_offset + size > testfile->size) {
+        size = testfile->size - abs_offset;
+    }
+
+    pool_range(&testfile->stream, buf, size, abs_offset, prio_read_class(size) == PRIO_BULK);
+
+    return size;
+}
+
+/*
+ * The FUSE operation for close(), which only matters to /.stats.
+ */
+static int fop_release(const char *path, struct fuse_file_info *fi) {
+    if (strcmp(path, STATS_PATH) == 0) {
+        free((stats_snapshot_t *)(uintptr_t)fi->fh);
+    }
+    return 0;
+}
+
+/*
+ * The error for an extended attribute a path doesn't have: only test
+ * files have any, but the other paths fop_getattr() knows of exist.
+ */
+static int xattr_missing(const char *path) {
+    hash_path_t hp;
+    testfile_t *testfile;
+    if (strcmp(path, "/") == 0 || strcmp(path, STATS_PATH) == 0 ||
+        parse_hash_path(path, &hp) != HASH_PATH_NONE ||
+        parse_torrent_path(path, &testfile) != TORRENT_PATH_NONE) {
+        return -ENODATA;
+    }
+    return -ENOENT;
+}
+
+/*
+ * Copy an extended attribute value (or name list) out to the caller,
+ * following the getxattr(2) convention that a zero size asks for the
+ * length only.
+ */
+static int xattr_reply(char *buf, size_t size, const char *value, size_t len) {
+    if (size == 0) {
+        return len;
+    }
+    if (size < len) {
+        return -ERANGE;
+    }
+    memcpy(buf, value, len);
+    return len;
+}
+
+#define XATTR_PREFIX "user.testfuse."
+
+/*
+ * FUSE operation for getxattr().  Each test file carries its size and
+ * seed, plus reference digests of its content.  The digests are
+ * computed in the background on first request; until they're ready,
+ * ENODATA is returned rather than blocking the caller.
+ */
+static int fop_getxattr(const char *path, const char *name, char *buf, size_t size) {
+    testfile_t *testfile = lookup_testfile(path);
+    if (testfile == NULL) {
+        return xattr_missing(path);
+    }
+    if (strncmp(name, XATTR_PREFIX, strlen(XATTR_PREFIX)) != 0) {
+        return -ENODATA;
+    }
+    name += strlen(XATTR_PREFIX);
+
+    char value[DIGEST_HEX_MAX];
+    if (strcmp(name, "size") == 0) {
+        snprintf(value, sizeof(value), "%" PRIu64, testfile->size);
+    } else if (strcmp(name, "seed") == 0) {
+        snprintf(value, sizeof(value), "%" PRIu32, testfile->stream.seed);
+    } else if (strcmp(name, "generator") == 0 && testfile->generator) {
+        return xattr_reply(buf, size, testfile->generator, strlen(testfile->generator));
+    } else {
+        int algo;
+        for (algo=0; algo<DIGEST_COUNT; algo++) {
+            if (strcmp(name, digest_name(algo)) == 0) {
+                break;
+            }
+        }
+        if (algo == DIGEST_COUNT) {
+            return -ENODATA;
+        }
+        int ret = digest_lookup(testfile->size, &testfile->stream, algo, value);
+        if (ret) {
+            return ret;
+        }
+    }
+    return xattr_reply(buf, size, value, strlen(value));
+}
+
+/*
+ * FUSE operation for listxattr().
+ */
+static int fop_listxattr(const char *path, char *buf, size_t size) {
+    testfile_t *testfile = lookup_testfile(path);
+    if (testfile == NULL) {
+        // other paths have no attributes to list
+        return xattr_missing(path) == -ENODATA ? 0 : -ENOENT;
+    }
+
+    char list[256];
+    size_t len = 0;
+    len += sprintf(list+len, XATTR_PREFIX "size") + 1;
+    len += sprintf(list+len, XATTR_PREFIX "seed") + 1;
+    if (testfile->generator) {
+        len += sprintf(list+len, XATTR_PREFIX "generator") + 1;
+    }
+    int algo;
+    for (algo=0; algo<DIGEST_COUNT; algo++) {
+        len += sprintf(list+len, XATTR_PREFIX "%s", digest_name(algo)) + 1;
+    }
+    return xattr_reply(buf, size, list, len);
+}
+
+/*
+ * Resolve a name asked for over the ring socket.
+ */
+static int ring_lookup(const char *name, uint64_t *size, gen_stream_t *stream, void *arg) {
+    testfile_t *testfile = lookup_testfile(name);
+    if (testfile == NULL) {
+        return -1;
+    }
+    *size = testfile->size;
+    *stream = testfile->stream;
+    return 0;
+}
+
+/*
+ * The client making the current request, if we can tell.
+ */
+static prio_client_t *request_client(void) {
+    return fs_config.client ? prio_client(fs_config.client()) : NULL;
+}
+
+/*
+ * The operations as FUSE calls them, each timed as its class, with
+ * bulk reads waiting for a slot first.
+ */
+static int prio_getattr(const char *path, struct stat *st) {
+    prio_ticket_t ticket;
+    prio_begin(PRIO_META, request_client(), 0, &ticket);
+    int ret = fop_getattr(path, st);
+    prio_end(&ticket, 0);
+    return ret;
+}
+
+static int prio_readdir(
+    const char *path,
+    void *buf,
+    fuse_fill_dir_t filler,
+    off_t offset,
+    struct fuse_file_info *fi
+) {
+    prio_ticket_t ticket;
+    prio_begin(PRIO_META, request_client(), 0, &ticket);
+    int ret = fop_readdir(path, buf, filler, offset, fi);
+    prio_end(&ticket, 0);
+    return ret;
+}
+
+static int prio_open(const char *path, struct fuse_file_info *fi) {
+    prio_ticket_t ticket;
+    prio_begin(PRIO_META, request_client(), 0, &ticket);
+    int ret = fop_open(path, fi);
+    prio_end(&ticket, 0);
+    return ret;
+}
+
+static int prio_read(
+    const char *path,
+    char *buf,
+    size_t size,
+    off_t abs_offset,
+    struct fuse_file_info *fi
+) {
+    prio_ticket_t ticket;
+    prio_begin(prio_read_class(size), request_client(), size, &ticket);
+    int ret = fop_read(path, buf, size, abs_offset, fi);
+    prio_end(&ticket, ret > 0 ? ret : 0);
+    return ret;
+}
+
+static int prio_getxattr(const char *path, const char *name, char *buf, size_t size) {
+    prio_ticket_t ticket;
+    prio_begin(PRIO_META, request_client(), 0, &ticket);
+    int ret = fop_getxattr(path, name, buf, size);
+    prio_end(&ticket, 0);
+    return ret;
+}
+
+/*
+ * Called once FUSE has set up (and possibly daemonized), so it's the
+ * place to start any threads of our own.
+ */
+static void *fop_init(struct fuse_conn_info *conn) {
+    prio_config(fs_config.bulk_size, fs_config.bulk_threads);
+    if (digest_start(fs_config.hashcache, fs_config.hash_threads)) {
+        fprintf(stderr, "warning: can't start digest threads\n");
+    }
+    if (pool_start(fs_config.read_threads, fs_config.bulk_threads)) {
+        fprintf(stderr, "warning: can't start read threads\n");
+    }
+    if (fs_config.ring && ring_serve(fs_config.ring, ring_lookup, NULL, sysconf(_SC_NPROCESSORS_ONLN))) {
+        fprintf(stderr, "warning: can't serve rings on %s\n", fs_config.ring);
+    }
+    return NULL;
+}
+
+/*
+ * Define our basic FUSE file operations.
+ */
+struct fuse_operations fs_operations = {
+    .getattr        = prio_getattr,
+    .readdir        = prio_readdir,
+    .open           = prio_open,
+    .read           = prio_read,
+    .release        = fop_release,
+    .getxattr       = prio_getxattr,
+    .listxattr      = fop_listxattr,
+    .init           = fop_init,
+};
+
+int fs_add_file(const spec_t *spec, const char *plugin_dir) {
+    testfile_t *testfile = malloc(sizeof(testfile_t));
+    if (testfile == NULL || (testfile->name = strdup(spec->name)) == NULL) {
+        fprintf(stderr, "error: out of memory\n");
+        return -1;
+    }
+    testfile->size = spec->size;
+    testfile->stream = GEN_STREAM(spec->seed);
+    testfile->generator = NULL;
+    testfile->torrent = NULL;
+    testfile->torrent_hashing = 0;
+    if (spec->generator) {
+        plugin_t *plugin = plugin_load(spec->generator, plugin_dir);
+        if (plugin == NULL) {
+            free(testfile->name);
+            free(testfile);
+            return -1;
+        }
+        plugin_stream(plugin, spec->seed, &testfile->stream);
+        testfile->generator = (char *)plugin_field(plugin);
+    }
+    testfile->next = testfile_list;
+    testfile_list = testfile;
+    return 0;
+}
@@ -0,0 +1,64 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * The testfuse filesystem, apart from the command line: the test files
+ * and the FUSE operations which serve them.  testfuse mounts it, and
+ * fsbench calls the operations directly.
+ */
+
+#ifndef FS_H
+#define FS_H
+
+#define FUSE_USE_VERSION 26
+#include <fuse.h>
+#include <stdint.h>
+
+#include "spec.h"
+
+typedef struct fs_config_s {
+    char *hashcache;            // digest cache file (absolute), or NULL
+    unsigned int hash_threads;
+    unsigned int read_threads;  // helping with large reads (see pool.h)
+    size_t bulk_size;           // reads this large are bulk (see prio.h)
+    unsigned int bulk_threads;  // bulk reads served at once, and the
+                                // threads generating them
+    uint32_t (*client)(void);   // ID of who's asking, for sharing them
+                                // fairly, or NULL
+    uint32_t piece_length;      // of .torrent pieces, or 0 to pick by size
+    char *announce;             // .torrent tracker URL, or NULL
+    char *ring;                 // ring socket path (absolute), or NULL
+} fs_config_t;
+
+/*
+ * Set before the filesystem is mounted (or driven).
+ */
+extern fs_config_t fs_config;
+
+extern struct fuse_operations fs_operations;
+
+/*
+ * Add a test file, loading the generator plugin it names (if any) from
+ * plugin_dir (see plugin_load()).  Returns 0, or -1 after reporting the
+ * problem on stderr.
+ */
+int fs_add_file(const spec_t *spec, const char *plugin_dir);
+
+#endif
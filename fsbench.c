@@ -0,0 +1,429 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Benchmark the filesystem's own code with FUSE and the kernel taken
+ * out of the picture: the FUSE operations are called directly, from
+ * several threads, with synthetic request streams, which gives an upper
+ * bound on what a mount could deliver and shows regressions in the
+ * daemon without needing a mount.
+ *
+ * Usage:
+ *     ./fsbench [-d seconds] [-b size] [-t max-threads] [-p read-threads]
+ *               [-q bulk-threads] [-f] [-n numa-nodes]
+ *               [-w workload[,...]] [file-spec-list]
+ *
+ * Each workload runs for the given time (default 1 second) with 1, 2,
+ * 4, ... threads up to the number of CPUs, reporting the operations
+ * done, the average time per operation, and the data rate:
+ *
+ *     seq      sequential reads of -b bytes (default 128K, FUSE's usual
+ *              largest read), each thread in its own part of the file
+ *     rand     reads of -b bytes at random 4K-aligned offsets
+ *     mixed    reads of 4K to 1M at random offsets
+ *     getattr  stat() of a test file
+ *     open     open() and close() of a test file
+ *     readdir  listing the root directory
+ *
+ * The file-spec-list (default "bench,64G,1") may name generator
+ * plugins; reads go to each listed file in turn.  As in testfuse, large
+ * reads are split over a pool of -p threads (default: CPUs - 1), and
+ * reads of 128K or more are bulk reads, served -q at a time, and
+ * generated by no more than -q threads, helpers included (default:
+ * CPUs / 2); the latency of each class of request over the whole run is
+ * printed at the end.  With -f, each benchmark thread counts as a
+ * separate client in sharing the bulk slots, and each one's throughput
+ * is printed too.
+ *
+ * -n binds the benchmark to NUMA nodes as -o numa_nodes does testfuse,
+ * the CPU counts then being those of the nodes, and reports afterwards
+ * what was generated on each node and how much of it went to remote
+ * memory.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "fs.h"
+#include "spec.h"
+#include "node.h"
+#include "prio.h"
+
+#define MIXED_MIN (4*1024)
+#define MIXED_SHIFTS 9          // so up to 1M
+#define CLOCK_EVERY 16
+
+typedef enum {
+    WORK_SEQ,
+    WORK_RAND,
+    WORK_MIXED,
+    WORK_GETATTR,
+    WORK_OPEN,
+    WORK_READDIR,
+    WORK_COUNT
+} workload_t;
+
+static const char *workload_names[WORK_COUNT] = {
+    [WORK_SEQ] = "seq",
+    [WORK_RAND] = "rand",
+    [WORK_MIXED] = "mixed",
+    [WORK_GETATTR] = "getattr",
+    [WORK_OPEN] = "open",
+    [WORK_READDIR] = "readdir",
+};
+
+typedef struct bench_file_s {
+    char path[PATH_MAX];
+    uint64_t size;
+} bench_file_t;
+
+static bench_file_t *files;
+static int nfiles;
+static size_t block_size = 128*1024;
+static double duration = 1.0;
+static __thread uint32_t thread_client;
+
+typedef struct worker_s {
+    pthread_t thread;
+    workload_t work;
+    int index;
+    int nthreads;
+    double deadline;
+
+    uint64_t ops;
+    uint64_t bytes;
+    double busy;
+    int failed;
+} worker_t;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint32_t bench_client(void) {
+    return thread_client;
+}
+
+static uint64_t xorshift64(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+static int count_entry(void *buf, const char *name, const struct stat *st, off_t off) {
+    (*(int *)buf)++;
+    return 0;
+}
+
+/*
+ * Do one operation of a workload, returning the bytes read or -1.
+ */
+static ssize_t do_op(worker_t *w, char *buf, uint64_t *rng, uint64_t *pos,
+    struct fuse_file_info *fi
+) {
+    bench_file_t *file = &files[w->ops % nfiles];
+    uint64_t offset;
+    size_t size = block_size;
+    struct stat st;
+    int entries = 0;
+
+    switch (w->work) {
+    case WORK_SEQ:
+        if (*pos + size > file->size) {
+            *pos = 0;
+        }
+        offset = *pos;
+        *pos += size;
+        break;
+    case WORK_RAND:
+        offset = xorshift64(rng) % (file->size / 4096) * 4096;
+        break;
+    case WORK_MIXED:
+        size = (size_t)MIXED_MIN << (xorshift64(rng) % MIXED_SHIFTS);
+        offset = xorshift64(rng) % file->size;
+        break;
+    case WORK_GETATTR:
+        return fs_operations.getattr(file->path, &st) == 0 ? 0 : -1;
+    case WORK_OPEN:
+        if (fs_operations.open(file->path, fi) != 0) {
+            return -1;
+        }
+        fs_operations.release(file->path, fi);
+        return 0;
+    case WORK_READDIR:
+        return fs_operations.readdir("/", &entries, count_entry, 0, fi) == 0 ? 0 : -1;
+    default:
+        return -1;
+    }
+    if (offset + size > file->size) {
+        size = file->size - offset;
+    }
+    return fs_operations.read(file->path, buf, size, offset, fi);
+}
+
+static void *worker_thread(void *arg) {
+    worker_t *w = arg;
+    thread_client = w->index;
+    size_t buf_size = block_size > (size_t)MIXED_MIN << (MIXED_SHIFTS-1) ?
+        block_size : (size_t)MIXED_MIN << (MIXED_SHIFTS-1);
+    char *buf;
+    if (posix_memalign((void **)&buf, 4096, buf_size) != 0) {
+        w->failed = 1;
+        return NULL;
+    }
+    uint64_t rng = 0x9e3779b97f4a7c15ULL * (w->index + 1);
+    uint64_t pos = files[0].size / w->nthreads * w->index / block_size * block_size;
+    struct fuse_file_info fi;
+    memset(&fi, 0, sizeof(fi));
+    fi.flags = O_RDONLY;
+
+    double start = now();
+    double t = start;
+    while (t < w->deadline) {
+        int i;
+        for (i=0; i<CLOCK_EVERY; i++) {
+            ssize_t n = do_op(w, buf, &rng, &pos, &fi);
+            if (n < 0) {
+                w->failed = 1;
+                break;
+            }
+            w->bytes += n;
+            w->ops++;
+        }
+        if (w->failed) {
+            break;
+        }
+        t = now();
+    }
+    w->busy = t - start;
+    free(buf);
+    return NULL;
+}
+
+static int run(workload_t work, int nthreads) {
+    worker_t workers[nthreads];
+    int i;
+    memset(workers, 0, sizeof(workers));
+    double start = now();
+    for (i=0; i<nthreads; i++) {
+        workers[i].work = work;
+        workers[i].index = i;
+        workers[i].nthreads = nthreads;
+        workers[i].deadline = start + duration;
+        if (pthread_create(&workers[i].thread, NULL, worker_thread, &workers[i]) != 0) {
+            fprintf(stderr, "error: can't start threads\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    uint64_t ops = 0, bytes = 0;
+    double busy = 0;
+    int failed = 0;
+    for (i=0; i<nthreads; i++) {
+        pthread_join(workers[i].thread, NULL);
+        ops += workers[i].ops;
+        bytes += workers[i].bytes;
+        busy += workers[i].busy;
+        failed |= workers[i].failed;
+    }
+    double elapsed = now() - start;
+    if (failed) {
+        fprintf(stderr, "error: %s failed\n", workload_names[work]);
+        return -1;
+    }
+    printf("%-8s %7d  %12" PRIu64 "  %10.1f  %8.2f\n", workload_names[work], nthreads, ops,
+        ops ? busy * 1e9 / ops : 0.0, bytes / elapsed / 1e9);
+    return 0;
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: fsbench [-d seconds] [-b size] [-t max-threads] [-p read-threads] [-q bulk-threads] [-f] [-n numa-nodes] [-w workload[,...]] [filename,size,seed[,generator][/...]]\n");
+    fprintf(stderr, "    workloads: seq, rand, mixed, getattr, open, readdir (default: all)\n");
+}
+
+int main(int argc, char **argv) {
+    int max_threads = 0;
+    int read_threads = -1;
+    int bulk_threads = -1;
+    int fair = 0;
+    char *nodes = NULL;
+    int workloads = (1 << WORK_COUNT) - 1;
+    char *endptr;
+    int opt;
+    while ((opt = getopt(argc, argv, "d:b:t:p:q:fn:w:")) != -1) {
+        switch (opt) {
+        case 'd':
+            duration = strtod(optarg, &endptr);
+            if (*endptr != '\0' || duration <= 0) {
+                usage();
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'b':
+            block_size = parse_size(optarg, &endptr);
+            if (*endptr != '\0' || block_size == 0 || block_size > 64*1024*1024) {
+                usage();
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 't':
+            max_threads = atoi(optarg);
+            if (max_threads < 1) {
+                usage();
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'p':
+            read_threads = strtol(optarg, &endptr, 0);
+            if (*endptr != '\0' || read_threads < 0) {
+                usage();
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'q':
+            bulk_threads = strtol(optarg, &endptr, 0);
+            if (*endptr != '\0' || bulk_threads < 1) {
+                usage();
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'f':
+            fair = 1;
+            break;
+        case 'n':
+            nodes = optarg;
+            break;
+        case 'w':
+            workloads = 0;
+            char *save;
+            char *name;
+            for (name = strtok_r(optarg, ",", &save); name; name = strtok_r(NULL, ",", &save)) {
+                int work;
+                for (work=0; work<WORK_COUNT; work++) {
+                    if (strcmp(name, workload_names[work]) == 0) {
+                        break;
+                    }
+                }
+                if (work == WORK_COUNT) {
+                    usage();
+                    exit(EXIT_FAILURE);
+                }
+                workloads |= 1 << work;
+            }
+            break;
+        default:
+            usage();
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (argc - optind > 1) {
+        usage();
+        exit(EXIT_FAILURE);
+    }
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nodes) {
+        cpus = node_bind(nodes);
+        if (cpus < 0) {
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (max_threads == 0) {
+        max_threads = cpus;
+    }
+    if (read_threads < 0) {
+        read_threads = cpus - 1;
+    }
+    if (bulk_threads < 0) {
+        bulk_threads = cpus > 1 ? cpus / 2 : 1;
+    }
+
+    char default_list[] = "bench,64G,1";
+    spec_t *specs = parse_spec_list_generators(argc > optind ? argv[optind] : default_list);
+    if (specs == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    spec_t *spec;
+    for (spec = specs; spec!=NULL; spec=spec->next) {
+        nfiles++;
+    }
+    files = calloc(nfiles, sizeof(bench_file_t));
+    if (files == NULL) {
+        fprintf(stderr, "error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    int i = 0;
+    for (spec = specs; spec!=NULL; spec=spec->next, i++) {
+        if (fs_add_file(spec, NULL) != 0) {
+            exit(EXIT_FAILURE);
+        }
+        snprintf(files[i].path, sizeof(files[i].path), "/%s", spec->name);
+        files[i].size = spec->size;
+        if (files[i].size < block_size || files[i].size < 4096) {
+            fprintf(stderr, "error: %s is smaller than a read\n", spec->name);
+            exit(EXIT_FAILURE);
+        }
+    }
+    fs_config.hash_threads = 1;
+    fs_config.read_threads = read_threads;
+    fs_config.bulk_threads = bulk_threads;
+    if (fair) {
+        fs_config.client = bench_client;
+        prio_fair("thread", NULL);
+    }
+    fs_operations.init(NULL);
+
+    printf("workload threads           ops       ns/op      GB/s\n");
+    int work;
+    for (work=0; work<WORK_COUNT; work++) {
+        if (!(workloads & (1 << work))) {
+            continue;
+        }
+        int threads = 1;
+        for (;;) {
+            if (run(work, threads) != 0) {
+                exit(EXIT_FAILURE);
+            }
+            if (threads == max_threads) {
+                break;
+            }
+            threads *= 2;
+            if (threads > max_threads) {
+                threads = max_threads;
+            }
+        }
+    }
+    char stats[4096];
+    size_t len = prio_stats(stats, sizeof(stats));
+    if (nodes) {
+        len += node_stats(stats + len, sizeof(stats) - len);
+    }
+    fwrite(stats, 1, len, stdout);
+    return 0;
+}
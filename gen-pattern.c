@@ -0,0 +1,118 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * An example generator plugin (see generator.h): files made of a byte
+ * pattern repeated end to end, given in hex as the parameters.  Without
+ * parameters the files are all zeroes.  The seed is ignored.
+ *
+ *     $ ./testfuse zeroes_1G,1G,1,pattern/beef_1G,1G,1,pattern:deadbeef \
+ *           /mnt/testfuse
+ *
+ * The content of a file is much more compressible than the built-in
+ * generator's, which makes it useful for testing what a compressing
+ * link or filesystem does with easy data.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "generator.h"
+
+#define PATTERN_MAX 4096
+
+/*
+ * A tile of the pattern a block plus a pattern long, so that a whole
+ * block's worth at any phase of the pattern can be copied from it.
+ */
+typedef struct pattern_s {
+    size_t len;
+    char tile[TF_GENERATOR_BLOCK_SIZE + PATTERN_MAX];
+} pattern_t;
+
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+static void *pattern_init(const char *params) {
+    unsigned char bytes[PATTERN_MAX];
+    size_t len = 0;
+    if (params == NULL || *params == '\0') {
+        bytes[len++] = 0;
+    } else {
+        if (strncmp(params, "0x", 2) == 0) {
+            params += 2;
+        }
+        for (; params[0] && len < PATTERN_MAX; params += 2) {
+            int hi = hex_digit(params[0]);
+            int lo = params[1] ? hex_digit(params[1]) : -1;
+            if (hi < 0 || lo < 0) {
+                fprintf(stderr, "error: pattern must be an even number of hex digits\n");
+                return NULL;
+            }
+            bytes[len++] = hi << 4 | lo;
+        }
+        if (params[0]) {
+            fprintf(stderr, "error: pattern is longer than %d bytes\n", PATTERN_MAX);
+            return NULL;
+        }
+    }
+
+    pattern_t *pattern = malloc(sizeof(pattern_t));
+    if (pattern == NULL) {
+        return NULL;
+    }
+    pattern->len = len;
+    size_t pos;
+    for (pos = 0; pos < sizeof(pattern->tile); pos++) {
+        pattern->tile[pos] = bytes[pos % len];
+    }
+    return pattern;
+}
+
+static void pattern_generate(void *state, uint32_t seed, uint64_t offset, char *buf, size_t len) {
+    pattern_t *pattern = state;
+    size_t phase = offset % pattern->len;
+    while (len) {
+        size_t n = len < TF_GENERATOR_BLOCK_SIZE ? len : TF_GENERATOR_BLOCK_SIZE;
+        memcpy(buf, pattern->tile + phase, n);
+        phase = (phase + n) % pattern->len;
+        buf += n;
+        len -= n;
+    }
+}
+
+const tf_generator_t testfuse_generator = {
+    .abi = TF_GENERATOR_ABI,
+    .name = "pattern",
+    .version = 1,
+    .init = pattern_init,
+    .generate = pattern_generate,
+};
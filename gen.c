@@ -0,0 +1,455 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <pthread.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "gen.h"
+
+static const uint32_t global_seed = 123456789;
+
+/*
+ * Combine the global seed, file seed, and the block number using a
+ * CRC32 technique such that even a small change in one of the values
+ * (i.e., file_seed=1 vs. file_seed=2, or the block number incrementing)
+ * will result in a radical change to the output.
+ */
+static uint32_t crc(uint32_t global_seed, uint32_t file_seed, uint32_t block) {
+    static const uint32_t polynomial = 0x04C11DB7U;
+    static const uint32_t msb_mask = 0x80000000U;
+    uint32_t input = global_seed;
+    uint32_t input_next = file_seed;
+    uint32_t divisor = msb_mask | (polynomial>>1);
+    uint32_t divisor_next = (polynomial&0x01)<<31;
+    int i;
+    for (i=0; i<(3*sizeof(uint32_t)*8); i++) {
+        // refill next
+        if (i == 1*sizeof(uint32_t)*8) {
+            input_next = block;
+        }
+        // xor
+        if (input & msb_mask) {
+            input ^= divisor;
+            input_next ^= divisor_next;
+        }
+        // shift
+        input <<= 1;
+        if (input_next & msb_mask) {
+            input |= 0x01;
+        }
+        input_next <<= 1;
+    }
+    return input;
+}
+
+/*
+ * Use a xorshift algorithm to produce a deterministic pseudo-random
+ * block of data.
+ */
+void get_block(uint32_t block, char *buf, uint32_t file_seed) {
+    uint32_t x = crc(global_seed, file_seed, block);
+    uint32_t y = 362436069;
+    uint32_t z = 521288629;
+    uint32_t w = 88675123;
+    uint32_t *buf32 = (uint32_t*)buf;
+    int i;
+    for (i=0; i<(BLOCK_SIZE/sizeof(uint32_t)); i++) {
+        uint32_t t = x ^ (x << 11);
+        x = y; y = z; z = w;
+        w = w ^ (w >> 19) ^ (t ^ (t >> 8));
+        buf32[i] = w;
+    }
+}
+
+#if defined(__SSE2__)
+/*
+ * The xorshift generator is inherently serial within a block, but the
+ * blocks are independent, so SSE2 can run four blocks side by side, one
+ * per 32-bit lane.  Every four steps, the 4x4 matrix of outputs is
+ * transposed so that each vector holds four consecutive words of one
+ * block, ready to be stored or compared as a unit.
+ */
+typedef struct gen4_s {
+    __m128i x, y, z, w;
+} gen4_t;
+
+static void gen4_init(gen4_t *g, uint32_t block, uint32_t file_seed) {
+    g->x = _mm_set_epi32(
+        crc(global_seed, file_seed, block+3),
+        crc(global_seed, file_seed, block+2),
+        crc(global_seed, file_seed, block+1),
+        crc(global_seed, file_seed, block));
+    g->y = _mm_set1_epi32(362436069);
+    g->z = _mm_set1_epi32(521288629);
+    g->w = _mm_set1_epi32(88675123);
+}
+
+static inline __m128i gen4_step(gen4_t *g) {
+    __m128i t = _mm_xor_si128(g->x, _mm_slli_epi32(g->x, 11));
+    g->x = g->y;
+    g->y = g->z;
+    g->z = g->w;
+    g->w = _mm_xor_si128(
+        _mm_xor_si128(g->w, _mm_srli_epi32(g->w, 19)),
+        _mm_xor_si128(t, _mm_srli_epi32(t, 8)));
+    return g->w;
+}
+
+/*
+ * Advance four steps, leaving out[j] = the next four words of block j.
+ */
+static inline void gen4_next(gen4_t *g, __m128i out[4]) {
+    __m128i s0 = gen4_step(g);
+    __m128i s1 = gen4_step(g);
+    __m128i s2 = gen4_step(g);
+    __m128i s3 = gen4_step(g);
+    __m128i t0 = _mm_unpacklo_epi32(s0, s1);
+    __m128i t1 = _mm_unpacklo_epi32(s2, s3);
+    __m128i t2 = _mm_unpackhi_epi32(s0, s1);
+    __m128i t3 = _mm_unpackhi_epi32(s2, s3);
+    out[0] = _mm_unpacklo_epi64(t0, t1);
+    out[1] = _mm_unpackhi_epi64(t0, t1);
+    out[2] = _mm_unpacklo_epi64(t2, t3);
+    out[3] = _mm_unpackhi_epi64(t2, t3);
+}
+#endif
+
+#if defined(__x86_64__)
+/*
+ * The same again, eight blocks at a time with AVX2.  Within each
+ * 128-bit half the transpose matches the SSE2 one, and the halves are
+ * then exchanged so that each vector holds eight words of one block.
+ */
+typedef struct gen8_s {
+    __m256i x, y, z, w;
+} gen8_t;
+
+__attribute__((target("avx2")))
+static void gen8_init(gen8_t *g, uint32_t block, uint32_t file_seed) {
+    g->x = _mm256_set_epi32(
+        crc(global_seed, file_seed, block+7),
+        crc(global_seed, file_seed, block+6),
+        crc(global_seed, file_seed, block+5),
+        crc(global_seed, file_seed, block+4),
+        crc(global_seed, file_seed, block+3),
+        crc(global_seed, file_seed, block+2),
+        crc(global_seed, file_seed, block+1),
+        crc(global_seed, file_seed, block));
+    g->y = _mm256_set1_epi32(362436069);
+    g->z = _mm256_set1_epi32(521288629);
+    g->w = _mm256_set1_epi32(88675123);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i gen8_step(gen8_t *g) {
+    __m256i t = _mm256_xor_si256(g->x, _mm256_slli_epi32(g->x, 11));
+    g->x = g->y;
+    g->y = g->z;
+    g->z = g->w;
+    g->w = _mm256_xor_si256(
+        _mm256_xor_si256(g->w, _mm256_srli_epi32(g->w, 19)),
+        _mm256_xor_si256(t, _mm256_srli_epi32(t, 8)));
+    return g->w;
+}
+
+__attribute__((target("avx2")))
+static inline void gen8_next(gen8_t *g, __m256i out[8]) {
+    __m256i s[8], t[8], u[8];
+    int i;
+    for (i=0; i<8; i++) {
+        s[i] = gen8_step(g);
+    }
+    for (i=0; i<8; i+=4) {
+        t[i+0] = _mm256_unpacklo_epi32(s[i+0], s[i+1]);
+        t[i+1] = _mm256_unpackhi_epi32(s[i+0], s[i+1]);
+        t[i+2] = _mm256_unpacklo_epi32(s[i+2], s[i+3]);
+        t[i+3] = _mm256_unpackhi_epi32(s[i+2], s[i+3]);
+        u[i+0] = _mm256_unpacklo_epi64(t[i+0], t[i+2]);
+        u[i+1] = _mm256_unpackhi_epi64(t[i+0], t[i+2]);
+        u[i+2] = _mm256_unpacklo_epi64(t[i+1], t[i+3]);
+        u[i+3] = _mm256_unpackhi_epi64(t[i+1], t[i+3]);
+    }
+    for (i=0; i<4; i++) {
+        out[i] = _mm256_permute2x128_si256(u[i], u[i+4], 0x20);
+        out[i+4] = _mm256_permute2x128_si256(u[i], u[i+4], 0x31);
+    }
+}
+
+__attribute__((target("avx2")))
+static void get_blocks8(uint32_t block, char *buf, uint32_t file_seed) {
+    gen8_t g;
+    int i, j;
+    gen8_init(&g, block, file_seed);
+    for (i=0; i<BLOCK_SIZE; i+=32) {
+        __m256i out[8];
+        gen8_next(&g, out);
+        for (j=0; j<8; j++) {
+            _mm256_storeu_si256((__m256i *)(buf + j*BLOCK_SIZE + i), out[j]);
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+static int verify_blocks8(uint32_t block, const char *data, uint32_t file_seed) {
+    gen8_t g;
+    __m256i diff = _mm256_setzero_si256();
+    int i, j;
+    gen8_init(&g, block, file_seed);
+    for (i=0; i<BLOCK_SIZE; i+=32) {
+        __m256i out[8];
+        gen8_next(&g, out);
+        for (j=0; j<8; j++) {
+            __m256i in = _mm256_loadu_si256((const __m256i *)(data + j*BLOCK_SIZE + i));
+            diff = _mm256_or_si256(diff, _mm256_xor_si256(in, out[j]));
+        }
+    }
+    return _mm256_testz_si256(diff, diff);
+}
+#endif
+
+/*
+ * Use AVX2 when the CPU has it.
+ */
+static int gen_avx2 = 0;
+static pthread_once_t gen_once = PTHREAD_ONCE_INIT;
+
+static void gen_setup(void) {
+#if defined(__x86_64__)
+    gen_avx2 = __builtin_cpu_supports("avx2");
+#endif
+}
+
+void get_blocks(uint32_t block, uint32_t count, char *buf, uint32_t file_seed) {
+#if defined(__x86_64__)
+    pthread_once(&gen_once, gen_setup);
+    if (gen_avx2 && BLOCK_SIZE >= 32) {
+        for (; count >= 8; count -= 8, block += 8, buf += 8*BLOCK_SIZE) {
+            get_blocks8(block, buf, file_seed);
+        }
+    }
+#endif
+#if defined(__SSE2__)
+    for (; count >= 4; count -= 4, block += 4, buf += 4*BLOCK_SIZE) {
+        gen4_t g;
+        int i, j;
+        gen4_init(&g, block, file_seed);
+        for (i=0; i<BLOCK_SIZE; i+=16) {
+            __m128i out[4];
+            gen4_next(&g, out);
+            for (j=0; j<4; j++) {
+                _mm_storeu_si128((__m128i *)(buf + j*BLOCK_SIZE + i), out[j]);
+            }
+        }
+    }
+#endif
+    for (; count; count--, block++, buf += BLOCK_SIZE) {
+        get_block(block, buf, file_seed);
+    }
+}
+
+/*
+ * Compare one block against the stream, generating as we go rather
+ * than into a buffer.
+ */
+static int verify_block(uint32_t block, const char *data, uint32_t file_seed) {
+    uint32_t x = crc(global_seed, file_seed, block);
+    uint32_t y = 362436069;
+    uint32_t z = 521288629;
+    uint32_t w = 88675123;
+    uint32_t diff = 0;
+    int i;
+    for (i=0; i<(BLOCK_SIZE/sizeof(uint32_t)); i++) {
+        uint32_t t = x ^ (x << 11);
+        uint32_t word;
+        x = y; y = z; z = w;
+        w = w ^ (w >> 19) ^ (t ^ (t >> 8));
+        memcpy(&word, data + i*sizeof(uint32_t), sizeof(uint32_t));
+        diff |= w ^ word;
+    }
+    return diff == 0;
+}
+
+int verify_blocks(uint32_t block, uint32_t count, const char *data, uint32_t file_seed) {
+#if defined(__x86_64__)
+    pthread_once(&gen_once, gen_setup);
+    if (gen_avx2 && BLOCK_SIZE >= 32) {
+        for (; count >= 8; count -= 8, block += 8, data += 8*BLOCK_SIZE) {
+            if (!verify_blocks8(block, data, file_seed)) {
+                return 0;
+            }
+        }
+    }
+#endif
+#if defined(__SSE2__)
+    for (; count >= 4; count -= 4, block += 4, data += 4*BLOCK_SIZE) {
+        gen4_t g;
+        __m128i diff = _mm_setzero_si128();
+        int i, j;
+        gen4_init(&g, block, file_seed);
+        for (i=0; i<BLOCK_SIZE; i+=16) {
+            __m128i out[4];
+            gen4_next(&g, out);
+            for (j=0; j<4; j++) {
+                __m128i in = _mm_loadu_si128((const __m128i *)(data + j*BLOCK_SIZE + i));
+                diff = _mm_or_si128(diff, _mm_xor_si128(in, out[j]));
+            }
+        }
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(diff, _mm_setzero_si128())) != 0xFFFF) {
+            return 0;
+        }
+    }
+#endif
+    for (; count; count--, block++, data += BLOCK_SIZE) {
+        if (!verify_block(block, data, file_seed)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * The xorshift state is just its last four outputs, so four consecutive
+ * words of a block give the full state, and each step can be undone:
+ * the three older words are shifted back, and both xorshifts in the
+ * new word are invertible.  Stepping back until y, z and w hold their
+ * initial constants recovers x, the block's seed word.
+ */
+int gen_rewind(const uint32_t words[4], uint32_t *x0, uint32_t *index) {
+    uint32_t x = words[0], y = words[1], z = words[2], w = words[3];
+    uint32_t steps;
+    for (steps=0; steps<=BLOCK_SIZE/sizeof(uint32_t); steps++) {
+        if (y == 362436069 && z == 521288629 && w == 88675123) {
+            if (steps < 4) {
+                break;
+            }
+            *x0 = x;
+            *index = steps - 4;
+            return 0;
+        }
+        // w = w' ^ (w' >> 19) ^ t ^ (t >> 8), where w' is the old w
+        // (now z) and t = x' ^ (x' << 11) for the old x
+        uint32_t prev_w = z;
+        uint32_t s = w ^ prev_w ^ (prev_w >> 19);
+        uint32_t t = s ^ (s >> 8) ^ (s >> 16) ^ (s >> 24);
+        uint32_t prev_x = t ^ (t << 11) ^ (t << 22);
+        w = prev_w;
+        z = y;
+        y = x;
+        x = prev_x;
+    }
+    return -1;
+}
+
+/*
+ * The seed word is a CRC of (global seed, file seed, block) without any
+ * pre- or post-conditioning, so it's linear over GF(2) in the block
+ * number: crc(g, s, b) = crc(g, s, 0) ^ crc(0, 0, b).  The polynomial
+ * isn't divisible by x, so crc(0, 0, b) is a bijection on 32-bit
+ * values, and its inverse matrix is computed once by Gauss-Jordan
+ * elimination.
+ */
+static uint32_t block_inverse[32];
+static pthread_once_t block_inverse_once = PTHREAD_ONCE_INIT;
+
+static void block_inverse_init(void) {
+    uint32_t m[32];
+    int i, j;
+    // row i of the augmented system: crc(0, 0, 1<<i) -> 1<<i
+    for (i=0; i<32; i++) {
+        m[i] = crc(0, 0, 1U << i);
+        block_inverse[i] = 1U << i;
+    }
+    for (j=0; j<32; j++) {
+        for (i=j; i<32 && !(m[i] & (1U << j)); i++) {
+        }
+        uint32_t tmp = m[i]; m[i] = m[j]; m[j] = tmp;
+        tmp = block_inverse[i]; block_inverse[i] = block_inverse[j]; block_inverse[j] = tmp;
+        for (i=0; i<32; i++) {
+            if (i != j && (m[i] & (1U << j))) {
+                m[i] ^= m[j];
+                block_inverse[i] ^= block_inverse[j];
+            }
+        }
+    }
+}
+
+uint32_t gen_block_of(uint32_t x0, uint32_t file_seed) {
+    pthread_once(&block_inverse_once, block_inverse_init);
+    uint32_t v = x0 ^ crc(global_seed, file_seed, 0);
+    uint32_t block = 0;
+    int i;
+    for (i=0; i<32; i++) {
+        if (v & (1U << i)) {
+            block ^= block_inverse[i];
+        }
+    }
+    return block;
+}
+
+/*
+ * Produce an arbitrary byte range of a stream, generating whole blocks
+ * directly into the caller's buffer where possible.
+ */
+void get_range(char *buf, size_t size, uint64_t abs_offset, uint32_t file_seed) {
+    while (size) {
+        // consider the file to be made up of 64K blocks, each with its
+        // own predictable pseudorandom context.  The use of uint32_t's
+        // here limit the total size to 256TB.
+        uint32_t block = abs_offset>>BLOCK_SHIFT;
+        uint32_t offset = abs_offset & OFFSET_MASK;
+
+        if (offset==0 && size>=BLOCK_SIZE) {
+            // ideal case -- aligned buffer of whole blocks
+            uint32_t count = size >> BLOCK_SHIFT;
+            get_blocks(block, count, buf, file_seed);
+            buf += (size_t)count << BLOCK_SHIFT;
+            size -= (size_t)count << BLOCK_SHIFT;
+            abs_offset += (uint64_t)count << BLOCK_SHIFT;
+        } else {
+            // fulfill partial-block reads
+            char block_buffer[BLOCK_SIZE];
+            get_block(block, block_buffer, file_seed);
+            int bytes;
+            if (size < (BLOCK_SIZE-offset)) {
+                bytes = size;
+            } else {
+                bytes = BLOCK_SIZE-offset;
+            }
+            memcpy(buf, block_buffer+offset, bytes);
+            buf += bytes;
+            size -= bytes;
+            abs_offset += bytes;
+        }
+    }
+}
+
+void gen_stream_range(const gen_stream_t *stream, char *buf, size_t size, uint64_t abs_offset) {
+    if (stream->range) {
+        stream->range(stream->arg, buf, size, abs_offset, stream->seed);
+    } else {
+        get_range(buf, size, abs_offset, stream->seed);
+    }
+}
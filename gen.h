@@ -0,0 +1,110 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * The deterministic pseudo-random content generator shared by the
+ * filesystem driver and the digest machinery.
+ */
+
+#ifndef GEN_H
+#define GEN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* uncomment this only to debug edge conditions dealing with blocks */
+//#define SMALL_BLOCK_TEST
+
+#ifdef SMALL_BLOCK_TEST
+ #define BLOCK_SIZE (16)
+ #define BLOCK_SHIFT 4
+ #define OFFSET_MASK (BLOCK_SIZE-1)
+#else
+ #define BLOCK_SIZE (64*1024)
+ #define BLOCK_SHIFT 16
+ #define OFFSET_MASK (BLOCK_SIZE-1)
+#endif
+
+/*
+ * Identifies the content generator in persistent caches, so that
+ * results for different kinds of content can't be confused.
+ */
+#define GEN_FORMAT_XORSHIFT 0
+
+/*
+ * A stream of content: the built-in generator, or a generator plugin
+ * (see plugin.h), with a seed.  Anything derived from the content
+ * (digests, piece hashes) is keyed by format and seed.
+ */
+typedef struct gen_stream_s {
+    uint32_t format;
+    uint32_t seed;
+    // a plugin's range generator, or NULL for the built-in one
+    void (*range)(void *arg, char *buf, size_t size, uint64_t offset, uint32_t seed);
+    void *arg;
+} gen_stream_t;
+
+#define GEN_STREAM(seed) ((gen_stream_t){ GEN_FORMAT_XORSHIFT, (seed), NULL, NULL })
+
+/*
+ * Fill buf with the BLOCK_SIZE bytes of the given block of a stream.
+ */
+void get_block(uint32_t block, char *buf, uint32_t file_seed);
+
+/*
+ * Fill buf with count consecutive blocks, several at a time using SIMD
+ * (SSE2, or AVX2 where the CPU has it).
+ */
+void get_blocks(uint32_t block, uint32_t count, char *buf, uint32_t file_seed);
+
+/*
+ * Check that data holds count consecutive whole blocks of a stream,
+ * regenerating them alongside the comparison rather than into a
+ * buffer.  Returns nonzero if every byte matches.
+ */
+int verify_blocks(uint32_t block, uint32_t count, const char *data, uint32_t file_seed);
+
+/*
+ * Given four consecutive words from within one block of a stream,
+ * recover the block's seed word and the index of words[0] in the
+ * block.  Returns 0 on success, or -1 if the words can't have come from
+ * the generator.
+ */
+int gen_rewind(const uint32_t words[4], uint32_t *x0, uint32_t *index);
+
+/*
+ * Return the block of the given stream whose seed word is x0.  Every
+ * seed word maps to exactly one block for each file seed.
+ */
+uint32_t gen_block_of(uint32_t x0, uint32_t file_seed);
+
+/*
+ * Fill buf with size bytes of a stream starting at an arbitrary byte
+ * offset.  The caller is responsible for limiting the range to the size
+ * of the file.
+ */
+void get_range(char *buf, size_t size, uint64_t abs_offset, uint32_t file_seed);
+
+/*
+ * get_range() for any stream.
+ */
+void gen_stream_range(const gen_stream_t *stream, char *buf, size_t size, uint64_t abs_offset);
+
+#endif
@@ -0,0 +1,95 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * The ABI for content generator plugins: shared objects which testfuse
+ * loads with dlopen() to serve test files whose content isn't the
+ * built-in pseudorandom stream.  A file-spec names its generator in an
+ * optional fourth field, with optional parameters after a colon:
+ *
+ *     testfile_1G,1G,1,pattern:deadbeef
+ *
+ * loads testfuse-gen-pattern.so (from -o plugin_dir=DIR, or else next
+ * to the testfuse binary, or else the library search path), which must
+ * export a tf_generator_t named testfuse_generator:
+ *
+ *     #include "generator.h"
+ *
+ *     const tf_generator_t testfuse_generator = {
+ *         .abi = TF_GENERATOR_ABI,
+ *         .name = "pattern",
+ *         .version = 1,
+ *         .init = pattern_init,
+ *         .generate = pattern_generate,
+ *     };
+ *
+ * Everything testfuse does with content -- reads, range digests and
+ * extended attribute digests, .torrent piece hashes, rings -- works the
+ * same for plugins.  Content must be a pure function of the parameters,
+ * the seed and the offset: it's generated in pieces, from many threads,
+ * in any order, and digests of it are kept in the persistent cache.
+ */
+
+#ifndef GENERATOR_H
+#define GENERATOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TF_GENERATOR_ABI 1
+
+// the block size of generate_blocks(); see below
+#define TF_GENERATOR_BLOCK_SIZE (64*1024)
+
+typedef struct tf_generator_s {
+    uint32_t abi;           // TF_GENERATOR_ABI
+    const char *name;
+
+    // change this whenever the content changes, so that digests cached
+    // for the old content aren't reused
+    uint32_t version;
+
+    /*
+     * Set up the generator once for each distinct parameter string
+     * (NULL if none was given).  Returns the state passed to the other
+     * functions, or NULL after reporting the problem on stderr.
+     * Optional; without it the state is NULL.
+     */
+    void *(*init)(const char *params);
+
+    /*
+     * Fill buf with len bytes of the stream for seed, starting at the
+     * given offset.  Called from many threads at once.
+     */
+    void (*generate)(void *state, uint32_t seed, uint64_t offset, char *buf, size_t len);
+
+    /*
+     * Fill buf with count whole TF_GENERATOR_BLOCK_SIZE blocks starting
+     * at the given block.  Optional: a plugin with a faster (batched,
+     * SIMD) path for aligned runs of blocks can supply it, and the
+     * aligned part of every larger read goes here rather than to
+     * generate().
+     */
+    void (*generate_blocks)(void *state, uint32_t seed, uint64_t block, uint32_t count, char *buf);
+} tf_generator_t;
+
+#define TF_GENERATOR_SYMBOL "testfuse_generator"
+
+#endif
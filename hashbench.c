@@ -0,0 +1,90 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Benchmark the parallel BLAKE3 digest of a generated stream against
+ * the number of threads used.
+ *
+ * Usage:
+ *     ./hashbench [size [max-threads]]
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "digest.h"
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+    uint64_t size = 4ULL*1024*1024*1024;
+    int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    char *endptr;
+
+    if (argc > 1) {
+        size = strtoull(argv[1], &endptr, 0);
+        if (*endptr == 'm' || *endptr == 'M') {
+            size *= 1024*1024;
+        } else if (*endptr == 'g' || *endptr == 'G') {
+            size *= 1024*1024*1024;
+        }
+    }
+    if (argc > 2) {
+        max_threads = atoi(argv[2]);
+    }
+    if (size == 0 || max_threads < 1) {
+        fprintf(stderr, "usage: hashbench [size [max-threads]]\n");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("blake3 digest of %" PRIu64 " bytes\n", size);
+    printf("threads     seconds      GB/s  digest\n");
+    gen_stream_t stream = GEN_STREAM(1);
+    int threads = 1;
+    for (;;) {
+        uint8_t out[32];
+        double start = now();
+        digest_blake3_range(&stream, 0, size, threads, out);
+        double elapsed = now() - start;
+
+        printf("%7d  %10.3f  %8.2f  ", threads, elapsed, size / elapsed / 1e9);
+        int i;
+        for (i=0; i<8; i++) {
+            printf("%02x", out[i]);
+        }
+        printf("...\n");
+
+        if (threads == max_threads) {
+            break;
+        }
+        threads *= 2;
+        if (threads > max_threads) {
+            threads = max_threads;
+        }
+    }
+    return 0;
+}
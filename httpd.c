@@ -0,0 +1,665 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/errqueue.h>
+
+#include "gen.h"
+#include "net.h"
+#include "httpd.h"
+
+// requests (line and headers) larger than this are refused
+#define REQUEST_MAX 16384
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+
+// generated bodies are sent this much at a time; zerocopy buffers are
+// reusable only once the kernel is done with them, so keep several
+#define BODY_CHUNK (128*1024)
+#define BODY_CHUNKS 4
+
+#define EPOLL_EVENTS 64
+
+typedef struct body_chunk_s {
+    char *buf;
+    size_t len;
+    size_t pos;
+    uint32_t calls;         // zerocopy send calls (numbered per socket) using buf
+} body_chunk_t;
+
+struct http_conn_s {
+    int fd;
+    int epfd;
+    uint32_t events;
+    int zerocopy;
+    uint32_t calls;         // zerocopy send calls made
+    uint32_t completed;     // and those the kernel is done with
+    uint32_t waiting;       // completed calls needed to send more
+    char req[REQUEST_MAX];
+    size_t req_len;         // bytes in req
+    size_t req_used;        // bytes of req belonging to the current request
+
+    // the response in progress
+    int active;
+    int head;
+    int keep_alive;
+    char *out;              // headers, then any in-memory body
+    size_t out_len;
+    size_t out_pos;
+    uint32_t seed;          // generated body, after out
+    uint64_t body_offset;
+    uint64_t body_left;
+    body_chunk_t chunks[BODY_CHUNKS];
+    int chunk;              // the one being sent
+};
+
+typedef struct http_server_s {
+    int lfd;
+    http_handler_t handler;
+    void *arg;
+} http_server_t;
+
+static const char *status_text(int status) {
+    switch (status) {
+    case 200: return "OK";
+    case 204: return "No Content";
+    case 206: return "Partial Content";
+    case 304: return "Not Modified";
+    case 400: return "Bad Request";
+    case 403: return "Forbidden";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 416: return "Range Not Satisfiable";
+    case 431: return "Request Header Fields Too Large";
+    case 500: return "Internal Server Error";
+    case 501: return "Not Implemented";
+    }
+    return "Unknown";
+}
+
+const char *http_header(const http_request_t *req, const char *name) {
+    int i;
+    for (i=0; i<req->nheaders; i++) {
+        if (strcasecmp(req->header_names[i], name) == 0) {
+            return req->header_values[i];
+        }
+    }
+    return NULL;
+}
+
+static void percent_decode(char *s) {
+    char *out = s;
+    while (*s) {
+        if (s[0] == '%' && s[1] && s[2]) {
+            char hex[3] = { s[1], s[2], '\0' };
+            char *endptr;
+            long c = strtol(hex, &endptr, 16);
+            if (*endptr == '\0') {
+                *out++ = c;
+                s += 3;
+                continue;
+            }
+        }
+        *out++ = *s++;
+    }
+    *out = '\0';
+}
+
+int http_query(const http_request_t *req, const char *name, char *value, size_t len) {
+    const char *p = req->query;
+    size_t name_len = strlen(name);
+    while (p && *p) {
+        const char *end = strchr(p, '&');
+        size_t param_len = end ? (size_t)(end - p) : strlen(p);
+        if (strncmp(p, name, name_len) == 0 &&
+            (param_len == name_len || p[name_len] == '=')) {
+            const char *v = param_len == name_len ? p + param_len : p + name_len + 1;
+            size_t n = p + param_len - v;
+            if (n >= len) {
+                n = len - 1;
+            }
+            memcpy(value, v, n);
+            value[n] = '\0';
+            percent_decode(value);
+            return 1;
+        }
+        p = end ? end + 1 : NULL;
+    }
+    return 0;
+}
+
+int http_parse_range(const char *range, uint64_t size, uint64_t *offset, uint64_t *length) {
+    if (range == NULL || strncmp(range, "bytes=", 6) != 0 || strchr(range, ',') != NULL) {
+        // multiple ranges may be answered with the whole resource
+        return 0;
+    }
+    const char *p = range + 6;
+    char *endptr;
+    if (*p == '-') {
+        // the last n bytes
+        uint64_t n = strtoull(p+1, &endptr, 10);
+        if (endptr == p+1 || *endptr != '\0') {
+            return 0;
+        }
+        if (n == 0 || size == 0) {
+            return -1;
+        }
+        *length = n < size ? n : size;
+        *offset = size - *length;
+        return 1;
+    }
+    uint64_t first = strtoull(p, &endptr, 10);
+    if (endptr == p || *endptr != '-') {
+        return 0;
+    }
+    uint64_t last = size ? size - 1 : 0;
+    if (endptr[1] != '\0') {
+        p = endptr + 1;
+        last = strtoull(p, &endptr, 10);
+        if (*endptr != '\0' || last < first) {
+            return 0;
+        }
+        if (last >= size) {
+            last = size - 1;
+        }
+    }
+    if (first >= size) {
+        return -1;
+    }
+    *offset = first;
+    *length = last - first + 1;
+    return 1;
+}
+
+/*
+ * Build the status line and headers, with room for an in-memory body.
+ */
+static void start_response(http_conn_t *conn, int status, const char *headers,
+    uint64_t content_length, size_t body_room) {
+    char date[64];
+    time_t t = time(NULL);
+    struct tm tm;
+    strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", gmtime_r(&t, &tm));
+    size_t max = 256 + (headers ? strlen(headers) : 0) + body_room;
+    conn->out = malloc(max);
+    if (conn->out == NULL) {
+        fprintf(stderr, "error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    char length[48] = "";
+    if (status != 304 && status != 204) {
+        snprintf(length, sizeof(length), "Content-Length: %" PRIu64 "\r\n", content_length);
+    }
+    conn->out_len = snprintf(conn->out, max,
+        "HTTP/1.1 %d %s\r\n"
+        "Date: %s\r\n"
+        "Server: testfuse\r\n"
+        "%s"
+        "%s"
+        "%s"
+        "\r\n",
+        status, status_text(status), date, length,
+        conn->keep_alive ? "" : "Connection: close\r\n",
+        headers ? headers : "");
+    conn->out_pos = 0;
+    conn->active = 1;
+}
+
+void http_send(http_conn_t *conn, int status, const char *headers, const char *body, size_t len) {
+    start_response(conn, status, headers, len, len);
+    if (!conn->head) {
+        memcpy(conn->out + conn->out_len, body, len);
+        conn->out_len += len;
+    }
+    conn->body_left = 0;
+}
+
+void http_send_stream(http_conn_t *conn, int status, const char *headers,
+    uint32_t seed, uint64_t offset, uint64_t length) {
+    start_response(conn, status, headers, length, 0);
+    conn->seed = seed;
+    conn->body_offset = offset;
+    conn->body_left = conn->head ? 0 : length;
+}
+
+void http_etag(char *etag, uint64_t size, uint32_t seed) {
+    snprintf(etag, HTTP_ETAG_MAX, "\"%" PRIx64 "-%" PRIx32 "\"", size, seed);
+}
+
+void http_send_file(http_conn_t *conn, const http_request_t *req,
+    uint64_t size, uint32_t seed, const char *headers) {
+    char etag[HTTP_ETAG_MAX];
+    http_etag(etag, size, seed);
+    char *extra;
+    if (asprintf(&extra, "ETag: %s\r\n"
+        "Accept-Ranges: bytes\r\n"
+        "Content-Type: application/octet-stream\r\n"
+        "%s", etag, headers ? headers : "") < 0) {
+        http_send(conn, 500, NULL, "", 0);
+        return;
+    }
+
+    const char *if_none_match = http_header(req, "If-None-Match");
+    if (if_none_match && (strcmp(if_none_match, etag) == 0 || strcmp(if_none_match, "*") == 0)) {
+        http_send(conn, 304, extra, "", 0);
+        free(extra);
+        return;
+    }
+
+    // a range is only honoured if the client's copy is still current
+    uint64_t offset = 0, length = size;
+    const char *if_range = http_header(req, "If-Range");
+    int range = 0;
+    if (if_range == NULL || strcmp(if_range, etag) == 0) {
+        range = http_parse_range(http_header(req, "Range"), size, &offset, &length);
+    }
+    if (range < 0) {
+        char *headers416;
+        if (asprintf(&headers416, "%sContent-Range: bytes */%" PRIu64 "\r\n", extra, size) < 0) {
+            headers416 = NULL;
+        }
+        http_send(conn, 416, headers416, "", 0);
+        free(headers416);
+    } else if (range > 0) {
+        char *headers206;
+        if (asprintf(&headers206, "%sContent-Range: bytes %" PRIu64 "-%" PRIu64 "/%" PRIu64 "\r\n",
+            extra, offset, offset + length - 1, size) < 0) {
+            headers206 = NULL;
+        }
+        http_send_stream(conn, 206, headers206, seed, offset, length);
+        free(headers206);
+    } else {
+        http_send_stream(conn, 200, extra, seed, 0, size);
+    }
+    free(extra);
+}
+
+/*
+ * Free the body buffers, unless the kernel may still be sending from
+ * them.
+ */
+static void free_chunks(http_conn_t *conn) {
+    if (conn->zerocopy && conn->completed != conn->calls) {
+        return;
+    }
+    int i;
+    for (i=0; i<BODY_CHUNKS; i++) {
+        free(conn->chunks[i].buf);
+        conn->chunks[i].buf = NULL;
+    }
+}
+
+static void finish_response(http_conn_t *conn) {
+    free(conn->out);
+    conn->out = NULL;
+    free_chunks(conn);
+    conn->active = 0;
+    // drop the request just answered, keeping any pipelined after it
+    memmove(conn->req, conn->req + conn->req_used, conn->req_len - conn->req_used);
+    conn->req_len -= conn->req_used;
+    conn->req_used = 0;
+}
+
+/*
+ * Collect zerocopy completions from the socket's error queue.  TCP
+ * completes send calls in order, so the highest one done is enough.
+ * Returns 0, or -1 on error.
+ */
+static int reap_completions(http_conn_t *conn) {
+    for (;;) {
+        char control[128];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(conn->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN ? 0 : -1;
+        }
+        struct cmsghdr *cm;
+        for (cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+            struct sock_extended_err *serr = (struct sock_extended_err *)CMSG_DATA(cm);
+            if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY || serr->ee_errno != 0) {
+                continue;
+            }
+            if (serr->ee_data + 1 > conn->completed) {
+                conn->completed = serr->ee_data + 1;
+            }
+        }
+    }
+}
+
+/*
+ * Write as much of the response as the socket will take.  The headers
+ * (and any in-memory body) are copied, and a generated body is sent
+ * from a ring of chunks with MSG_ZEROCOPY where the kernel supports it.
+ * Returns 0 if the response is done, the socket is full or we must wait
+ * for completions, or -1 to close.
+ */
+static int write_response(http_conn_t *conn) {
+    while (conn->active) {
+        body_chunk_t *c = &conn->chunks[conn->chunk];
+        if (conn->out_pos < conn->out_len) {
+            int more = conn->body_left || c->pos < c->len ? MSG_MORE : 0;
+            ssize_t n = send(conn->fd, conn->out + conn->out_pos, conn->out_len - conn->out_pos,
+                MSG_NOSIGNAL | more);
+            if (n < 0) {
+                return errno == EAGAIN || errno == EINTR ? 0 : -1;
+            }
+            conn->out_pos += n;
+            continue;
+        }
+        if (c->pos == c->len) {
+            if (conn->body_left == 0) {
+                int keep_alive = conn->keep_alive;
+                finish_response(conn);
+                return keep_alive ? 0 : -1;
+            }
+            // wait (for EPOLLERR) until the kernel lets go of the buffer
+            if (conn->zerocopy && conn->completed < c->calls) {
+                conn->waiting = c->calls;
+                if (reap_completions(conn) != 0) {
+                    return -1;
+                }
+                if (conn->completed < c->calls) {
+                    return 0;
+                }
+            }
+            if (c->buf == NULL && posix_memalign((void **)&c->buf, 4096, BODY_CHUNK) != 0) {
+                c->buf = NULL;
+                return -1;
+            }
+            c->len = conn->body_left < BODY_CHUNK ? conn->body_left : BODY_CHUNK;
+            c->pos = 0;
+            get_range(c->buf, c->len, conn->body_offset, conn->seed);
+            conn->body_offset += c->len;
+            conn->body_left -= c->len;
+        }
+        ssize_t n = send(conn->fd, c->buf + c->pos, c->len - c->pos,
+            MSG_NOSIGNAL | (conn->zerocopy ? MSG_ZEROCOPY : 0));
+        if (n < 0 && errno == ENOBUFS && conn->zerocopy) {
+            // out of pinned-page budget; wait for completions if there
+            // are any to come, or else give up on zerocopy
+            if (conn->completed < conn->calls) {
+                conn->waiting = conn->completed + 1;
+                return 0;
+            }
+            conn->zerocopy = 0;
+            continue;
+        }
+        if (n < 0) {
+            return errno == EAGAIN || errno == EINTR ? 0 : -1;
+        }
+        if (conn->zerocopy) {
+            conn->calls++;
+            c->calls = conn->calls;
+        }
+        c->pos += n;
+        if (c->pos == c->len) {
+            conn->chunk = (conn->chunk + 1) % BODY_CHUNKS;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Whether the response in progress can go on once the socket is
+ * writable, rather than waiting for zerocopy completions (which are
+ * signalled by EPOLLERR).
+ */
+static int want_output(const http_conn_t *conn) {
+    return !conn->zerocopy || conn->completed >= conn->waiting;
+}
+
+/*
+ * Parse one complete request from the start of the buffer, if there is
+ * one, and pass it to the handler.  Returns 1 if a request was handled,
+ * 0 if more input is needed, or -1 to close.
+ */
+static int handle_request(http_conn_t *conn, http_server_t *server) {
+    char *end = memmem(conn->req, conn->req_len, "\r\n\r\n", 4);
+    if (end == NULL) {
+        if (conn->req_len == REQUEST_MAX) {
+            conn->keep_alive = 0;
+            conn->head = 0;
+            http_send(conn, 431, NULL, "", 0);
+            conn->req_used = conn->req_len;
+            return 1;
+        }
+        return 0;
+    }
+    conn->req_used = end + 4 - conn->req;
+    end[2] = '\0';
+
+    http_request_t req;
+    memset(&req, 0, sizeof(req));
+    char *save, *save_line;
+    char *line = strtok_r(conn->req, "\r\n", &save);
+    char *version = NULL;
+    if (line) {
+        req.method = strtok_r(line, " ", &save_line);
+        req.path = strtok_r(NULL, " ", &save_line);
+        version = strtok_r(NULL, " ", &save_line);
+    }
+    conn->head = 0;
+    if (!req.method || !req.path || !version || strncmp(version, "HTTP/1.", 7) != 0) {
+        conn->keep_alive = 0;
+        http_send(conn, 400, NULL, "", 0);
+        return 1;
+    }
+    while ((line = strtok_r(NULL, "\r\n", &save)) != NULL && req.nheaders < HTTP_MAX_HEADERS) {
+        char *colon = strchr(line, ':');
+        if (colon == NULL) {
+            continue;
+        }
+        *colon = '\0';
+        char *value = colon + 1;
+        while (*value == ' ' || *value == '\t') {
+            value++;
+        }
+        req.header_names[req.nheaders] = line;
+        req.header_values[req.nheaders] = value;
+        req.nheaders++;
+    }
+
+    // HTTP/1.1 keeps the connection by default, and 1.0 closes it
+    const char *connection = http_header(&req, "Connection");
+    req.keep_alive = strcmp(version, "HTTP/1.0") != 0;
+    if (connection && strcasecmp(connection, "close") == 0) {
+        req.keep_alive = 0;
+    } else if (connection && strcasecmp(connection, "keep-alive") == 0) {
+        req.keep_alive = 1;
+    }
+    req.head = strcmp(req.method, "HEAD") == 0;
+    req.query = strchr(req.path, '?');
+    if (req.query) {
+        *req.query++ = '\0';
+    }
+    percent_decode(req.path);
+
+    conn->keep_alive = req.keep_alive;
+    conn->head = req.head;
+    server->handler(conn, &req, server->arg);
+    if (!conn->active) {
+        http_send(conn, 500, NULL, "", 0);
+    }
+    return 1;
+}
+
+static void close_conn(http_conn_t *conn) {
+    close(conn->fd);
+    // closing the socket releases any pages still pinned for zerocopy
+    int i;
+    for (i=0; i<BODY_CHUNKS; i++) {
+        free(conn->chunks[i].buf);
+    }
+    free(conn->out);
+    free(conn);
+}
+
+/*
+ * Wait for the given events on the connection, if it isn't already.
+ */
+static void set_events(http_conn_t *conn, uint32_t events) {
+    if (events != conn->events) {
+        struct epoll_event ev = { events, { .ptr = conn } };
+        epoll_ctl(conn->epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+        conn->events = events;
+    }
+}
+
+/*
+ * Read what has arrived, and answer requests until a response can't be
+ * finished right away.  Returns -1 to close.
+ */
+static int service(http_conn_t *conn, uint32_t events, http_server_t *server) {
+    if (events & EPOLLHUP) {
+        return -1;
+    }
+    if ((events & EPOLLERR) && conn->zerocopy && reap_completions(conn) != 0) {
+        return -1;
+    }
+    for (;;) {
+        if (conn->active) {
+            if (write_response(conn) != 0) {
+                return -1;
+            }
+            if (conn->active) {
+                // wait until the socket can take more, or with no events
+                // (EPOLLERR being reported regardless) for completions
+                set_events(conn, want_output(conn) ? EPOLLOUT : 0);
+                return 0;
+            }
+            continue;
+        }
+        int r = handle_request(conn, server);
+        if (r < 0) {
+            return -1;
+        }
+        if (r > 0) {
+            continue;
+        }
+        ssize_t n = read(conn->fd, conn->req + conn->req_len, REQUEST_MAX - conn->req_len);
+        if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+            set_events(conn, EPOLLIN);
+            return 0;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        conn->req_len += n;
+    }
+}
+
+static void *http_thread(void *arg) {
+    http_server_t *server = arg;
+    int epfd = epoll_create1(0);
+    if (epfd < 0) {
+        perror("testfuse: epoll_create1");
+        exit(EXIT_FAILURE);
+    }
+    // the listening socket is shared, and only one thread is woken for
+    // each connection
+    struct epoll_event lev = { EPOLLIN | EPOLLEXCLUSIVE, { .ptr = NULL } };
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, server->lfd, &lev) != 0) {
+        perror("testfuse: epoll_ctl");
+        exit(EXIT_FAILURE);
+    }
+    struct epoll_event events[EPOLL_EVENTS];
+    for (;;) {
+        int n = epoll_wait(epfd, events, EPOLL_EVENTS, -1);
+        int i;
+        for (i=0; i<n; i++) {
+            if (events[i].data.ptr == NULL) {
+                int fd = accept4(server->lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if (fd < 0) {
+                    continue;
+                }
+                int one = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                http_conn_t *conn = calloc(1, sizeof(http_conn_t));
+                if (conn == NULL) {
+                    close(fd);
+                    continue;
+                }
+                conn->fd = fd;
+                conn->epfd = epfd;
+                conn->events = EPOLLIN;
+                conn->zerocopy = setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
+                struct epoll_event ev = { EPOLLIN, { .ptr = conn } };
+                epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+                continue;
+            }
+            http_conn_t *conn = events[i].data.ptr;
+            if (service(conn, events[i].events, server) != 0) {
+                close_conn(conn);
+            }
+        }
+    }
+    return NULL;
+}
+
+int http_serve(const char *port, int threads, http_handler_t handler, void *arg) {
+    http_server_t *server = malloc(sizeof(http_server_t));
+    if (server == NULL) {
+        return -1;
+    }
+    server->lfd = net_listen(port, SOCK_STREAM);
+    if (server->lfd < 0) {
+        return -1;
+    }
+    fcntl(server->lfd, F_SETFL, O_NONBLOCK);
+    server->handler = handler;
+    server->arg = arg;
+    int i;
+    for (i=1; i<threads; i++) {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, http_thread, server) != 0) {
+            return -1;
+        }
+        pthread_detach(tid);
+    }
+    http_thread(server);
+    return -1;
+}
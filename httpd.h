@@ -0,0 +1,106 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * A small epoll-based HTTP/1.1 server whose response bodies are either
+ * held in memory or generated on the fly from a test file's stream.
+ */
+
+#ifndef HTTPD_H
+#define HTTPD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HTTP_MAX_HEADERS 32
+
+typedef struct http_request_s {
+    char *method;
+    char *path;             // percent-decoded, without the query
+    char *query;            // raw, or NULL
+    int head;               // a HEAD request: send the headers alone
+    int keep_alive;
+    int nheaders;
+    char *header_names[HTTP_MAX_HEADERS];
+    char *header_values[HTTP_MAX_HEADERS];
+} http_request_t;
+
+typedef struct http_conn_s http_conn_t;
+
+/*
+ * Called for each request, which must be answered by calling one of
+ * the http_send functions before returning.
+ */
+typedef void (*http_handler_t)(http_conn_t *conn, const http_request_t *req, void *arg);
+
+/*
+ * Serve requests on port with the given number of threads, each with
+ * its own epoll loop.  Returns only on error.
+ */
+int http_serve(const char *port, int threads, http_handler_t handler, void *arg);
+
+/*
+ * Return the value of a request header (matched without regard to
+ * case), or NULL.
+ */
+const char *http_header(const http_request_t *req, const char *name);
+
+/*
+ * Find a parameter in the request's query string and copy its decoded
+ * value into value (of len bytes).  Returns 1 if it's present, else 0.
+ */
+int http_query(const http_request_t *req, const char *name, char *value, size_t len);
+
+/*
+ * Parse a Range header against a resource of the given size.  Returns
+ * 1 and sets *offset and *length for a single satisfiable range, -1 for
+ * an unsatisfiable one (to be answered 416), or 0 if there is no range
+ * to honour, so the whole resource should be sent.
+ */
+int http_parse_range(const char *range, uint64_t size, uint64_t *offset, uint64_t *length);
+
+/*
+ * Answer with a body held in memory, which is copied.  headers holds
+ * any extra header lines, each ending in CRLF, or is NULL.
+ */
+void http_send(http_conn_t *conn, int status, const char *headers, const char *body, size_t len);
+
+/*
+ * Answer with length bytes of the stream with the given seed, starting
+ * at offset, generated as the connection can take them.
+ */
+void http_send_stream(http_conn_t *conn, int status, const char *headers,
+    uint32_t seed, uint64_t offset, uint64_t length);
+
+/*
+ * Files with the same size and seed are identical, so that's all an
+ * entity tag needs.  Writes the quoted tag into etag.
+ */
+#define HTTP_ETAG_MAX 32
+void http_etag(char *etag, uint64_t size, uint32_t seed);
+
+/*
+ * Answer a GET or HEAD of a whole test file, honouring Range, If-Range
+ * and If-None-Match, with its entity tag.  headers is as for http_send.
+ */
+void http_send_file(http_conn_t *conn, const http_request_t *req,
+    uint64_t size, uint32_t seed, const char *headers);
+
+#endif
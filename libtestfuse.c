@@ -0,0 +1,170 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "libtestfuse.h"
+#include "gen.h"
+#include "spec.h"
+
+// whole blocks are checked this many at a time, so that a mismatch is
+// narrowed down without going back over much
+#define VERIFY_RUN 64
+
+int tf_version(void) {
+    return TF_VERSION;
+}
+
+int tf_parse_spec(const char *str, tf_spec_t *spec) {
+    char *endptr;
+    spec->size = parse_size(str, &endptr);
+    if (spec->size == 0 || *endptr != ',' || parse_seed(endptr+1, &spec->seed) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+tf_file_t *tf_parse_spec_list(const char *list) {
+    // the parser works in place, and its names point into the copy
+    char *copy = strdup(list);
+    if (copy == NULL) {
+        return NULL;
+    }
+    spec_t *specs = parse_spec_list(copy);
+    tf_file_t *head = NULL;
+    tf_file_t **tail = &head;
+    int failed = specs == NULL;
+    while (specs) {
+        spec_t *next = specs->next;
+        tf_file_t *file = failed ? NULL : malloc(sizeof(tf_file_t));
+        if (file && (file->name = strdup(specs->name)) != NULL) {
+            file->spec.size = specs->size;
+            file->spec.seed = specs->seed;
+            file->next = NULL;
+            *tail = file;
+            tail = &file->next;
+        } else {
+            free(file);
+            failed = 1;
+        }
+        free(specs);
+        specs = next;
+    }
+    free(copy);
+    if (failed) {
+        tf_free_spec_list(head);
+        return NULL;
+    }
+    return head;
+}
+
+void tf_free_spec_list(tf_file_t *list) {
+    while (list) {
+        tf_file_t *next = list->next;
+        free(list->name);
+        free(list);
+        list = next;
+    }
+}
+
+size_t tf_generate(const tf_spec_t *spec, uint64_t offset, void *buf, size_t len) {
+    if (offset >= spec->size) {
+        return 0;
+    }
+    if (len > spec->size - offset) {
+        len = spec->size - offset;
+    }
+    get_range(buf, len, offset, spec->seed);
+    return len;
+}
+
+/*
+ * Count the bytes of data which differ from the expected bytes of one
+ * block, noting the first.
+ */
+static uint64_t compare_block(const char *data, const char *expected, size_t len,
+    uint64_t offset, uint64_t *first, uint64_t mismatched) {
+    size_t i;
+    if (memcmp(data, expected, len) == 0) {
+        return mismatched;
+    }
+    for (i=0; i<len; i++) {
+        if (data[i] != expected[i]) {
+            if (mismatched++ == 0 && first) {
+                *first = offset + i;
+            }
+        }
+    }
+    return mismatched;
+}
+
+uint64_t tf_verify(const tf_spec_t *spec, uint64_t offset, const void *buf, size_t len,
+    uint64_t *first) {
+    const char *data = buf;
+    uint64_t mismatched = 0;
+    char expected[BLOCK_SIZE];
+
+    // nothing past the end of the file can match
+    uint64_t past_end = 0;
+    if (offset >= spec->size) {
+        past_end = len;
+        len = 0;
+    } else if (len > spec->size - offset) {
+        past_end = len - (spec->size - offset);
+        len = spec->size - offset;
+    }
+
+    while (len) {
+        uint32_t block = offset >> BLOCK_SHIFT;
+        size_t block_offset = offset & OFFSET_MASK;
+        size_t n;
+        if (block_offset == 0 && len >= BLOCK_SIZE) {
+            // whole blocks: compare while generating, and only
+            // generate a copy to count mismatches if there are some
+            uint32_t count = len >> BLOCK_SHIFT;
+            if (count > VERIFY_RUN) {
+                count = VERIFY_RUN;
+            }
+            n = (size_t)count << BLOCK_SHIFT;
+            if (!verify_blocks(block, count, data, spec->seed)) {
+                uint32_t i;
+                for (i=0; i<count; i++) {
+                    get_block(block + i, expected, spec->seed);
+                    mismatched = compare_block(data + ((size_t)i << BLOCK_SHIFT), expected,
+                        BLOCK_SIZE, offset + ((uint64_t)i << BLOCK_SHIFT), first, mismatched);
+                }
+            }
+        } else {
+            n = BLOCK_SIZE - block_offset < len ? BLOCK_SIZE - block_offset : len;
+            get_block(block, expected, spec->seed);
+            mismatched = compare_block(data, expected + block_offset, n, offset, first,
+                mismatched);
+        }
+        data += n;
+        offset += n;
+        len -= n;
+    }
+    if (past_end && mismatched == 0 && first) {
+        // offset is now the end of the file
+        *first = offset;
+    }
+    return mismatched + past_end;
+}
@@ -0,0 +1,110 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * libtestfuse: the testfuse content generator as a library, for
+ * programs which generate or check test file content in-process.
+ *
+ *     tf_spec_t spec;
+ *     tf_parse_spec("1G,0x02", &spec);
+ *     tf_generate(&spec, offset, buf, len);
+ *     ...
+ *     if (tf_verify(&spec, offset, buf, len, &first) != 0) {
+ *         ...
+ *     }
+ *
+ * Every function is thread-safe, and tf_generate() and tf_verify()
+ * allocate nothing, so they can be called from any number of threads
+ * in a benchmark's inner loop.  Ranges made of whole, aligned
+ * TF_BLOCK_SIZE blocks run several blocks at a time with SIMD (SSE2, or
+ * AVX2 where the CPU has it); other ranges work too, a little slower.
+ *
+ * Only the tf_ functions are part of the stable API, and the shared
+ * library exports nothing else.
+ */
+
+#ifndef LIBTESTFUSE_H
+#define LIBTESTFUSE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TF_VERSION 1
+
+// the unit in which content is generated; see above
+#define TF_BLOCK_SIZE (64*1024)
+
+/*
+ * A test file: its content depends only on the seed, and the size says
+ * where it ends.  Files with the same seed share their content up to
+ * the shorter one's size.
+ */
+typedef struct tf_spec_s {
+    uint64_t size;
+    uint32_t seed;
+} tf_spec_t;
+
+/*
+ * One named file of a file-spec-list.
+ */
+typedef struct tf_file_s {
+    char *name;
+    tf_spec_t spec;
+    struct tf_file_s *next;
+} tf_file_t;
+
+/*
+ * Return TF_VERSION of the library in use, which may be newer than the
+ * header a program was built with.
+ */
+int tf_version(void);
+
+/*
+ * Parse "<size>,<seed>", where the size may have a k/M/G/T suffix and the
+ * seed is a nonzero 32-bit number in decimal, hex or octal.  Returns 0,
+ * or -1 if the string is malformed.
+ */
+int tf_parse_spec(const char *str, tf_spec_t *spec);
+
+/*
+ * Parse a file-spec-list, "name,size,seed[/...]", as given to testfuse.
+ * Returns the files in order, to be freed with tf_free_spec_list(), or
+ * NULL after describing the problem on stderr.
+ */
+tf_file_t *tf_parse_spec_list(const char *list);
+void tf_free_spec_list(tf_file_t *list);
+
+/*
+ * Fill buf with up to len bytes of a file starting at offset.  Returns
+ * the number of bytes generated, which is less than len only at the end
+ * of the file.
+ */
+size_t tf_generate(const tf_spec_t *spec, uint64_t offset, void *buf, size_t len);
+
+/*
+ * Check that buf holds the len bytes of a file starting at offset.
+ * Returns the number of bytes which don't match (counting any past the
+ * end of the file), and if there are any, sets *first to the file
+ * offset of the first of them.  first may be NULL.
+ */
+uint64_t tf_verify(const tf_spec_t *spec, uint64_t offset, const void *buf, size_t len,
+    uint64_t *first);
+
+#endif
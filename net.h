@@ -0,0 +1,106 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Helpers shared by the testfuse-net sender and receiver modes.
+ */
+
+#ifndef NET_H
+#define NET_H
+
+#include <stdint.h>
+
+#define NET_PORT "7359"
+
+/*
+ * Each TCP stream begins with this header, in network byte order,
+ * describing the part of the test file which follows.  Streams with the
+ * same session id belong to one transfer.
+ */
+#define NET_MAGIC "TFNET001"
+
+typedef struct net_header_s {
+    char magic[8];
+    uint64_t session;
+    uint32_t seed;
+    uint32_t streams;
+    uint64_t offset;
+    uint64_t length;
+} __attribute__((packed)) net_header_t;
+
+/*
+ * After the last byte of a stream, the receiver answers with the result
+ * of verifying it.
+ */
+typedef struct net_result_s {
+    uint64_t mismatched;
+    uint64_t first_mismatch;
+} __attribute__((packed)) net_result_t;
+
+/*
+ * Each UDP datagram begins with this header, in network byte order,
+ * followed by the test file content at the given offset.  When the
+ * sender is done, it sends a few NET_UDP_END headers alone, with seq
+ * holding the number of datagrams sent and offset the bytes of content.
+ */
+#define NET_UDP_MAGIC 0x54465544    // "TFUD"
+#define NET_UDP_END 0x54465545      // "TFUE"
+
+typedef struct net_udp_header_s {
+    uint32_t magic;
+    uint32_t seed;
+    uint64_t session;
+    uint64_t seq;
+    uint64_t offset;
+} __attribute__((packed)) net_udp_header_t;
+
+double net_now(void);
+
+/*
+ * Return a session id which is unlikely to be repeated.
+ */
+uint64_t net_session_id(void);
+
+/*
+ * Open a socket of the given type connected to (or, for UDP, aimed at)
+ * host and port.  Returns the socket, or -1 after reporting the error.
+ */
+int net_connect(const char *host, const char *port, int type);
+
+/*
+ * Open a socket of the given type bound to port on all addresses, and
+ * for TCP, listening.  Returns the socket, or -1 after reporting the
+ * error.
+ */
+int net_listen(const char *port, int type);
+
+/*
+ * Read or write exactly len bytes.  Returns 0, or -1 on error or end of
+ * file.
+ */
+int net_read_full(int fd, void *buf, size_t len);
+int net_write_full(int fd, const void *buf, size_t len);
+
+int tcp_send_main(int argc, char **argv);
+int tcp_recv_main(int argc, char **argv);
+int udp_send_main(int argc, char **argv);
+int udp_recv_main(int argc, char **argv);
+
+#endif
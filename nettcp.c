@@ -0,0 +1,563 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * TCP sender and receiver modes of testfuse-net.
+ *
+ * The sender splits a test file into one contiguous part per stream,
+ * and each stream's thread generates its part into a small ring of
+ * buffers which are sent with MSG_ZEROCOPY where the kernel supports
+ * it, so the data is never copied on the way out.  The receiver checks
+ * each stream as it arrives with the streaming verifier, and reports
+ * the rate and any corruption once every stream of a transfer is done.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <endian.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/errqueue.h>
+
+#include "gen.h"
+#include "spec.h"
+#include "verify.h"
+#include "net.h"
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+
+#define CHUNK_SIZE (1024*1024)
+
+// zerocopy buffers are reusable only once the kernel says so, which is
+// after the data is acknowledged, so keep several in flight
+#define SEND_BUFS 8
+
+typedef struct tcp_sender_s {
+    const char *host;
+    const char *port;
+    int zerocopy;
+    net_header_t header;
+
+    // results
+    int failed;
+    double finished;
+    uint32_t retransmits;
+    uint32_t mss;
+    int copied;
+    net_result_t result;
+} tcp_sender_t;
+
+/*
+ * Collect zerocopy completions from the socket's error queue, advancing
+ * *completed past every send call the kernel has finished with.  TCP
+ * completes them in order.  Blocks for at least one if wait is set.
+ * Returns 0, or -1 on error.
+ */
+static int reap_completions(tcp_sender_t *s, int fd, uint32_t *completed, int wait) {
+    for (;;) {
+        char control[128];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN) {
+                return -1;
+            }
+            if (!wait) {
+                return 0;
+            }
+            struct pollfd pfd = { fd, 0, 0 };
+            poll(&pfd, 1, 1000);
+            continue;
+        }
+        struct cmsghdr *cm;
+        for (cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+            struct sock_extended_err *serr = (struct sock_extended_err *)CMSG_DATA(cm);
+            if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY || serr->ee_errno != 0) {
+                continue;
+            }
+            // ee_info..ee_data is the range of send calls completed
+            if (serr->ee_data + 1 > *completed) {
+                *completed = serr->ee_data + 1;
+            }
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                s->copied = 1;
+            }
+        }
+        wait = 0;
+    }
+}
+
+static void *tcp_send_thread(void *arg) {
+    tcp_sender_t *s = arg;
+    int fd = net_connect(s->host, s->port, SOCK_STREAM);
+    if (fd < 0) {
+        s->failed = 1;
+        return NULL;
+    }
+    int one = 1;
+    if (s->zerocopy && setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) != 0) {
+        s->zerocopy = 0;
+    }
+
+    char *bufs[SEND_BUFS];
+    uint32_t buf_calls[SEND_BUFS];   // send calls using each buffer
+    uint32_t calls = 0, completed = 0;
+    int i;
+    for (i=0; i<SEND_BUFS; i++) {
+        if (posix_memalign((void **)&bufs[i], 4096, CHUNK_SIZE) != 0) {
+            fprintf(stderr, "error: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        buf_calls[i] = 0;
+    }
+
+    net_header_t header = s->header;
+    header.session = htobe64(header.session);
+    header.seed = htobe32(header.seed);
+    header.streams = htobe32(header.streams);
+    header.offset = htobe64(header.offset);
+    header.length = htobe64(header.length);
+    if (net_write_full(fd, &header, sizeof(header)) != 0) {
+        goto fail;
+    }
+
+    uint64_t pos = 0;
+    uint64_t chunk;
+    for (chunk=0; pos<s->header.length; chunk++) {
+        int b = chunk % SEND_BUFS;
+        size_t len = s->header.length - pos < CHUNK_SIZE ? s->header.length - pos : CHUNK_SIZE;
+        while (s->zerocopy && completed < buf_calls[b]) {
+            if (reap_completions(s, fd, &completed, 1) != 0) {
+                goto fail;
+            }
+        }
+        get_range(bufs[b], len, s->header.offset + pos, s->header.seed);
+        size_t sent = 0;
+        while (sent < len) {
+            ssize_t n = send(fd, bufs[b] + sent, len - sent, s->zerocopy ? MSG_ZEROCOPY : 0);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0 && errno == ENOBUFS && s->zerocopy) {
+                // out of pinned-page budget until more completions arrive
+                if (reap_completions(s, fd, &completed, 1) != 0) {
+                    goto fail;
+                }
+                continue;
+            }
+            if (n < 0) {
+                goto fail;
+            }
+            sent += n;
+            calls++;
+        }
+        buf_calls[b] = calls;
+        pos += len;
+        if (s->zerocopy) {
+            reap_completions(s, fd, &completed, 0);
+        }
+    }
+    shutdown(fd, SHUT_WR);
+
+    net_result_t result;
+    if (net_read_full(fd, &result, sizeof(result)) != 0) {
+        goto fail;
+    }
+    s->finished = net_now();
+    s->result.mismatched = be64toh(result.mismatched);
+    s->result.first_mismatch = be64toh(result.first_mismatch);
+
+    struct tcp_info info;
+    socklen_t info_len = sizeof(info);
+    if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &info_len) == 0) {
+        s->retransmits = info.tcpi_total_retrans;
+        s->mss = info.tcpi_snd_mss;
+    }
+    while (s->zerocopy && completed < calls) {
+        if (reap_completions(s, fd, &completed, 1) != 0) {
+            break;
+        }
+    }
+    close(fd);
+    for (i=0; i<SEND_BUFS; i++) {
+        free(bufs[i]);
+    }
+    return NULL;
+
+fail:
+    fprintf(stderr, "error: stream at offset %" PRIu64 ": %s\n", s->header.offset,
+        errno ? strerror(errno) : "connection closed");
+    s->failed = 1;
+    close(fd);
+    return NULL;
+}
+
+static void send_usage(void) {
+    fprintf(stderr, "usage: testfuse-net send [-P streams] [-p port] [-c] <host> <size>,<seed>\n");
+    fprintf(stderr, "    -P N        send over N parallel streams (default 1)\n");
+    fprintf(stderr, "    -p PORT     receiver port (default " NET_PORT ")\n");
+    fprintf(stderr, "    -c          copy data into the socket instead of MSG_ZEROCOPY\n");
+}
+
+int tcp_send_main(int argc, char **argv) {
+    int streams = 1;
+    const char *port = NET_PORT;
+    int zerocopy = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "P:p:c")) != -1) {
+        switch (opt) {
+        case 'P':
+            streams = atoi(optarg);
+            break;
+        case 'p':
+            port = optarg;
+            break;
+        case 'c':
+            zerocopy = 0;
+            break;
+        default:
+            send_usage();
+            return EXIT_FAILURE;
+        }
+    }
+    if (argc - optind != 2 || streams < 1) {
+        send_usage();
+        return EXIT_FAILURE;
+    }
+    const char *host = argv[optind];
+    char *endptr;
+    uint64_t size = parse_size(argv[optind+1], &endptr);
+    uint32_t seed;
+    if (size == 0 || *endptr != ',' || parse_seed(endptr+1, &seed) != 0) {
+        fprintf(stderr, "error: invalid size,seed\n");
+        return EXIT_FAILURE;
+    }
+
+    // split the file into block-aligned parts, one per stream
+    uint64_t session = net_session_id();
+    tcp_sender_t *senders = calloc(streams, sizeof(tcp_sender_t));
+    pthread_t *tids = calloc(streams, sizeof(pthread_t));
+    if (senders == NULL || tids == NULL) {
+        fprintf(stderr, "error: out of memory\n");
+        return EXIT_FAILURE;
+    }
+    int i;
+    for (i=0; i<streams; i++) {
+        uint64_t start = (size * i / streams) & ~(uint64_t)OFFSET_MASK;
+        uint64_t end = i+1 == streams ? size : (size * (i+1) / streams) & ~(uint64_t)OFFSET_MASK;
+        senders[i].host = host;
+        senders[i].port = port;
+        senders[i].zerocopy = zerocopy;
+        memcpy(senders[i].header.magic, NET_MAGIC, sizeof(senders[i].header.magic));
+        senders[i].header.session = session;
+        senders[i].header.seed = seed;
+        senders[i].header.streams = streams;
+        senders[i].header.offset = start;
+        senders[i].header.length = end - start;
+    }
+
+    double start = net_now();
+    for (i=0; i<streams; i++) {
+        if (pthread_create(&tids[i], NULL, tcp_send_thread, &senders[i]) != 0) {
+            fprintf(stderr, "error: can't start stream threads\n");
+            return EXIT_FAILURE;
+        }
+    }
+    int failed = 0;
+    double finished = start;
+    uint64_t retransmitted = 0;
+    uint32_t retransmits = 0;
+    uint64_t mismatched = 0, first_mismatch = UINT64_MAX;
+    int copied = 0;
+    for (i=0; i<streams; i++) {
+        pthread_join(tids[i], NULL);
+        tcp_sender_t *s = &senders[i];
+        if (s->failed) {
+            failed = 1;
+            continue;
+        }
+        if (s->finished > finished) {
+            finished = s->finished;
+        }
+        retransmits += s->retransmits;
+        retransmitted += (uint64_t)s->retransmits * s->mss;
+        copied |= s->copied;
+        mismatched += s->result.mismatched;
+        if (s->result.mismatched && s->result.first_mismatch < first_mismatch) {
+            first_mismatch = s->result.first_mismatch;
+        }
+    }
+    if (failed) {
+        return EXIT_FAILURE;
+    }
+
+    double elapsed = finished - start;
+    printf("sent %" PRIu64 " bytes over %d stream%s in %.3f s: %.2f Gbit/s goodput\n",
+        size, streams, streams == 1 ? "" : "s", elapsed, size * 8 / elapsed / 1e9);
+    printf("%" PRIu32 " segments retransmitted (about %" PRIu64 " bytes, %.3f%%)\n",
+        retransmits, retransmitted, 100.0 * retransmitted / size);
+    if (zerocopy && !senders[0].zerocopy) {
+        printf("MSG_ZEROCOPY isn't supported; data was copied\n");
+    } else if (copied) {
+        printf("the kernel copied some MSG_ZEROCOPY data (as it does over loopback)\n");
+    }
+    if (mismatched) {
+        printf("receiver found %" PRIu64 " mismatched bytes, the first at offset %" PRIu64 "\n",
+            mismatched, first_mismatch);
+        return EXIT_FAILURE;
+    }
+    printf("receiver verified the content\n");
+    return 0;
+}
+
+/*
+ * The receiver gathers the streams of each transfer into a session.
+ */
+typedef struct session_s {
+    uint64_t id;
+    uint32_t seed;
+    uint32_t streams;
+    uint32_t done;
+    int failed;
+    char peer[NI_MAXHOST];
+    double started;
+    uint64_t bytes;
+    uint64_t mismatched;
+    uint64_t first_mismatch;
+    struct session_s *next;
+} session_t;
+
+static session_t *sessions = NULL;
+static pthread_mutex_t sessions_lock = PTHREAD_MUTEX_INITIALIZER;
+static int recv_once = 0;
+
+typedef struct tcp_conn_s {
+    int fd;
+    char peer[NI_MAXHOST];
+} tcp_conn_t;
+
+static session_t *join_session(const net_header_t *header, const char *peer) {
+    session_t *session;
+    pthread_mutex_lock(&sessions_lock);
+    for (session = sessions; session != NULL; session = session->next) {
+        if (session->id == header->session) {
+            break;
+        }
+    }
+    if (session == NULL) {
+        session = calloc(1, sizeof(session_t));
+        if (session == NULL) {
+            fprintf(stderr, "error: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        session->id = header->session;
+        session->seed = header->seed;
+        session->streams = header->streams;
+        session->first_mismatch = UINT64_MAX;
+        session->started = net_now();
+        snprintf(session->peer, sizeof(session->peer), "%s", peer);
+        session->next = sessions;
+        sessions = session;
+    }
+    pthread_mutex_unlock(&sessions_lock);
+    return session;
+}
+
+static void leave_session(session_t *session, uint64_t bytes, uint64_t mismatched,
+    uint64_t first_mismatch, int failed) {
+    pthread_mutex_lock(&sessions_lock);
+    session->bytes += bytes;
+    session->mismatched += mismatched;
+    if (mismatched && first_mismatch < session->first_mismatch) {
+        session->first_mismatch = first_mismatch;
+    }
+    session->failed |= failed;
+    if (++session->done < session->streams) {
+        pthread_mutex_unlock(&sessions_lock);
+        return;
+    }
+
+    double elapsed = net_now() - session->started;
+    printf("received %" PRIu64 " bytes over %" PRIu32 " stream%s from %s in %.3f s: %.2f Gbit/s\n",
+        session->bytes, session->streams, session->streams == 1 ? "" : "s",
+        session->peer, elapsed, session->bytes * 8 / elapsed / 1e9);
+    int status = 0;
+    if (session->failed) {
+        printf("transfer incomplete\n");
+        status = EXIT_FAILURE;
+    } else if (session->mismatched) {
+        printf("%" PRIu64 " mismatched bytes, the first at offset %" PRIu64 "\n",
+            session->mismatched, session->first_mismatch);
+        status = EXIT_FAILURE;
+    } else {
+        printf("content verified\n");
+    }
+    fflush(stdout);
+
+    session_t **p;
+    for (p = &sessions; *p != session; p = &(*p)->next) {
+    }
+    *p = session->next;
+    free(session);
+    pthread_mutex_unlock(&sessions_lock);
+    if (recv_once) {
+        exit(status);
+    }
+}
+
+static void *tcp_recv_thread(void *arg) {
+    tcp_conn_t *conn = arg;
+    net_header_t header;
+    if (net_read_full(conn->fd, &header, sizeof(header)) != 0 ||
+        memcmp(header.magic, NET_MAGIC, sizeof(header.magic)) != 0) {
+        fprintf(stderr, "%s: not a testfuse-net stream\n", conn->peer);
+        close(conn->fd);
+        free(conn);
+        return NULL;
+    }
+    header.session = be64toh(header.session);
+    header.seed = be32toh(header.seed);
+    header.streams = be32toh(header.streams);
+    header.offset = be64toh(header.offset);
+    header.length = be64toh(header.length);
+    session_t *session = join_session(&header, conn->peer);
+
+    verify_ctx_t *ctx = verify_new(header.seed, header.offset);
+    char *buf = malloc(CHUNK_SIZE);
+    if (ctx == NULL || buf == NULL) {
+        fprintf(stderr, "error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    uint64_t received = 0;
+    while (received < header.length) {
+        size_t want = header.length - received < CHUNK_SIZE ? header.length - received : CHUNK_SIZE;
+        ssize_t n = recv(conn->fd, buf, want, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        verify_update(ctx, buf, n);
+        received += n;
+    }
+    uint64_t first = 0;
+    uint64_t mismatched = verify_mismatched(ctx, &first);
+    int failed = received < header.length;
+    if (!failed) {
+        net_result_t result;
+        result.mismatched = htobe64(mismatched);
+        result.first_mismatch = htobe64(first);
+        net_write_full(conn->fd, &result, sizeof(result));
+    }
+    verify_free(ctx);
+    free(buf);
+    close(conn->fd);
+    free(conn);
+    leave_session(session, received, mismatched, first, failed);
+    return NULL;
+}
+
+static void recv_usage(void) {
+    fprintf(stderr, "usage: testfuse-net recv [-p port] [-1]\n");
+    fprintf(stderr, "    -p PORT     listen on this port (default " NET_PORT ")\n");
+    fprintf(stderr, "    -1          exit after one transfer, with its status\n");
+}
+
+int tcp_recv_main(int argc, char **argv) {
+    const char *port = NET_PORT;
+    int opt;
+    while ((opt = getopt(argc, argv, "p:1")) != -1) {
+        switch (opt) {
+        case 'p':
+            port = optarg;
+            break;
+        case '1':
+            recv_once = 1;
+            break;
+        default:
+            recv_usage();
+            return EXIT_FAILURE;
+        }
+    }
+    if (argc != optind) {
+        recv_usage();
+        return EXIT_FAILURE;
+    }
+    int lfd = net_listen(port, SOCK_STREAM);
+    if (lfd < 0) {
+        return EXIT_FAILURE;
+    }
+    for (;;) {
+        struct sockaddr_storage addr;
+        socklen_t addr_len = sizeof(addr);
+        int fd = accept(lfd, (struct sockaddr *)&addr, &addr_len);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            perror("testfuse-net: accept");
+            return EXIT_FAILURE;
+        }
+        tcp_conn_t *conn = malloc(sizeof(tcp_conn_t));
+        if (conn == NULL) {
+            fprintf(stderr, "error: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        conn->fd = fd;
+        if (getnameinfo((struct sockaddr *)&addr, addr_len, conn->peer, sizeof(conn->peer),
+                NULL, 0, NI_NUMERICHOST) != 0) {
+            strcpy(conn->peer, "?");
+        }
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, tcp_recv_thread, conn) != 0) {
+            fprintf(stderr, "error: can't start a stream thread\n");
+            close(fd);
+            free(conn);
+            continue;
+        }
+        pthread_detach(tid);
+    }
+}
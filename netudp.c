@@ -0,0 +1,488 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * UDP sender and receiver modes of testfuse-net, for datagram path
+ * testing.
+ *
+ * The sender cuts a test file into datagrams, each with a header giving
+ * its sequence number and offset, and paces them with a token bucket.
+ * Datagrams are sent in batches with sendmmsg(), each message carrying
+ * a run of datagrams which the kernel segments (UDP_SEGMENT, or GSO),
+ * and the content is gathered straight from the generator's buffer
+ * rather than copied next to each header.  The receiver takes batches
+ * with recvmmsg(), coalesced by the kernel where it can (UDP_GRO), and
+ * accounts for loss, reordering, duplication and corrupted content.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <endian.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+
+#include "gen.h"
+#include "spec.h"
+#include "verify.h"
+#include "net.h"
+
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+#define DATAGRAM_SIZE 1400
+
+// the kernel segments at most 64 datagrams, and 64K, per message
+#define GSO_MAX_SEGS 64
+#define GSO_MAX_BYTES 65000
+#define BATCH_MSGS 16
+
+// bursts are limited to this long at the paced rate
+#define BURST_TIME 200e-6
+
+// how many END datagrams the sender repeats, in case some are lost
+#define END_REPEATS 3
+
+/*
+ * Parse a bit rate with an optional (decimal) k/M/G suffix.
+ */
+static double parse_rate(const char *str) {
+    char *endptr;
+    double rate = strtod(str, &endptr);
+    if (*endptr == 'k' || *endptr == 'K') {
+        rate *= 1e3;
+        endptr++;
+    } else if (*endptr == 'm' || *endptr == 'M') {
+        rate *= 1e6;
+        endptr++;
+    } else if (*endptr == 'g' || *endptr == 'G') {
+        rate *= 1e9;
+        endptr++;
+    }
+    return *endptr == '\0' ? rate : -1;
+}
+
+static void send_usage(void) {
+    fprintf(stderr, "usage: testfuse-net udp-send [-r rate] [-l size] [-p port] <host> <size>,<seed>\n");
+    fprintf(stderr, "    -r RATE     bits per second, with k/M/G suffix, or 0 for unpaced (default 1G)\n");
+    fprintf(stderr, "    -l SIZE     datagram size, including a %zu-byte header (default %d)\n",
+        sizeof(net_udp_header_t), DATAGRAM_SIZE);
+    fprintf(stderr, "    -p PORT     receiver port (default " NET_PORT ")\n");
+}
+
+int udp_send_main(int argc, char **argv) {
+    double rate = 1e9;
+    size_t datagram_size = DATAGRAM_SIZE;
+    const char *port = NET_PORT;
+    int opt;
+    while ((opt = getopt(argc, argv, "r:l:p:")) != -1) {
+        switch (opt) {
+        case 'r':
+            rate = parse_rate(optarg);
+            break;
+        case 'l':
+            datagram_size = atoi(optarg);
+            break;
+        case 'p':
+            port = optarg;
+            break;
+        default:
+            send_usage();
+            return EXIT_FAILURE;
+        }
+    }
+    if (argc - optind != 2 || rate < 0 ||
+        datagram_size <= sizeof(net_udp_header_t) || datagram_size > GSO_MAX_BYTES) {
+        send_usage();
+        return EXIT_FAILURE;
+    }
+    const char *host = argv[optind];
+    char *endptr;
+    uint64_t size = parse_size(argv[optind+1], &endptr);
+    uint32_t seed;
+    if (size == 0 || *endptr != ',' || parse_seed(endptr+1, &seed) != 0) {
+        fprintf(stderr, "error: invalid size,seed\n");
+        return EXIT_FAILURE;
+    }
+    int fd = net_connect(host, port, SOCK_DGRAM);
+    if (fd < 0) {
+        return EXIT_FAILURE;
+    }
+
+    // each message is a run of datagrams for the kernel to segment, if
+    // it can
+    size_t payload = datagram_size - sizeof(net_udp_header_t);
+    int segs = GSO_MAX_BYTES / datagram_size;
+    if (segs > GSO_MAX_SEGS) {
+        segs = GSO_MAX_SEGS;
+    }
+    int gso_size = datagram_size;
+    int gso = setsockopt(fd, SOL_UDP, UDP_SEGMENT, &gso_size, sizeof(gso_size)) == 0;
+    if (!gso) {
+        segs = 1;
+    }
+    int sndbuf = 16*1024*1024;
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+    // keep bursts short when paced
+    int batch_msgs = BATCH_MSGS;
+    if (rate > 0) {
+        double burst = rate / 8 * BURST_TIME / datagram_size;
+        if (burst < (double)segs * batch_msgs) {
+            batch_msgs = burst / segs;
+            if (batch_msgs < 1) {
+                batch_msgs = 1;
+                segs = burst < 1 ? 1 : burst;
+            }
+        }
+    }
+    size_t batch_datagrams = (size_t)segs * batch_msgs;
+    char *content = malloc(batch_datagrams * payload);
+    net_udp_header_t *headers = calloc(batch_datagrams, sizeof(net_udp_header_t));
+    struct iovec *iov = calloc(2 * batch_datagrams, sizeof(struct iovec));
+    struct mmsghdr *msgs = calloc(batch_msgs, sizeof(struct mmsghdr));
+    if (content == NULL || headers == NULL || iov == NULL || msgs == NULL) {
+        fprintf(stderr, "error: out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    uint64_t session = net_session_id();
+    uint64_t seq = 0, offset = 0, sent_bytes = 0;
+    double start = net_now();
+    while (offset < size) {
+        // generate the next batch's content in one piece, and point
+        // each datagram's second iovec into it
+        uint64_t len = size - offset < batch_datagrams * payload ? size - offset : batch_datagrams * payload;
+        get_range(content, len, offset, seed);
+        size_t n = (len + payload - 1) / payload;
+        size_t i;
+        for (i=0; i<n; i++) {
+            headers[i].magic = htobe32(NET_UDP_MAGIC);
+            headers[i].seed = htobe32(seed);
+            headers[i].session = htobe64(session);
+            headers[i].seq = htobe64(seq + i);
+            headers[i].offset = htobe64(offset + i * payload);
+            iov[2*i].iov_base = &headers[i];
+            iov[2*i].iov_len = sizeof(net_udp_header_t);
+            iov[2*i+1].iov_base = content + i * payload;
+            iov[2*i+1].iov_len = len - i * payload < payload ? len - i * payload : payload;
+        }
+        int nmsgs = (n + segs - 1) / segs;
+        int m;
+        for (m=0; m<nmsgs; m++) {
+            size_t first = (size_t)m * segs;
+            size_t count = n - first < segs ? n - first : segs;
+            memset(&msgs[m], 0, sizeof(msgs[m]));
+            msgs[m].msg_hdr.msg_iov = &iov[2*first];
+            msgs[m].msg_hdr.msg_iovlen = 2 * count;
+        }
+
+        // pace: wait until the bucket has filled enough for this batch
+        if (rate > 0) {
+            double due = start + sent_bytes * 8 / rate;
+            double wait = due - net_now();
+            if (wait > 0) {
+                struct timespec ts;
+                ts.tv_sec = wait;
+                ts.tv_nsec = (wait - ts.tv_sec) * 1e9;
+                nanosleep(&ts, NULL);
+            }
+        }
+        int done = 0;
+        while (done < nmsgs) {
+            int r = sendmmsg(fd, msgs + done, nmsgs - done, 0);
+            if (r < 0 && (errno == EINTR || errno == ENOBUFS || errno == ECONNREFUSED)) {
+                // a full queue, or no receiver yet: the datagrams are
+                // dropped for the receiver to count, unless interrupted
+                if (errno != EINTR) {
+                    done++;
+                }
+                continue;
+            }
+            if (r < 0) {
+                perror("testfuse-net: sendmmsg");
+                return EXIT_FAILURE;
+            }
+            done += r;
+        }
+        seq += n;
+        offset += len;
+        sent_bytes += len + n * sizeof(net_udp_header_t);
+    }
+    double elapsed = net_now() - start;
+
+    net_udp_header_t end;
+    end.magic = htobe32(NET_UDP_END);
+    end.seed = htobe32(seed);
+    end.session = htobe64(session);
+    end.seq = htobe64(seq);
+    end.offset = htobe64(size);
+    int i;
+    for (i=0; i<END_REPEATS; i++) {
+        send(fd, &end, sizeof(end), 0);
+        usleep(1000);
+    }
+    printf("sent %" PRIu64 " datagrams (%" PRIu64 " bytes of content) in %.3f s: %.2f Gbit/s%s\n",
+        seq, size, elapsed, sent_bytes * 8 / elapsed / 1e9, gso ? "" : ", without GSO");
+    return 0;
+}
+
+/*
+ * Received sequence numbers are remembered in a sliding window, so
+ * duplicates are recognised unless they arrive very late.
+ */
+#define SEEN_WINDOW (1 << 20)
+
+typedef struct udp_stats_s {
+    uint64_t session;
+    uint32_t seed;
+    double first, last;
+    uint64_t highest;           // highest sequence number + 1
+    uint64_t received;          // unique datagrams
+    uint64_t bytes;
+    uint64_t duplicates;
+    uint64_t reordered;
+    uint64_t corrupt;
+    uint64_t expected;          // from the END datagram, or 0
+    uint8_t *seen;
+    verify_ctx_t *ctx;
+} udp_stats_t;
+
+static void udp_report(udp_stats_t *st) {
+    uint64_t expected = st->expected ? st->expected : st->highest;
+    double elapsed = st->last - st->first;
+    printf("received %" PRIu64 " of %" PRIu64 " datagrams (%" PRIu64 " bytes of content) in %.3f s: %.2f Gbit/s\n",
+        st->received, expected, st->bytes, elapsed,
+        elapsed > 0 ? st->bytes * 8 / elapsed / 1e9 : 0);
+    printf("lost %" PRIu64 " (%.3f%%), reordered %" PRIu64 ", duplicated %" PRIu64 ", corrupt %" PRIu64 "%s\n",
+        expected - st->received, expected ? 100.0 * (expected - st->received) / expected : 0,
+        st->reordered, st->duplicates, st->corrupt,
+        st->expected ? "" : " (end of transfer not seen)");
+    fflush(stdout);
+}
+
+static void udp_reset(udp_stats_t *st, uint64_t session, uint32_t seed) {
+    uint8_t *seen = st->seen;
+    verify_free(st->ctx);
+    memset(st, 0, sizeof(*st));
+    memset(seen, 0, SEEN_WINDOW / 8);
+    st->seen = seen;
+    st->session = session;
+    st->seed = seed;
+    st->ctx = verify_new(seed, 0);
+    st->first = net_now();
+}
+
+/*
+ * Account for one datagram.  Returns 1 if it ended the transfer.
+ */
+static int udp_datagram(udp_stats_t *st, const char *data, size_t len) {
+    net_udp_header_t header;
+    if (len < sizeof(header)) {
+        return 0;
+    }
+    memcpy(&header, data, sizeof(header));
+    uint32_t magic = be32toh(header.magic);
+    if (magic != NET_UDP_MAGIC && magic != NET_UDP_END) {
+        return 0;
+    }
+    uint64_t session = be64toh(header.session);
+    uint64_t seq = be64toh(header.seq);
+    if (session != st->session) {
+        if (st->session && st->received && !st->expected) {
+            udp_report(st);
+        }
+        if (magic == NET_UDP_END) {
+            // a repeat of an END we've already reported
+            return 0;
+        }
+        udp_reset(st, session, be32toh(header.seed));
+    }
+    if (magic == NET_UDP_END) {
+        if (st->expected) {
+            // a repeat, or the transfer already timed out
+            return 0;
+        }
+        st->expected = seq;
+        return 1;
+    }
+    st->last = net_now();
+
+    // duplicates and reordering
+    if (seq + SEEN_WINDOW > st->highest) {
+        uint8_t bit = 1 << (seq % 8);
+        uint8_t *byte = &st->seen[(seq % SEEN_WINDOW) / 8];
+        if (seq >= st->highest) {
+            // clear the window slots between the old and new highest
+            uint64_t s;
+            for (s = st->highest; s < seq && s < st->highest + SEEN_WINDOW; s++) {
+                st->seen[(s % SEEN_WINDOW) / 8] &= ~(1 << (s % 8));
+            }
+            *byte &= ~bit;
+        }
+        if (*byte & bit) {
+            st->duplicates++;
+            return 0;
+        }
+        *byte |= bit;
+    }
+    if (seq < st->highest) {
+        st->reordered++;
+    } else {
+        st->highest = seq + 1;
+    }
+    st->received++;
+
+    uint64_t offset = be64toh(header.offset);
+    len -= sizeof(header);
+    st->bytes += len;
+    if (verify_offset(st->ctx) != offset) {
+        verify_seek(st->ctx, offset);
+    }
+    if (verify_update(st->ctx, data + sizeof(header), len) != 0) {
+        st->corrupt++;
+    }
+    return 0;
+}
+
+static void recv_usage(void) {
+    fprintf(stderr, "usage: testfuse-net udp-recv [-p port] [-1]\n");
+    fprintf(stderr, "    -p PORT     listen on this port (default " NET_PORT ")\n");
+    fprintf(stderr, "    -1          exit after one transfer\n");
+}
+
+// a transfer whose END datagrams are all lost is reported after this
+#define IDLE_TIMEOUT 2000
+
+// recvmmsg() batch, each buffer large enough for a GRO train
+#define RECV_MSGS 32
+#define RECV_BUF 65536
+
+int udp_recv_main(int argc, char **argv) {
+    const char *port = NET_PORT;
+    int once = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "p:1")) != -1) {
+        switch (opt) {
+        case 'p':
+            port = optarg;
+            break;
+        case '1':
+            once = 1;
+            break;
+        default:
+            recv_usage();
+            return EXIT_FAILURE;
+        }
+    }
+    if (argc != optind) {
+        recv_usage();
+        return EXIT_FAILURE;
+    }
+    int fd = net_listen(port, SOCK_DGRAM);
+    if (fd < 0) {
+        return EXIT_FAILURE;
+    }
+    int one = 1;
+    int gro = setsockopt(fd, SOL_UDP, UDP_GRO, &one, sizeof(one)) == 0;
+    int rcvbuf = 64*1024*1024;
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)) != 0) {
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    }
+
+    char *bufs = malloc(RECV_MSGS * RECV_BUF);
+    struct iovec iov[RECV_MSGS];
+    struct mmsghdr msgs[RECV_MSGS];
+    char control[RECV_MSGS][CMSG_SPACE(sizeof(int))];
+    udp_stats_t st;
+    memset(&st, 0, sizeof(st));
+    st.seen = malloc(SEEN_WINDOW / 8);
+    if (bufs == NULL || st.seen == NULL) {
+        fprintf(stderr, "error: out of memory\n");
+        return EXIT_FAILURE;
+    }
+    int i;
+    for (;;) {
+        for (i=0; i<RECV_MSGS; i++) {
+            iov[i].iov_base = bufs + i * RECV_BUF;
+            iov[i].iov_len = RECV_BUF;
+            memset(&msgs[i], 0, sizeof(msgs[i]));
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_control = gro ? control[i] : NULL;
+            msgs[i].msg_hdr.msg_controllen = gro ? sizeof(control[i]) : 0;
+        }
+        int n = recvmmsg(fd, msgs, RECV_MSGS, MSG_DONTWAIT, NULL);
+        if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+            struct pollfd pfd = { fd, POLLIN, 0 };
+            if (poll(&pfd, 1, IDLE_TIMEOUT) == 0 && st.received && !st.expected) {
+                // the sender has gone quiet without an END
+                udp_report(&st);
+                st.expected = st.highest;
+                if (once) {
+                    return 0;
+                }
+            }
+            continue;
+        }
+        if (n < 0) {
+            perror("testfuse-net: recvmmsg");
+            return EXIT_FAILURE;
+        }
+        for (i=0; i<n; i++) {
+            // a coalesced train of datagrams reports their size
+            size_t len = msgs[i].msg_len;
+            size_t seg = len;
+            struct cmsghdr *cm;
+            for (cm = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cm != NULL;
+                cm = CMSG_NXTHDR(&msgs[i].msg_hdr, cm)) {
+                if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+                    int gso_size;
+                    memcpy(&gso_size, CMSG_DATA(cm), sizeof(gso_size));
+                    seg = gso_size;
+                }
+            }
+            const char *data = bufs + i * RECV_BUF;
+            size_t pos;
+            for (pos=0; pos<len; pos+=seg) {
+                if (udp_datagram(&st, data + pos, len - pos < seg ? len - pos : seg)) {
+                    udp_report(&st);
+                    if (once) {
+                        return 0;
+                    }
+                }
+            }
+        }
+    }
+}
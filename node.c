@@ -0,0 +1,220 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#include "node.h"
+
+#define NODE_DIR "/sys/devices/system/node"
+
+/*
+ * Per-node counters, each on its own cache line since every read
+ * updates one.
+ */
+typedef struct node_counters_s {
+    uint64_t bytes;             // generated by the node's CPUs
+    uint64_t remote_bytes;      // of those, into another node's memory
+} __attribute__((aligned(64))) node_counters_t;
+
+static pthread_once_t node_once = PTHREAD_ONCE_INIT;
+static unsigned char online[NODE_MAX];
+static int nodes_online = 0;
+static short cpu_node[CPU_SETSIZE];       // or -1 if there's no such CPU
+static unsigned char bound[NODE_MAX];
+static int accounting = 0;
+static node_counters_t counters[NODE_MAX];
+
+/*
+ * Parse a list like "0-3,8,10-11" into bits[0..limit).  Returns 0, or
+ * -1 if it isn't a valid list.
+ */
+static int parse_list(const char *str, unsigned char *bits, int limit) {
+    memset(bits, 0, limit);
+    while (*str && *str != '\n') {
+        char *endptr;
+        long lo = strtol(str, &endptr, 10);
+        long hi = lo;
+        if (endptr == str) {
+            return -1;
+        }
+        if (*endptr == '-') {
+            str = endptr + 1;
+            hi = strtol(str, &endptr, 10);
+            if (endptr == str) {
+                return -1;
+            }
+        }
+        if (lo < 0 || hi < lo || hi >= limit) {
+            return -1;
+        }
+        for (; lo <= hi; lo++) {
+            bits[lo] = 1;
+        }
+        str = endptr;
+        if (*str == ',') {
+            str++;
+        } else if (*str && *str != '\n') {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int read_list(const char *path, unsigned char *bits, int limit) {
+    char line[4096];
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        return -1;
+    }
+    char *got = fgets(line, sizeof(line), f);
+    fclose(f);
+    return got ? parse_list(line, bits, limit) : -1;
+}
+
+/*
+ * Learn which nodes are online and which CPUs belong to each.  Without
+ * sysfs, everything is node 0.
+ */
+static void node_setup(void) {
+    int node, cpu;
+    if (read_list(NODE_DIR "/online", online, NODE_MAX) != 0) {
+        memset(online, 0, sizeof(online));
+        online[0] = 1;
+        for (cpu=0; cpu<CPU_SETSIZE; cpu++) {
+            cpu_node[cpu] = cpu < sysconf(_SC_NPROCESSORS_CONF) ? 0 : -1;
+        }
+    } else {
+        for (cpu=0; cpu<CPU_SETSIZE; cpu++) {
+            cpu_node[cpu] = -1;
+        }
+    }
+    for (node=0; node<NODE_MAX; node++) {
+        if (!online[node]) {
+            continue;
+        }
+        nodes_online++;
+        char path[64];
+        unsigned char cpus[CPU_SETSIZE];
+        snprintf(path, sizeof(path), NODE_DIR "/node%d/cpulist", node);
+        if (read_list(path, cpus, CPU_SETSIZE) == 0) {
+            for (cpu=0; cpu<CPU_SETSIZE; cpu++) {
+                if (cpus[cpu]) {
+                    cpu_node[cpu] = node;
+                }
+            }
+        }
+    }
+    if (nodes_online > 1) {
+        accounting = 1;
+    }
+}
+
+int node_bind(const char *list) {
+    pthread_once(&node_once, node_setup);
+    unsigned char nodes[NODE_MAX];
+    if (parse_list(list, nodes, NODE_MAX) != 0) {
+        fprintf(stderr, "error: invalid node list: %s\n", list);
+        return -1;
+    }
+
+    cpu_set_t cpus;
+    unsigned long mask = 0;
+    int node, cpu;
+    CPU_ZERO(&cpus);
+    for (node=0; node<NODE_MAX; node++) {
+        if (!nodes[node]) {
+            continue;
+        }
+        if (!online[node]) {
+            fprintf(stderr, "error: node %d isn't online\n", node);
+            return -1;
+        }
+        mask |= 1UL << node;
+        for (cpu=0; cpu<CPU_SETSIZE; cpu++) {
+            if (cpu_node[cpu] == node) {
+                CPU_SET(cpu, &cpus);
+            }
+        }
+    }
+    if (mask == 0) {
+        fprintf(stderr, "error: no nodes given\n");
+        return -1;
+    }
+    if (CPU_COUNT(&cpus) == 0) {
+        fprintf(stderr, "error: nodes %s have no CPUs\n", list);
+        return -1;
+    }
+    if (sched_setaffinity(0, sizeof(cpus), &cpus) != 0) {
+        perror("error: can't bind to the nodes' CPUs");
+        return -1;
+    }
+    // the kernel takes one less than maxnode bits from the mask
+    if (syscall(SYS_set_mempolicy, MPOL_BIND, &mask, NODE_MAX + 1) != 0) {
+        perror("error: can't bind memory to the nodes");
+        return -1;
+    }
+    memcpy(bound, nodes, sizeof(bound));
+    accounting = 1;
+    return CPU_COUNT(&cpus);
+}
+
+void node_account(const void *buf, size_t len) {
+    pthread_once(&node_once, node_setup);
+    if (!accounting) {
+        return;
+    }
+    int cpu = sched_getcpu();
+    int node = cpu >= 0 && cpu < CPU_SETSIZE && cpu_node[cpu] >= 0 ? cpu_node[cpu] : 0;
+    int mem_node;
+    if (syscall(SYS_get_mempolicy, &mem_node, NULL, 0, buf, MPOL_F_NODE | MPOL_F_ADDR) != 0) {
+        mem_node = node;
+    }
+    __atomic_add_fetch(&counters[node].bytes, len, __ATOMIC_RELAXED);
+    if (mem_node != node) {
+        __atomic_add_fetch(&counters[node].remote_bytes, len, __ATOMIC_RELAXED);
+    }
+}
+
+size_t node_stats(char *buf, size_t size) {
+    pthread_once(&node_once, node_setup);
+    size_t len = 0;
+    int node;
+    for (node=0; node<NODE_MAX && len<size; node++) {
+        if (!online[node]) {
+            continue;
+        }
+        int n = snprintf(buf + len, size - len,
+            "node %d bound=%d bytes=%" PRIu64 " remote_bytes=%" PRIu64 "\n",
+            node, bound[node],
+            __atomic_load_n(&counters[node].bytes, __ATOMIC_RELAXED),
+            __atomic_load_n(&counters[node].remote_bytes, __ATOMIC_RELAXED));
+        len += n < 0 ? 0 : n;
+    }
+    return len < size ? len : size;
+}
@@ -0,0 +1,62 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * NUMA placement.  On a multi-socket server whose NIC hangs off one
+ * socket, data generated by a CPU on another socket, or into memory on
+ * another socket, crosses the interconnect on its way out.  The daemon
+ * can be bound to the right node or nodes, and the data it generates
+ * for reads is counted by node, along with how much of it landed in
+ * memory on a node other than the generating CPU's.
+ */
+
+#ifndef NODE_H
+#define NODE_H
+
+#include <stddef.h>
+
+// nodes beyond this aren't supported
+#define NODE_MAX 64
+
+/*
+ * Bind the calling thread, and every thread it creates from now on
+ * (and any child process, such as FUSE's daemon), to the CPUs of the
+ * nodes in a list like "0", "0,1" or "0-3", with all of its memory
+ * allocated from those nodes -- buffers, thread stacks, the digest
+ * cache's pages and rings alike.  Returns the number of CPUs bound to,
+ * or -1 after reporting the problem on stderr.
+ */
+int node_bind(const char *list);
+
+/*
+ * Count len bytes generated by the calling thread into buf, by the
+ * node of the CPU and of buf's first page.  Only does anything on a
+ * machine with more than one node, or once node_bind() has been used.
+ */
+void node_account(const void *buf, size_t len);
+
+/*
+ * Describe each node and what was generated on it, a line each, into
+ * buf.  Returns the length of the text (which is truncated if it
+ * doesn't fit).
+ */
+size_t node_stats(char *buf, size_t size);
+
+#endif
@@ -0,0 +1,170 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "ns.h"
+
+/*
+ * Every entry is a series; a plain name is a series of one, with no
+ * number.
+ */
+typedef struct ns_entry_s {
+    char *prefix;
+    char *suffix;
+    int width;              // digits in the number, or 0 for none
+    uint64_t lo, hi;
+    uint64_t size;
+    uint32_t seed;
+} ns_entry_t;
+
+struct ns_s {
+    ns_entry_t *entries;
+    int nentries;
+};
+
+ns_t *ns_new(const spec_t *specs) {
+    ns_t *ns = calloc(1, sizeof(ns_t));
+    const spec_t *spec;
+    int n = 0;
+    for (spec=specs; spec!=NULL; spec=spec->next) {
+        n++;
+    }
+    if (ns == NULL || (ns->entries = calloc(n, sizeof(ns_entry_t))) == NULL) {
+        fprintf(stderr, "error: out of memory\n");
+        return NULL;
+    }
+    for (spec=specs; spec!=NULL; spec=spec->next) {
+        ns_entry_t *e = &ns->entries[ns->nentries++];
+        e->size = spec->size;
+        e->seed = spec->seed;
+        char *open = strchr(spec->name, '{');
+        if (open == NULL) {
+            e->prefix = strdup(spec->name);
+            e->suffix = strdup("");
+            continue;
+        }
+        char *endptr;
+        e->lo = strtoull(open+1, &endptr, 10);
+        if (endptr == open+1 || strncmp(endptr, "..", 2) != 0) {
+            fprintf(stderr, "error: invalid name template: %s\n", spec->name);
+            return NULL;
+        }
+        char *hi = endptr + 2;
+        e->hi = strtoull(hi, &endptr, 10);
+        if (endptr == hi || *endptr != '}' || e->hi < e->lo) {
+            fprintf(stderr, "error: invalid name template: %s\n", spec->name);
+            return NULL;
+        }
+        e->width = endptr - hi;
+        e->prefix = strndup(spec->name, open - spec->name);
+        e->suffix = strdup(endptr + 1);
+    }
+    return ns;
+}
+
+static void entry_name(const ns_entry_t *e, uint64_t i, char *name, size_t len) {
+    if (e->width) {
+        snprintf(name, len, "%s%0*llu%s", e->prefix, e->width, (unsigned long long)i, e->suffix);
+    } else {
+        snprintf(name, len, "%s", e->prefix);
+    }
+}
+
+int ns_lookup(const ns_t *ns, const char *name, uint64_t *size, uint32_t *seed) {
+    int i;
+    for (i=0; i<ns->nentries; i++) {
+        const ns_entry_t *e = &ns->entries[i];
+        size_t plen = strlen(e->prefix);
+        if (strncmp(name, e->prefix, plen) != 0) {
+            continue;
+        }
+        const char *p = name + plen;
+        uint64_t index = 0;
+        int d;
+        for (d=0; d<e->width; d++) {
+            if (p[d] < '0' || p[d] > '9') {
+                break;
+            }
+            index = index*10 + (p[d] - '0');
+        }
+        if (d < e->width || strcmp(p + d, e->suffix) != 0 ||
+            index < e->lo || index > e->hi) {
+            continue;
+        }
+        *size = e->size;
+        *seed = e->seed + (uint32_t)(index - e->lo);
+        return 0;
+    }
+    return -1;
+}
+
+/*
+ * The names in a series all have the same length, so their byte order
+ * is their numeric order, and the first one past a point can be found
+ * by binary search.  Returns 0 with *index set, or -1.
+ */
+static int entry_next(const ns_entry_t *e, const char *from, int inclusive, uint64_t *index) {
+    char name[4096];
+    uint64_t lo = e->lo, hi = e->hi + 1;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        entry_name(e, mid, name, sizeof(name));
+        int cmp = strcmp(name, from);
+        if (cmp > 0 || (inclusive && cmp == 0)) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    if (lo > e->hi) {
+        return -1;
+    }
+    *index = lo;
+    return 0;
+}
+
+int ns_next(const ns_t *ns, const char *from, int inclusive,
+    char *name, size_t len, uint64_t *size, uint32_t *seed) {
+    int found = -1;
+    char candidate[4096], start[4096];
+    int i;
+    // from may be the caller's name buffer, which is overwritten below
+    snprintf(start, sizeof(start), "%s", from);
+    from = start;
+    for (i=0; i<ns->nentries; i++) {
+        const ns_entry_t *e = &ns->entries[i];
+        uint64_t index;
+        if (entry_next(e, from, inclusive, &index) != 0) {
+            continue;
+        }
+        entry_name(e, index, candidate, sizeof(candidate));
+        if (found == 0 && strcmp(candidate, name) >= 0) {
+            continue;
+        }
+        snprintf(name, len, "%s", candidate);
+        *size = e->size;
+        *seed = e->seed + (uint32_t)(index - e->lo);
+        found = 0;
+    }
+    return found;
+}
@@ -0,0 +1,66 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * A namespace of test files built from a file-spec-list, in which a
+ * name may be a template standing for a numbered series of files:
+ *
+ *     part-{0000..9999},64M,0x10
+ *
+ * is 10000 files, part-0000 to part-9999, each 64M, with seeds 0x10,
+ * 0x11, and so on.  The number is zero-padded to the width of the upper
+ * bound.  Like any name, a template can't contain '/', which separates
+ * the specs in a list.  Series are never expanded in memory, so a
+ * namespace can hold billions of names, and they can still be looked
+ * up and listed in order.
+ */
+
+#ifndef NS_H
+#define NS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "spec.h"
+
+typedef struct ns_s ns_t;
+
+/*
+ * Build a namespace from a parsed file-spec-list.  Returns NULL after
+ * reporting a malformed template on stderr.
+ */
+ns_t *ns_new(const spec_t *specs);
+
+/*
+ * Look up a name.  Returns 0 and sets *size and *seed, or -1 if there's
+ * no such file.
+ */
+int ns_lookup(const ns_t *ns, const char *name, uint64_t *size, uint32_t *seed);
+
+/*
+ * Find the first name, in byte order, which is greater than from (or
+ * equal to it, if inclusive is set).  Returns 0 and fills in name (of
+ * at most len bytes, including the terminator), *size and *seed, or -1
+ * if there is none.
+ */
+int ns_next(const ns_t *ns, const char *from, int inclusive,
+    char *name, size_t len, uint64_t *size, uint32_t *seed);
+
+#endif
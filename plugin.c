@@ -0,0 +1,240 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <pthread.h>
+
+#include "generator.h"
+#include "plugin.h"
+
+#define PLUGIN_PREFIX "testfuse-gen-"
+#define PLUGIN_SUFFIX ".so"
+
+struct plugin_s {
+    char *field;
+    void *handle;
+    const tf_generator_t *gen;
+    void *state;
+    uint32_t format;
+
+    // statistics, updated atomically
+    uint64_t calls;
+    uint64_t bytes;
+    uint64_t batched_bytes;     // of those, through generate_blocks()
+    uint64_t nanoseconds;
+
+    struct plugin_s *next;
+};
+
+static plugin_t *plugin_list = NULL;
+static pthread_mutex_t plugin_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Plugins' formats are hashed from what determines their content, with
+ * the top bit set so they can't collide with the built-in generator's.
+ */
+static uint32_t plugin_format(const tf_generator_t *gen, const char *params) {
+    char version[16];
+    const char *parts[3] = { gen->name, params ? params : "", version };
+    uint32_t hash = 2166136261u;
+    int i;
+    snprintf(version, sizeof(version), "%" PRIu32, gen->version);
+    for (i=0; i<3; i++) {
+        const char *p;
+        for (p = parts[i]; ; p++) {
+            hash = (hash ^ (uint8_t)*p) * 16777619u;
+            if (*p == '\0') {
+                break;
+            }
+        }
+    }
+    return hash | 0x80000000u;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * The range function of plugin streams: like get_range(), the aligned
+ * run of whole blocks goes to the batch entry point where there is one.
+ */
+static void plugin_range(void *arg, char *buf, size_t size, uint64_t offset, uint32_t seed) {
+    plugin_t *plugin = arg;
+    const tf_generator_t *gen = plugin->gen;
+    uint64_t start = now_ns();
+    uint64_t batched = 0;
+
+    if (gen->generate_blocks) {
+        uint64_t first = (offset + TF_GENERATOR_BLOCK_SIZE - 1) / TF_GENERATOR_BLOCK_SIZE;
+        uint64_t end = (offset + size) / TF_GENERATOR_BLOCK_SIZE;
+        if (end > first) {
+            size_t head = first * TF_GENERATOR_BLOCK_SIZE - offset;
+            batched = (end - first) * TF_GENERATOR_BLOCK_SIZE;
+            if (head) {
+                gen->generate(plugin->state, seed, offset, buf, head);
+            }
+            // count is 32 bits; reads are never anywhere near that long
+            gen->generate_blocks(plugin->state, seed, first, end - first, buf + head);
+            if (head + batched < size) {
+                gen->generate(plugin->state, seed, offset + head + batched,
+                    buf + head + batched, size - head - batched);
+            }
+        }
+    }
+    if (batched == 0) {
+        gen->generate(plugin->state, seed, offset, buf, size);
+    }
+
+    __atomic_add_fetch(&plugin->calls, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&plugin->bytes, size, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&plugin->batched_bytes, batched, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&plugin->nanoseconds, now_ns() - start, __ATOMIC_RELAXED);
+}
+
+/*
+ * dlopen() a plugin by name: from dir if given, otherwise from the
+ * directory testfuse itself is in, and failing that from the library
+ * search path.
+ */
+static void *open_plugin(const char *name, const char *dir) {
+    char path[2*PATH_MAX];
+    if (dir) {
+        snprintf(path, sizeof(path), "%s/" PLUGIN_PREFIX "%s" PLUGIN_SUFFIX, dir, name);
+        return dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    }
+    char exe[PATH_MAX];
+    ssize_t len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+    if (len > 0) {
+        exe[len] = '\0';
+        char *slash = strrchr(exe, '/');
+        if (slash) {
+            *slash = '\0';
+            snprintf(path, sizeof(path), "%s/" PLUGIN_PREFIX "%s" PLUGIN_SUFFIX, exe, name);
+            void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+            if (handle) {
+                return handle;
+            }
+        }
+    }
+    snprintf(path, sizeof(path), PLUGIN_PREFIX "%s" PLUGIN_SUFFIX, name);
+    return dlopen(path, RTLD_NOW | RTLD_LOCAL);
+}
+
+plugin_t *plugin_load(const char *field, const char *dir) {
+    pthread_mutex_lock(&plugin_lock);
+    plugin_t *plugin;
+    for (plugin = plugin_list; plugin!=NULL; plugin=plugin->next) {
+        if (strcmp(plugin->field, field) == 0) {
+            pthread_mutex_unlock(&plugin_lock);
+            return plugin;
+        }
+    }
+    pthread_mutex_unlock(&plugin_lock);
+
+    char name[NAME_MAX];
+    const char *params = strchr(field, ':');
+    size_t len = params ? (size_t)(params - field) : strlen(field);
+    if (len == 0 || len >= sizeof(name)) {
+        fprintf(stderr, "error: invalid generator: %s\n", field);
+        return NULL;
+    }
+    memcpy(name, field, len);
+    name[len] = '\0';
+    if (params) {
+        params++;
+    }
+
+    void *handle = open_plugin(name, dir);
+    if (handle == NULL) {
+        fprintf(stderr, "error: can't load generator %s: %s\n", name, dlerror());
+        return NULL;
+    }
+    const tf_generator_t *gen = dlsym(handle, TF_GENERATOR_SYMBOL);
+    if (gen == NULL || gen->abi != TF_GENERATOR_ABI || gen->name == NULL ||
+        gen->generate == NULL) {
+        fprintf(stderr, "error: %s isn't a generator plugin for this version of testfuse\n", name);
+        dlclose(handle);
+        return NULL;
+    }
+
+    plugin = calloc(1, sizeof(plugin_t));
+    if (plugin == NULL || (plugin->field = strdup(field)) == NULL) {
+        fprintf(stderr, "error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    plugin->handle = handle;
+    plugin->gen = gen;
+    if (gen->init && (plugin->state = gen->init(params)) == NULL) {
+        fprintf(stderr, "error: can't set up generator %s\n", field);
+        free(plugin->field);
+        free(plugin);
+        dlclose(handle);
+        return NULL;
+    }
+    plugin->format = plugin_format(gen, params);
+
+    pthread_mutex_lock(&plugin_lock);
+    plugin->next = plugin_list;
+    plugin_list = plugin;
+    pthread_mutex_unlock(&plugin_lock);
+    return plugin;
+}
+
+void plugin_stream(plugin_t *plugin, uint32_t seed, gen_stream_t *stream) {
+    stream->format = plugin->format;
+    stream->seed = seed;
+    stream->range = plugin_range;
+    stream->arg = plugin;
+}
+
+const char *plugin_field(const plugin_t *plugin) {
+    return plugin->field;
+}
+
+size_t plugin_stats(char *buf, size_t size) {
+    size_t len = 0;
+    pthread_mutex_lock(&plugin_lock);
+    plugin_t *plugin;
+    for (plugin = plugin_list; plugin!=NULL && len<size; plugin=plugin->next) {
+        uint64_t bytes = __atomic_load_n(&plugin->bytes, __ATOMIC_RELAXED);
+        uint64_t ns = __atomic_load_n(&plugin->nanoseconds, __ATOMIC_RELAXED);
+        int n = snprintf(buf + len, size - len,
+            "generator %s format=%08" PRIx32 " version=%" PRIu32 " calls=%" PRIu64
+            " bytes=%" PRIu64 " batched_bytes=%" PRIu64 " seconds=%.6f gb_per_sec=%.2f\n",
+            plugin->field, plugin->format, plugin->gen->version,
+            __atomic_load_n(&plugin->calls, __ATOMIC_RELAXED), bytes,
+            __atomic_load_n(&plugin->batched_bytes, __ATOMIC_RELAXED),
+            ns / 1e9, ns ? (double)bytes / ns : 0.0);
+        len += n < 0 ? 0 : n;
+    }
+    pthread_mutex_unlock(&plugin_lock);
+    return len < size ? len : size;
+}
@@ -0,0 +1,61 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Loading of content generator plugins (see generator.h), and the
+ * streams and statistics of the loaded ones.
+ */
+
+#ifndef PLUGIN_H
+#define PLUGIN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gen.h"
+
+typedef struct plugin_s plugin_t;
+
+/*
+ * Load the generator named by a file-spec's "<name>[:<params>]" field,
+ * from dir if it isn't NULL, and initialize it with the parameters.
+ * Each distinct field is loaded once.  Returns NULL after reporting the
+ * problem on stderr.
+ */
+plugin_t *plugin_load(const char *field, const char *dir);
+
+/*
+ * Set up a stream of the plugin's content for the given seed.
+ */
+void plugin_stream(plugin_t *plugin, uint32_t seed, gen_stream_t *stream);
+
+/*
+ * Return the "<name>[:<params>]" field the plugin was loaded with.
+ */
+const char *plugin_field(const plugin_t *plugin);
+
+/*
+ * Describe every loaded plugin and how much it has generated, a line
+ * each, into buf.  Returns the length of the text (which is truncated
+ * if it doesn't fit).
+ */
+size_t plugin_stats(char *buf, size_t size);
+
+#endif
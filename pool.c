@@ -0,0 +1,303 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <limits.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "pool.h"
+#include "node.h"
+
+// tasks are as many blocks as the generator does at once with AVX2,
+// unless that would leave threads idle
+#define TASK_BLOCKS_MAX 8
+
+// reads split at once; any more are generated by their own threads
+#define JOB_SLOTS 64
+
+typedef enum {
+    JOB_FREE,
+    JOB_FILLING,            // claimed by a serving thread
+    JOB_OPEN,               // may be helped with
+    JOB_CLOSED              // every task claimed, helpers letting go
+} job_state_t;
+
+/*
+ * A read in progress.  Jobs are published without a lock: a serving
+ * thread claims a free slot, fills it in and opens it, works through
+ * its tasks, then closes it and waits for any pool threads still
+ * working on it to let go.  A pool thread counts itself as a helper
+ * before looking at a slot's state, so an open slot's fields stay put
+ * for as long as it looks at them.
+ */
+typedef struct pool_job_s {
+    uint32_t state;
+    uint32_t helpers;       // pool threads holding it, and a futex word
+    const gen_stream_t *stream;
+    char *buf;
+    uint64_t offset;
+    size_t size;
+    uint32_t task_blocks;
+    uint32_t ntasks;
+    uint32_t next_task;     // claimed atomically
+    int bulk;
+} __attribute__((aligned(64))) pool_job_t;
+
+static pool_job_t jobs[JOB_SLOTS];
+static int pool_threads = 0;
+
+// bumped whenever a job opens, and slept on by idle pool threads, who
+// are only woken if there are any
+static uint32_t work_seq = 0;
+static int idle_threads = 0;
+
+// threads generating bulk reads, serving threads included, and how many
+// there may be; a serving thread doesn't wait, having already waited
+// for its slot, so helpers give way to it between tasks
+static int bulk_busy = 0;
+static int bulk_max = 1;
+
+// statistics, updated atomically
+static uint64_t split_reads = 0;
+static uint64_t split_tasks = 0;
+static uint64_t stolen_tasks = 0;
+
+static void futex_wait(uint32_t *word, uint32_t value) {
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+}
+
+static void futex_wake(uint32_t *word, int count) {
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+/*
+ * Claim and generate tasks of a job until there are none left, or for a
+ * helper, until there are too many threads on bulk reads.  Returns the
+ * number done.
+ */
+static uint32_t run_tasks(pool_job_t *job, int helper) {
+    uint32_t done = 0;
+    uint64_t first_block = job->offset >> BLOCK_SHIFT;
+    uint64_t end = job->offset + job->size;
+    for (;;) {
+        if (helper && job->bulk &&
+            __atomic_load_n(&bulk_busy, __ATOMIC_RELAXED) > bulk_max) {
+            break;
+        }
+        uint32_t task = __atomic_fetch_add(&job->next_task, 1, __ATOMIC_RELAXED);
+        if (task >= job->ntasks) {
+            break;
+        }
+        uint64_t start = (first_block + (uint64_t)task * job->task_blocks) << BLOCK_SHIFT;
+        uint64_t stop = start + ((uint64_t)job->task_blocks << BLOCK_SHIFT);
+        if (start < job->offset) {
+            start = job->offset;
+        }
+        if (stop > end) {
+            stop = end;
+        }
+        gen_stream_range(job->stream, job->buf + (start - job->offset), stop - start, start);
+        node_account(job->buf + (start - job->offset), stop - start);
+        done++;
+    }
+    return done;
+}
+
+/*
+ * Let go of a job, waking its serving thread if it's waiting for us.
+ */
+static void let_go(pool_job_t *job) {
+    if (__atomic_sub_fetch(&job->helpers, 1, __ATOMIC_SEQ_CST) == 0 &&
+        __atomic_load_n(&job->state, __ATOMIC_SEQ_CST) == JOB_CLOSED) {
+        futex_wake(&job->helpers, INT_MAX);
+    }
+}
+
+/*
+ * Take hold of a job with unclaimed tasks which a pool thread may help
+ * with (counting the thread against the bulk limit if it's a bulk
+ * read), or return NULL.
+ */
+static pool_job_t *find_job(void) {
+    int i;
+    for (i=0; i<JOB_SLOTS; i++) {
+        pool_job_t *job = &jobs[i];
+        if (__atomic_load_n(&job->state, __ATOMIC_RELAXED) != JOB_OPEN) {
+            continue;
+        }
+        __atomic_add_fetch(&job->helpers, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&job->state, __ATOMIC_SEQ_CST) != JOB_OPEN ||
+            __atomic_load_n(&job->next_task, __ATOMIC_RELAXED) >= job->ntasks) {
+            let_go(job);
+            continue;
+        }
+        if (job->bulk) {
+            int busy = __atomic_load_n(&bulk_busy, __ATOMIC_RELAXED);
+            do {
+                if (busy >= bulk_max) {
+                    break;
+                }
+            } while (!__atomic_compare_exchange_n(&bulk_busy, &busy, busy + 1, 0,
+                __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+            if (busy >= bulk_max) {
+                let_go(job);
+                continue;
+            }
+        }
+        return job;
+    }
+    return NULL;
+}
+
+static void *pool_thread(void *arg) {
+    for (;;) {
+        uint32_t seq = __atomic_load_n(&work_seq, __ATOMIC_SEQ_CST);
+        pool_job_t *job = find_job();
+        if (job == NULL) {
+            // a job opened since seq was read makes the wait return at
+            // once, and one opened later sees this thread idle
+            __atomic_add_fetch(&idle_threads, 1, __ATOMIC_SEQ_CST);
+            futex_wait(&work_seq, seq);
+            __atomic_sub_fetch(&idle_threads, 1, __ATOMIC_SEQ_CST);
+            continue;
+        }
+        uint32_t done = run_tasks(job, 1);
+        __atomic_add_fetch(&stolen_tasks, done, __ATOMIC_RELAXED);
+        if (job->bulk) {
+            __atomic_sub_fetch(&bulk_busy, 1, __ATOMIC_RELAXED);
+        }
+        let_go(job);
+    }
+    return NULL;
+}
+
+int pool_start(int threads, int bulk_threads) {
+    bulk_max = bulk_threads > 1 ? bulk_threads : 1;
+    int i;
+    for (i=0; i<threads; i++) {
+        pthread_t thread;
+        int ret = pthread_create(&thread, NULL, pool_thread, NULL);
+        if (ret) {
+            return -ret;
+        }
+        pthread_detach(thread);
+        __atomic_add_fetch(&pool_threads, 1, __ATOMIC_RELAXED);
+    }
+    return 0;
+}
+
+/*
+ * Claim a free job slot, starting from a different one in each thread
+ * so that they don't all contend for the first, or return NULL.
+ */
+static pool_job_t *claim_slot(void) {
+    static uint32_t next_hint = 0;
+    static __thread int hint = -1;
+    if (hint < 0) {
+        hint = __atomic_fetch_add(&next_hint, 1, __ATOMIC_RELAXED) % JOB_SLOTS;
+    }
+    int i;
+    for (i=0; i<JOB_SLOTS; i++) {
+        pool_job_t *job = &jobs[(hint + i) % JOB_SLOTS];
+        uint32_t state = JOB_FREE;
+        if (__atomic_load_n(&job->state, __ATOMIC_RELAXED) == JOB_FREE &&
+            __atomic_compare_exchange_n(&job->state, &state, JOB_FILLING, 0,
+                __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            return job;
+        }
+    }
+    return NULL;
+}
+
+void pool_range(const gen_stream_t *stream, char *buf, size_t size, uint64_t offset, int bulk) {
+    int threads = __atomic_load_n(&pool_threads, __ATOMIC_RELAXED);
+    pool_job_t *job;
+    if (size < POOL_SPLIT_MIN || threads == 0 || (job = claim_slot()) == NULL) {
+        gen_stream_range(stream, buf, size, offset);
+        node_account(buf, size);
+        return;
+    }
+
+    uint32_t nblocks = ((offset + size - 1) >> BLOCK_SHIFT) - (offset >> BLOCK_SHIFT) + 1;
+    uint32_t task_blocks = TASK_BLOCKS_MAX;
+    while (task_blocks > 1 && nblocks / task_blocks < threads + 1) {
+        task_blocks /= 2;
+    }
+    job->stream = stream;
+    job->buf = buf;
+    job->offset = offset;
+    job->size = size;
+    job->task_blocks = task_blocks;
+    job->ntasks = (nblocks + task_blocks - 1) / task_blocks;
+    job->next_task = 0;
+    job->bulk = bulk != 0;
+    if (job->bulk) {
+        __atomic_add_fetch(&bulk_busy, 1, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&job->state, JOB_OPEN, __ATOMIC_RELEASE);
+
+    // wake no more idle threads than there are tasks for, or than bulk
+    // reads may have, and make no system call if none are idle
+    __atomic_add_fetch(&work_seq, 1, __ATOMIC_SEQ_CST);
+    int wake = __atomic_load_n(&idle_threads, __ATOMIC_SEQ_CST);
+    if (wake > (int)job->ntasks - 1) {
+        wake = job->ntasks - 1;
+    }
+    if (job->bulk && wake > bulk_max - __atomic_load_n(&bulk_busy, __ATOMIC_RELAXED)) {
+        wake = bulk_max - __atomic_load_n(&bulk_busy, __ATOMIC_RELAXED);
+    }
+    if (wake > 0) {
+        futex_wake(&work_seq, wake);
+    }
+
+    run_tasks(job, 0);
+
+    __atomic_store_n(&job->state, JOB_CLOSED, __ATOMIC_SEQ_CST);
+    if (job->bulk) {
+        __atomic_sub_fetch(&bulk_busy, 1, __ATOMIC_RELAXED);
+    }
+    uint32_t helpers;
+    while ((helpers = __atomic_load_n(&job->helpers, __ATOMIC_SEQ_CST)) != 0) {
+        futex_wait(&job->helpers, helpers);
+    }
+    uint32_t ntasks = job->ntasks;
+    __atomic_store_n(&job->state, JOB_FREE, __ATOMIC_RELEASE);
+
+    __atomic_add_fetch(&split_reads, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&split_tasks, ntasks, __ATOMIC_RELAXED);
+}
+
+size_t pool_stats(char *buf, size_t size) {
+    int n = snprintf(buf, size,
+        "pool threads=%d split_reads=%" PRIu64 " tasks=%" PRIu64 " stolen=%" PRIu64 "\n",
+        __atomic_load_n(&pool_threads, __ATOMIC_RELAXED),
+        __atomic_load_n(&split_reads, __ATOMIC_RELAXED),
+        __atomic_load_n(&split_tasks, __ATOMIC_RELAXED),
+        __atomic_load_n(&stolen_tasks, __ATOMIC_RELAXED));
+    if (n < 0) {
+        return 0;
+    }
+    return (size_t)n < size ? (size_t)n : size;
+}
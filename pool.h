@@ -0,0 +1,66 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * A pool of threads which helps generate large reads.  A read is split
+ * into tasks of a few 64K blocks; the thread serving the read works through
+ * them itself, and any idle pool thread steals tasks from it (or from
+ * any other read in progress) until they're all claimed, so a single
+ * stream reader can use several cores.  Bulk reads (see prio.h) are
+ * helped only so far as to keep the threads generating them, their
+ * serving threads included, within a limit, leaving the other helpers
+ * for smaller reads.
+ */
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gen.h"
+
+// reads smaller than this aren't worth splitting; FUSE (with the 2.6
+// API) sends reads of at most 128K, which must qualify, and so a split
+// takes no locks, and no system calls unless a pool thread is asleep
+#define POOL_SPLIT_MIN (2*BLOCK_SIZE)
+
+/*
+ * Start the pool threads, of which bulk reads may use as many as leave
+ * at most bulk_threads threads generating them at once.  Like
+ * digest_start(), this must be called after FUSE has daemonized.  With
+ * no threads, reads are all generated by the calling thread.
+ */
+int pool_start(int threads, int bulk_threads);
+
+/*
+ * gen_stream_range(), spread over the pool if the range is large
+ * enough (and bulk says whether it's a bulk read).  Returns once the
+ * whole range is generated.
+ */
+void pool_range(const gen_stream_t *stream, char *buf, size_t size, uint64_t offset, int bulk);
+
+/*
+ * Describe the pool's activity as a line of text in buf.  Returns the
+ * length of the text (which is truncated if it doesn't fit).
+ */
+size_t pool_stats(char *buf, size_t size);
+
+#endif
@@ -0,0 +1,523 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * An LD_PRELOAD shim which serves reads of test files under a testfuse
+ * mount in-process, straight from the generator, so that a local
+ * reader's own limits can be measured apart from the cost of FUSE:
+ *
+ *     $ TESTFUSE_MOUNT=/mnt/testfuse LD_PRELOAD=./libtestfuse-preload.so \
+ *           app /mnt/testfuse/testfile_1G
+ *
+ * Files are still opened through the mount, so the application gets a
+ * real descriptor and testfuse's own errors, and the file's size and
+ * seed are read from its extended attributes once.  From then on,
+ * read(), pread(), lseek(), fstat() and mmap() on that descriptor never
+ * reach FUSE; everything else falls through to the real calls.
+ *
+ * The file position stays the kernel's: read() claims its bytes by
+ * moving it, and lseek() moves it, measuring from the end by the size
+ * we know.  So calls which aren't wrapped (readv(), preadv(),
+ * sendfile(), splice() and the like), duplicates and child processes
+ * all see the right position, and read through FUSE from there.
+ *
+ * Only descriptors opened read-only with open() or openat() are served
+ * this way, along with their duplicates.  stdio opens files inside libc where they
+ * can't be intercepted, so FILE streams read through the mount as
+ * before.  Mappings of up to MMAP_MAX bytes are generated in full when
+ * they're made; larger ones are left to FUSE to fill as they're touched.
+ */
+
+// the real calls are looked up by their plain names
+#undef _FILE_OFFSET_BITS
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dlfcn.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+
+#include "gen.h"
+
+#define XATTR_PREFIX "user.testfuse."
+
+// descriptors above this fall through to FUSE
+#define FD_MAX 65536
+
+// and so do mappings larger than this, which would take too long (and
+// too much memory) to generate up front
+#define MMAP_MAX (64*1024*1024)
+
+_Static_assert(sizeof(struct stat) == sizeof(struct stat64),
+    "fstat() and fstat64() must share one cached stat");
+
+typedef struct preload_file_s {
+    int refs;               // descriptors sharing this open file
+    uint64_t size;
+    uint32_t seed;
+    struct stat st;
+} preload_file_t;
+
+static preload_file_t *files[FD_MAX];
+
+static char mount[PATH_MAX];
+static size_t mount_len = 0;
+
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static int (*real_open)(const char *, int, ...);
+static int (*real_openat)(int, const char *, int, ...);
+static int (*real_close)(int);
+static int (*real_dup)(int);
+static int (*real_dup2)(int, int);
+static int (*real_dup3)(int, int, int);
+static int (*real_fcntl)(int, int, ...);
+static ssize_t (*real_read)(int, void *, size_t);
+static ssize_t (*real_pread)(int, void *, size_t, off_t);
+static off_t (*real_lseek)(int, off_t, int);
+static int (*real_fstat)(int, struct stat *);
+static int (*real_fxstat)(int, int, struct stat *);
+static void *(*real_mmap)(void *, size_t, int, int, int, off_t);
+
+static void setup(void) {
+    real_open = dlsym(RTLD_NEXT, "open");
+    real_openat = dlsym(RTLD_NEXT, "openat");
+    real_close = dlsym(RTLD_NEXT, "close");
+    real_dup = dlsym(RTLD_NEXT, "dup");
+    real_dup2 = dlsym(RTLD_NEXT, "dup2");
+    real_dup3 = dlsym(RTLD_NEXT, "dup3");
+    real_fcntl = dlsym(RTLD_NEXT, "fcntl");
+    real_read = dlsym(RTLD_NEXT, "read");
+    real_pread = dlsym(RTLD_NEXT, "pread");
+    real_lseek = dlsym(RTLD_NEXT, "lseek");
+    real_fstat = dlsym(RTLD_NEXT, "fstat");
+    real_fxstat = dlsym(RTLD_NEXT, "__fxstat");
+    real_mmap = dlsym(RTLD_NEXT, "mmap");
+
+    // without a mount, every call falls through
+    const char *path = getenv("TESTFUSE_MOUNT");
+    if (path && realpath(path, mount)) {
+        mount_len = strlen(mount);
+        while (mount_len && mount[mount_len-1] == '/') {
+            mount[--mount_len] = '\0';
+        }
+    }
+}
+
+static preload_file_t *lookup(int fd) {
+    if (fd < 0 || fd >= FD_MAX) {
+        return NULL;
+    }
+    return __atomic_load_n(&files[fd], __ATOMIC_ACQUIRE);
+}
+
+static void release(preload_file_t *file) {
+    if (file && __atomic_sub_fetch(&file->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(file);
+    }
+}
+
+/*
+ * Point a descriptor at an open file (or at nothing), dropping whatever
+ * it referred to before.
+ */
+static void set_file(int fd, preload_file_t *file) {
+    if (fd < 0 || fd >= FD_MAX) {
+        return;
+    }
+    if (file) {
+        __atomic_add_fetch(&file->refs, 1, __ATOMIC_RELAXED);
+    }
+    release(__atomic_exchange_n(&files[fd], file, __ATOMIC_ACQ_REL));
+}
+
+/*
+ * Whether a path (relative to dirfd, if it's relative) is under the
+ * mount.  Paths relative to directories other than the working
+ * directory aren't resolved, and so are never served.
+ */
+static int under_mount(int dirfd, const char *path) {
+    char full[PATH_MAX];
+    if (mount_len == 0) {
+        return 0;
+    }
+    if (path[0] != '/') {
+        if (dirfd != AT_FDCWD || getcwd(full, sizeof(full)) == NULL) {
+            return 0;
+        }
+        size_t len = strlen(full);
+        snprintf(full + len, sizeof(full) - len, "/%s", path);
+        path = full;
+    }
+    return strncmp(path, mount, mount_len) == 0 && path[mount_len] == '/';
+}
+
+static int get_xattr(int fd, const char *name, char *value, size_t len) {
+    ssize_t n = fgetxattr(fd, name, value, len - 1);
+    if (n < 0) {
+        return -1;
+    }
+    value[n] = '\0';
+    return 0;
+}
+
+/*
+ * Start serving a newly opened descriptor, if it's a test file.  Other
+ * files under the mount (digests, torrents) have no size and seed, and
+ * files from generator plugins are left to the mount.
+ */
+static void track(int fd, int dirfd, const char *path, int flags) {
+    if (fd < 0 || fd >= FD_MAX || (flags & O_ACCMODE) != O_RDONLY ||
+        !under_mount(dirfd, path)) {
+        return;
+    }
+    char size[32], seed[32], generator[256];
+    preload_file_t *file = malloc(sizeof(preload_file_t));
+    if (file == NULL ||
+        get_xattr(fd, XATTR_PREFIX "size", size, sizeof(size)) != 0 ||
+        get_xattr(fd, XATTR_PREFIX "seed", seed, sizeof(seed)) != 0 ||
+        get_xattr(fd, XATTR_PREFIX "generator", generator, sizeof(generator)) == 0 ||
+        real_fstat(fd, &file->st) != 0) {
+        free(file);
+        return;
+    }
+    file->refs = 0;
+    file->size = strtoull(size, NULL, 10);
+    file->seed = strtoul(seed, NULL, 10);
+    file->st.st_size = file->size;
+    set_file(fd, file);
+}
+
+static int do_open(const char *path, int flags, mode_t mode) {
+    pthread_once(&once, setup);
+    int fd = real_open(path, flags, mode);
+    track(fd, AT_FDCWD, path, flags);
+    return fd;
+}
+
+static int do_openat(int dirfd, const char *path, int flags, mode_t mode) {
+    pthread_once(&once, setup);
+    int fd = real_openat(dirfd, path, flags, mode);
+    track(fd, dirfd, path, flags);
+    return fd;
+}
+
+/*
+ * The mode argument is only there when a file may be created.
+ */
+#define OPEN_MODE(flags, mode) \
+    if ((flags) & (O_CREAT | O_TMPFILE)) { \
+        va_list ap; \
+        va_start(ap, flags); \
+        mode = va_arg(ap, mode_t); \
+        va_end(ap); \
+    }
+
+int open(const char *path, int flags, ...) {
+    mode_t mode = 0;
+    OPEN_MODE(flags, mode);
+    return do_open(path, flags, mode);
+}
+
+int open64(const char *path, int flags, ...) {
+    mode_t mode = 0;
+    OPEN_MODE(flags, mode);
+    return do_open(path, flags, mode);
+}
+
+int openat(int dirfd, const char *path, int flags, ...) {
+    mode_t mode = 0;
+    OPEN_MODE(flags, mode);
+    return do_openat(dirfd, path, flags, mode);
+}
+
+int openat64(int dirfd, const char *path, int flags, ...) {
+    mode_t mode = 0;
+    OPEN_MODE(flags, mode);
+    return do_openat(dirfd, path, flags, mode);
+}
+
+// the checked variants used with _FORTIFY_SOURCE
+int __open_2(const char *path, int flags) {
+    return do_open(path, flags, 0);
+}
+
+int __open64_2(const char *path, int flags) {
+    return do_open(path, flags, 0);
+}
+
+int __openat_2(int dirfd, const char *path, int flags) {
+    return do_openat(dirfd, path, flags, 0);
+}
+
+int __openat64_2(int dirfd, const char *path, int flags) {
+    return do_openat(dirfd, path, flags, 0);
+}
+
+int close(int fd) {
+    pthread_once(&once, setup);
+    set_file(fd, NULL);
+    return real_close(fd);
+}
+
+/*
+ * A duplicate shares the open file, and so the position, as it does in
+ * the kernel.  Descriptors replaced by dup2() and dup3() are closed.
+ */
+int dup(int fd) {
+    pthread_once(&once, setup);
+    int new_fd = real_dup(fd);
+    if (new_fd >= 0) {
+        set_file(new_fd, lookup(fd));
+    }
+    return new_fd;
+}
+
+int dup2(int fd, int new_fd) {
+    pthread_once(&once, setup);
+    int ret = real_dup2(fd, new_fd);
+    if (ret >= 0 && fd != new_fd) {
+        set_file(new_fd, lookup(fd));
+    }
+    return ret;
+}
+
+int dup3(int fd, int new_fd, int flags) {
+    pthread_once(&once, setup);
+    int ret = real_dup3(fd, new_fd, flags);
+    if (ret >= 0) {
+        set_file(new_fd, lookup(fd));
+    }
+    return ret;
+}
+
+/*
+ * Every fcntl() argument fits in a pointer, so pass it on as one.
+ */
+static int do_fcntl(int fd, int cmd, void *arg) {
+    pthread_once(&once, setup);
+    int ret = real_fcntl(fd, cmd, arg);
+    if (ret >= 0 && (cmd == F_DUPFD || cmd == F_DUPFD_CLOEXEC)) {
+        set_file(ret, lookup(fd));
+    }
+    return ret;
+}
+
+int fcntl(int fd, int cmd, ...) {
+    va_list ap;
+    va_start(ap, cmd);
+    void *arg = va_arg(ap, void *);
+    va_end(ap);
+    return do_fcntl(fd, cmd, arg);
+}
+
+int fcntl64(int fd, int cmd, ...) {
+    va_list ap;
+    va_start(ap, cmd);
+    void *arg = va_arg(ap, void *);
+    va_end(ap);
+    return do_fcntl(fd, cmd, arg);
+}
+
+static size_t clip(const preload_file_t *file, uint64_t offset, size_t count) {
+    if (offset >= file->size) {
+        return 0;
+    }
+    return file->size - offset < count ? file->size - offset : count;
+}
+
+/*
+ * Claim the next count bytes of the file position by moving the
+ * kernel's (which FUSE leaves to the kernel), so that concurrent reads
+ * of one descriptor don't overlap, and then give back any past the end.
+ */
+ssize_t read(int fd, void *buf, size_t count) {
+    pthread_once(&once, setup);
+    preload_file_t *file = lookup(fd);
+    if (file == NULL) {
+        return real_read(fd, buf, count);
+    }
+    if (count > file->size) {
+        count = file->size;
+    }
+    off_t end = real_lseek(fd, count, SEEK_CUR);
+    if (end < 0) {
+        // too far along to claim anything; let the real call say so
+        return real_read(fd, buf, count);
+    }
+    uint64_t offset = end - count;
+    size_t n = clip(file, offset, count);
+    if (n < count && real_lseek(fd, offset + n, SEEK_SET) < 0) {
+        return -1;
+    }
+    get_range(buf, n, offset, file->seed);
+    return n;
+}
+
+static ssize_t do_pread(int fd, void *buf, size_t count, off_t offset) {
+    pthread_once(&once, setup);
+    preload_file_t *file = lookup(fd);
+    if (file == NULL) {
+        return real_pread(fd, buf, count, offset);
+    }
+    if (offset < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    size_t n = clip(file, offset, count);
+    get_range(buf, n, offset, file->seed);
+    return n;
+}
+
+ssize_t pread(int fd, void *buf, size_t count, off_t offset) {
+    return do_pread(fd, buf, count, offset);
+}
+
+ssize_t pread64(int fd, void *buf, size_t count, off_t offset) {
+    return do_pread(fd, buf, count, offset);
+}
+
+/*
+ * Move the kernel's file position, working out where the end is (and
+ * where data and holes are) from the size we know, rather than having
+ * FUSE asked for it.
+ */
+static off_t do_lseek(int fd, off_t offset, int whence) {
+    pthread_once(&once, setup);
+    preload_file_t *file = lookup(fd);
+    if (file == NULL) {
+        return real_lseek(fd, offset, whence);
+    }
+    int64_t base;
+    switch (whence) {
+    case SEEK_SET:
+    case SEEK_CUR:
+        return real_lseek(fd, offset, whence);
+    case SEEK_END:
+        base = file->size;
+        break;
+    case SEEK_DATA:
+    case SEEK_HOLE:
+        // the whole file is data, with the implicit hole at the end
+        if ((uint64_t)offset >= file->size) {
+            errno = ENXIO;
+            return -1;
+        }
+        offset = whence == SEEK_DATA ? offset : (off_t)file->size;
+        base = 0;
+        break;
+    default:
+        errno = EINVAL;
+        return -1;
+    }
+    if (base + offset < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    return real_lseek(fd, base + offset, SEEK_SET);
+}
+
+off_t lseek(int fd, off_t offset, int whence) {
+    return do_lseek(fd, offset, whence);
+}
+
+off_t lseek64(int fd, off_t offset, int whence) {
+    return do_lseek(fd, offset, whence);
+}
+
+int fstat(int fd, struct stat *st) {
+    pthread_once(&once, setup);
+    preload_file_t *file = lookup(fd);
+    if (file == NULL) {
+        return real_fstat(fd, st);
+    }
+    memcpy(st, &file->st, sizeof(struct stat));
+    return 0;
+}
+
+int fstat64(int fd, struct stat64 *st) {
+    return fstat(fd, (struct stat *)st);
+}
+
+// programs built against glibc before 2.33 call these instead
+int __fxstat(int ver, int fd, struct stat *st);
+int __fxstat64(int ver, int fd, struct stat64 *st);
+
+int __fxstat(int ver, int fd, struct stat *st) {
+    pthread_once(&once, setup);
+    preload_file_t *file = lookup(fd);
+    if (file == NULL) {
+        return real_fxstat(ver, fd, st);
+    }
+    memcpy(st, &file->st, sizeof(struct stat));
+    return 0;
+}
+
+int __fxstat64(int ver, int fd, struct stat64 *st) {
+    return __fxstat(ver, fd, (struct stat *)st);
+}
+
+/*
+ * Map anonymous memory instead, filled with the file's content (and
+ * zeroes past the end, as for a real file), then given the protection
+ * asked for.  Writes to a shared mapping are never written back, but
+ * testfuse files are read-only anyway.
+ */
+static void *do_mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset) {
+    pthread_once(&once, setup);
+    preload_file_t *file = lookup(fd);
+    if (file == NULL || (flags & MAP_ANONYMOUS) || len > MMAP_MAX) {
+        return real_mmap(addr, len, prot, flags, fd, offset);
+    }
+    if (offset < 0 || (offset & (sysconf(_SC_PAGESIZE) - 1)) != 0) {
+        errno = EINVAL;
+        return MAP_FAILED;
+    }
+    int anon_flags = MAP_PRIVATE | MAP_ANONYMOUS |
+        (flags & (MAP_FIXED | MAP_FIXED_NOREPLACE | MAP_POPULATE | MAP_NORESERVE));
+    void *map = real_mmap(addr, len, PROT_READ | PROT_WRITE, anon_flags, -1, 0);
+    if (map == MAP_FAILED) {
+        return map;
+    }
+    get_range(map, clip(file, offset, len), offset, file->seed);
+    if (prot != (PROT_READ | PROT_WRITE) && mprotect(map, len, prot) != 0) {
+        int err = errno;
+        munmap(map, len);
+        errno = err;
+        return MAP_FAILED;
+    }
+    return map;
+}
+
+void *mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset) {
+    return do_mmap(addr, len, prot, flags, fd, offset);
+}
+
+void *mmap64(void *addr, size_t len, int prot, int flags, int fd, off_t offset) {
+    return do_mmap(addr, len, prot, flags, fd, offset);
+}
@@ -0,0 +1,458 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#include "prio.h"
+
+// latencies are counted in power-of-two buckets of microseconds, the
+// last bucket taking everything from about 35 minutes up
+#define HIST_BUCKETS 32
+
+// clients beyond this many at once share one entry
+#define CLIENT_MAX 1024
+
+// an entry with no requests in progress for this long may be reused
+#define CLIENT_IDLE_NS (60ULL*1000000000)
+
+// the key of an entry being taken over for another client
+#define KEY_RECLAIMING UINT64_MAX
+
+#define WEIGHT_MAX 64
+
+static const char *class_names[PRIO_CLASSES] = { "meta", "small", "bulk" };
+
+typedef struct prio_counters_s {
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t queued;        // bulk reads which had to wait for a slot
+    uint64_t queued_ns;
+    uint64_t hist[HIST_BUCKETS];
+} __attribute__((aligned(64))) prio_counters_t;
+
+static prio_counters_t counters[PRIO_CLASSES];
+
+static size_t bulk_size = PRIO_BULK_SIZE;
+static int bulk_slots = 1;
+
+/*
+ * A bulk read waiting for a slot, on the stack of the thread serving
+ * it.
+ */
+typedef struct prio_waiter_s {
+    size_t size;
+    int admitted;
+    pthread_cond_t cond;
+    struct prio_waiter_s *next;
+} prio_waiter_t;
+
+/*
+ * Everyone who has made a request lately.  An entry is claimed, under
+ * bulk_lock, by setting its key to the client ID plus one.  Lookups
+ * don't lock: they count themselves in inflight and then check the key
+ * is still theirs, while an idle entry is only taken over for another
+ * client after its key is set to KEY_RECLAIMING and inflight is seen to
+ * still be zero.  Entries never go back to empty, so probe sequences
+ * stay intact.  The queueing state is under bulk_lock; the rest is
+ * counted atomically.
+ */
+struct prio_client_s {
+    uint64_t key;
+    uint32_t inflight;          // requests between prio_client() and prio_end()
+    unsigned int weight;
+
+    prio_waiter_t *head;        // queued bulk reads, in arrival order
+    prio_waiter_t *tail;
+    int64_t deficit;            // bytes it may still have this turn
+    int in_turn;                // its quantum has been added this turn
+    struct prio_client_s *next_active;
+
+    uint64_t reads;
+    uint64_t bytes;
+    uint64_t queued_ns;
+    uint64_t first_ns;          // of its first and latest requests
+    uint64_t last_ns;
+};
+
+static prio_client_t clients[CLIENT_MAX + 1] = { [CLIENT_MAX] = { .weight = 1 } };
+
+static const char *client_key = NULL;
+static struct {
+    uint32_t id;
+    unsigned int weight;
+} weights[WEIGHT_MAX];
+static int nweights = 0;
+
+/*
+ * Bulk reads are admitted by deficit round robin: clients with reads
+ * queued take turns, each turn adding the bulk size times the client's
+ * weight to what it may read, and admitting its reads while they fit.
+ * So each client gets slots in proportion to its weight, however deep
+ * its queue, and a single client is served first come first served.
+ */
+static pthread_mutex_t bulk_lock = PTHREAD_MUTEX_INITIALIZER;
+static prio_client_t *active_head = NULL;
+static prio_client_t *active_tail = NULL;
+static int bulk_active = 0;
+
+void prio_config(size_t size, int slots) {
+    bulk_size = size ? size : PRIO_BULK_SIZE;
+    bulk_slots = slots > 0 ? slots : 1;
+}
+
+int prio_fair(const char *key, const char *list) {
+    client_key = key;
+    nweights = 0;
+    while (list && *list) {
+        char *endptr;
+        unsigned long id = strtoul(list, &endptr, 10);
+        if (endptr == list || *endptr != ':' || nweights == WEIGHT_MAX) {
+            return -1;
+        }
+        list = endptr + 1;
+        unsigned long weight = strtoul(list, &endptr, 10);
+        if (endptr == list || weight < 1 || weight > 1000 || (*endptr != ',' && *endptr != '\0')) {
+            return -1;
+        }
+        weights[nweights].id = id;
+        weights[nweights].weight = weight;
+        nweights++;
+        list = *endptr ? endptr + 1 : endptr;
+    }
+    return 0;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static uint64_t elapsed_ns(const struct timespec *since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)(now.tv_sec - since->tv_sec) * 1000000000 + now.tv_nsec - since->tv_nsec;
+}
+
+/*
+ * Find a client's entry without locking, or return NULL.
+ */
+static prio_client_t *find_client(uint64_t key) {
+    uint32_t slot = ((uint32_t)(key - 1) * 2654435761U) % CLIENT_MAX;
+    int probes;
+    for (probes=0; probes<CLIENT_MAX; probes++) {
+        uint64_t seen = __atomic_load_n(&clients[slot].key, __ATOMIC_ACQUIRE);
+        if (seen == key) {
+            return &clients[slot];
+        }
+        if (seen == 0) {
+            break;
+        }
+        slot = (slot + 1) % CLIENT_MAX;
+    }
+    return NULL;
+}
+
+/*
+ * Take over an entry if nobody's using it and it has been idle a while.
+ * Must be called with bulk_lock held.
+ */
+static int reclaim_client(prio_client_t *c, uint64_t now) {
+    uint64_t old = __atomic_load_n(&c->key, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&c->inflight, __ATOMIC_SEQ_CST) != 0 ||
+        now - __atomic_load_n(&c->last_ns, __ATOMIC_RELAXED) < CLIENT_IDLE_NS) {
+        return 0;
+    }
+    __atomic_store_n(&c->key, KEY_RECLAIMING, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&c->inflight, __ATOMIC_SEQ_CST) != 0) {
+        // someone looked it up just now
+        __atomic_store_n(&c->key, old, __ATOMIC_SEQ_CST);
+        return 0;
+    }
+    __atomic_store_n(&c->reads, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->bytes, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->queued_ns, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->first_ns, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->last_ns, 0, __ATOMIC_RELAXED);
+    return 1;
+}
+
+/*
+ * Add a client's entry, in an empty slot or one reclaimed from an idle
+ * client, unless another thread has just added it.  Returns NULL if the
+ * table is full of clients in use.
+ */
+static prio_client_t *add_client(uint32_t id) {
+    uint64_t key = (uint64_t)id + 1;
+    unsigned int weight = 1;
+    int i;
+    for (i=0; i<nweights; i++) {
+        if (weights[i].id == id) {
+            weight = weights[i].weight;
+        }
+    }
+
+    pthread_mutex_lock(&bulk_lock);
+    uint64_t now = now_ns();
+    prio_client_t *c = find_client(key);
+    uint32_t slot = (id * 2654435761U) % CLIENT_MAX;
+    int probes;
+    for (probes=0; c == NULL && probes<CLIENT_MAX; probes++) {
+        prio_client_t *e = &clients[slot];
+        if (e->key == 0 || (e->key != KEY_RECLAIMING && reclaim_client(e, now))) {
+            e->weight = weight;
+            // not idle, or the next new client could take it straight back
+            __atomic_store_n(&e->last_ns, now, __ATOMIC_RELAXED);
+            __atomic_store_n(&e->key, key, __ATOMIC_SEQ_CST);
+            c = e;
+        }
+        slot = (slot + 1) % CLIENT_MAX;
+    }
+    pthread_mutex_unlock(&bulk_lock);
+    return c;
+}
+
+prio_client_t *prio_client(uint32_t id) {
+    uint64_t key = (uint64_t)id + 1;
+    for (;;) {
+        prio_client_t *c = find_client(key);
+        if (c == NULL && (c = add_client(id)) == NULL) {
+            // full; everyone else shares the last entry
+            c = &clients[CLIENT_MAX];
+        }
+        __atomic_add_fetch(&c->inflight, 1, __ATOMIC_SEQ_CST);
+        if (c == &clients[CLIENT_MAX] || __atomic_load_n(&c->key, __ATOMIC_SEQ_CST) == key) {
+            return c;
+        }
+        // taken over for someone else in the meantime
+        __atomic_sub_fetch(&c->inflight, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+prio_class_t prio_read_class(size_t size) {
+    return size >= bulk_size ? PRIO_BULK : PRIO_SMALL;
+}
+
+/*
+ * Admit queued bulk reads while there are slots.  Must be called with
+ * bulk_lock held.
+ */
+static void dispatch(void) {
+    while (bulk_active < bulk_slots && active_head != NULL) {
+        prio_client_t *c = active_head;
+        if (!c->in_turn) {
+            c->deficit += (int64_t)bulk_size * c->weight;
+            c->in_turn = 1;
+        }
+        prio_waiter_t *w = c->head;
+        if ((int64_t)w->size > c->deficit) {
+            // its turn is over; to the back of the round
+            c->in_turn = 0;
+            if (c != active_tail) {
+                active_head = c->next_active;
+                c->next_active = NULL;
+                active_tail->next_active = c;
+                active_tail = c;
+            }
+            continue;
+        }
+        c->deficit -= w->size;
+        c->head = w->next;
+        w->admitted = 1;
+        bulk_active++;
+        pthread_cond_signal(&w->cond);
+        if (c->head == NULL) {
+            // nothing left to send, so nothing saved up for later
+            c->tail = NULL;
+            c->deficit = 0;
+            c->in_turn = 0;
+            active_head = c->next_active;
+            c->next_active = NULL;
+            if (active_head == NULL) {
+                active_tail = NULL;
+            }
+        }
+    }
+}
+
+void prio_begin(prio_class_t class, prio_client_t *client, size_t size, prio_ticket_t *ticket) {
+    ticket->class = class;
+    ticket->client = client;
+    clock_gettime(CLOCK_MONOTONIC, &ticket->start);
+    if (client) {
+        uint64_t ns = (uint64_t)ticket->start.tv_sec * 1000000000 + ticket->start.tv_nsec;
+        uint64_t none = 0;
+        __atomic_compare_exchange_n(&client->first_ns, &none, ns, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    }
+    if (class != PRIO_BULK) {
+        return;
+    }
+    if (client == NULL) {
+        client = &clients[CLIENT_MAX];
+    }
+
+    prio_waiter_t w = {
+        .size = size,
+        .admitted = 0,
+        .next = NULL,
+    };
+    pthread_mutex_lock(&bulk_lock);
+    if (client->head) {
+        client->tail->next = &w;
+    } else {
+        client->head = &w;
+        if (active_tail) {
+            active_tail->next_active = client;
+        } else {
+            active_head = client;
+        }
+        active_tail = client;
+    }
+    client->tail = &w;
+    dispatch();
+    if (w.admitted) {
+        pthread_mutex_unlock(&bulk_lock);
+        return;
+    }
+    pthread_cond_init(&w.cond, NULL);
+    while (!w.admitted) {
+        pthread_cond_wait(&w.cond, &bulk_lock);
+    }
+    pthread_mutex_unlock(&bulk_lock);
+    pthread_cond_destroy(&w.cond);
+
+    uint64_t ns = elapsed_ns(&ticket->start);
+    prio_counters_t *c = &counters[PRIO_BULK];
+    __atomic_add_fetch(&c->queued, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&c->queued_ns, ns, __ATOMIC_RELAXED);
+    if (ticket->client) {
+        __atomic_add_fetch(&ticket->client->queued_ns, ns, __ATOMIC_RELAXED);
+    }
+}
+
+void prio_end(prio_ticket_t *ticket, size_t bytes) {
+    if (ticket->class == PRIO_BULK) {
+        pthread_mutex_lock(&bulk_lock);
+        bulk_active--;
+        dispatch();
+        pthread_mutex_unlock(&bulk_lock);
+    }
+
+    uint64_t ns = elapsed_ns(&ticket->start);
+    uint64_t us = ns / 1000;
+    int bucket = 0;
+    while (us > 1 && bucket < HIST_BUCKETS - 1) {
+        us >>= 1;
+        bucket++;
+    }
+    prio_counters_t *c = &counters[ticket->class];
+    __atomic_add_fetch(&c->total_ns, ns, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&c->hist[bucket], 1, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&c->max_ns, __ATOMIC_RELAXED);
+    while (ns > max && !__atomic_compare_exchange_n(&c->max_ns, &max, ns, 0,
+        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+
+    prio_client_t *client = ticket->client;
+    if (client && ticket->class != PRIO_META) {
+        __atomic_add_fetch(&client->reads, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&client->bytes, bytes, __ATOMIC_RELAXED);
+    }
+    if (client) {
+        __atomic_store_n(&client->last_ns, now_ns(), __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&client->inflight, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+/*
+ * The upper bound, in microseconds, of the bucket holding the given
+ * fraction of ops.
+ */
+static uint64_t percentile_us(const uint64_t *hist, uint64_t ops, double fraction) {
+    uint64_t want = (uint64_t)(ops * fraction + 0.999999);
+    uint64_t seen = 0;
+    int bucket;
+    for (bucket=0; bucket<HIST_BUCKETS-1; bucket++) {
+        seen += hist[bucket];
+        if (seen >= want) {
+            break;
+        }
+    }
+    return (uint64_t)2 << bucket;
+}
+
+size_t prio_stats(char *buf, size_t size) {
+    size_t len = 0;
+    int class;
+    for (class=0; class<PRIO_CLASSES && len<size; class++) {
+        prio_counters_t *c = &counters[class];
+        uint64_t hist[HIST_BUCKETS];
+        uint64_t ops = 0;
+        int bucket;
+        for (bucket=0; bucket<HIST_BUCKETS; bucket++) {
+            hist[bucket] = __atomic_load_n(&c->hist[bucket], __ATOMIC_RELAXED);
+            ops += hist[bucket];
+        }
+        uint64_t total_ns = __atomic_load_n(&c->total_ns, __ATOMIC_RELAXED);
+        int n = snprintf(buf + len, size - len,
+            "class %s ops=%" PRIu64 " mean_us=%" PRIu64 " p50_us=%" PRIu64 " p99_us=%" PRIu64
+            " max_us=%" PRIu64 " queued=%" PRIu64 " queued_us=%" PRIu64 "\n",
+            class_names[class], ops,
+            ops ? total_ns / ops / 1000 : 0,
+            ops ? percentile_us(hist, ops, 0.5) : 0,
+            ops ? percentile_us(hist, ops, 0.99) : 0,
+            __atomic_load_n(&c->max_ns, __ATOMIC_RELAXED) / 1000,
+            __atomic_load_n(&c->queued, __ATOMIC_RELAXED),
+            __atomic_load_n(&c->queued_ns, __ATOMIC_RELAXED) / 1000);
+        len += n < 0 ? 0 : n;
+    }
+
+    int i;
+    for (i=0; i<=CLIENT_MAX && client_key && len<size; i++) {
+        prio_client_t *c = &clients[i];
+        uint64_t key = __atomic_load_n(&c->key, __ATOMIC_ACQUIRE);
+        if (key == KEY_RECLAIMING || (key == 0 && (i < CLIENT_MAX || c->first_ns == 0))) {
+            continue;
+        }
+        uint64_t bytes = __atomic_load_n(&c->bytes, __ATOMIC_RELAXED);
+        uint64_t first = __atomic_load_n(&c->first_ns, __ATOMIC_RELAXED);
+        uint64_t last = __atomic_load_n(&c->last_ns, __ATOMIC_RELAXED);
+        double seconds = last > first ? (last - first) / 1e9 : 0;
+        char id[16];
+        if (i < CLIENT_MAX) {
+            snprintf(id, sizeof(id), "%" PRIu64, key - 1);
+        } else {
+            strcpy(id, "other");
+        }
+        int n = snprintf(buf + len, size - len,
+            "client %s=%s weight=%u reads=%" PRIu64 " bytes=%" PRIu64 " queued_us=%" PRIu64
+            " seconds=%.3f mb_per_sec=%.1f\n",
+            client_key, id, c->weight,
+            __atomic_load_n(&c->reads, __ATOMIC_RELAXED), bytes,
+            __atomic_load_n(&c->queued_ns, __ATOMIC_RELAXED) / 1000,
+            seconds, seconds > 0 ? bytes / seconds / 1e6 : 0.0);
+        len += n < 0 ? 0 : n;
+    }
+    return len < size ? len : size;
+}
@@ -0,0 +1,107 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Request classes.  A few streams reading a megabyte at a time can keep
+ * every CPU busy, and without care a stat() or a 4K read arriving
+ * behind them waits its turn with the rest.  So requests are classed
+ * as metadata, small reads or bulk reads: the first two are served as
+ * soon as they arrive, while bulk reads queue, first come first served,
+ * for a bounded number of slots, shared fairly between the clients
+ * (processes or users) asking.  The latency of each class, including
+ * any time queued, is kept as a histogram, and each client's throughput
+ * and time queued are counted.
+ */
+
+#ifndef PRIO_H
+#define PRIO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// reads of at least this many bytes are bulk reads, unless configured
+#define PRIO_BULK_SIZE (128*1024)
+
+typedef enum prio_class_e {
+    PRIO_META,          // getattr, open, readdir, xattrs
+    PRIO_SMALL,         // reads below the bulk size
+    PRIO_BULK,          // reads of at least the bulk size
+    PRIO_CLASSES
+} prio_class_t;
+
+typedef struct prio_client_s prio_client_t;
+
+/*
+ * A request in progress, from prio_begin() to prio_end().
+ */
+typedef struct prio_ticket_s {
+    prio_class_t class;
+    prio_client_t *client;
+    struct timespec start;
+} prio_ticket_t;
+
+/*
+ * Set the bulk read size (or 0 for PRIO_BULK_SIZE) and how many bulk
+ * reads may be served at once (at least one).  Call before any
+ * requests are served.
+ */
+void prio_config(size_t bulk_size, int bulk_slots);
+
+/*
+ * Name what client IDs are ("pid" or "uid"), which turns on the
+ * per-client stats, and give clients weights in a list like
+ * "1000:4,1001:2" (others have weight 1, and each gets a share of the
+ * bulk slots in proportion).  Returns 0, or -1 if the list is invalid.
+ */
+int prio_fair(const char *key, const char *weights);
+
+/*
+ * The client with the given ID, for one request: it must be passed to
+ * prio_begin(), and is let go of by prio_end().  Clients which have had
+ * no requests for a minute may be forgotten, to make room for others.
+ */
+prio_client_t *prio_client(uint32_t id);
+
+/*
+ * The class of a read of size bytes.
+ */
+prio_class_t prio_read_class(size_t size);
+
+/*
+ * Start timing a client's request (the client may be NULL), first
+ * waiting for a slot if it's a bulk read of size bytes.
+ */
+void prio_begin(prio_class_t class, prio_client_t *client, size_t size, prio_ticket_t *ticket);
+
+/*
+ * Finish the request, which read the given number of bytes, freeing its
+ * slot and recording its latency.
+ */
+void prio_end(prio_ticket_t *ticket, size_t bytes);
+
+/*
+ * Describe each class's latency, and then each client's throughput, a
+ * line each, into buf.  Returns the length of the text (which is
+ * truncated if it doesn't fit).
+ */
+size_t prio_stats(char *buf, size_t size);
+
+#endif
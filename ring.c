@@ -0,0 +1,486 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <linux/futex.h>
+
+#include "gen.h"
+#include "ring.h"
+#include "node.h"
+
+// waits are bounded, so that a ring whose other end has gone away is
+// noticed even if no wake-up comes
+#define WAIT_NS 100000000
+
+typedef struct ring_server_s {
+    int lfd;
+    ring_lookup_t lookup;
+    void *arg;
+    int max_threads;
+} ring_server_t;
+
+/*
+ * The daemon's side of one ring.  The client can write anywhere in the
+ * shared header, so the producers keep the geometry and head to
+ * themselves, only ever storing to the header, and take nothing from
+ * it but tail.
+ */
+typedef struct ring_s {
+    int fd;
+    ring_header_t *header;
+    size_t map_len;
+    char *data;
+    gen_stream_t stream;
+    uint64_t offset;
+    uint64_t length;
+    uint32_t slot_size;
+    uint32_t slots;
+    uint32_t chunks;
+    uint32_t head;          // chunks published
+    uint32_t next_chunk;
+    int cancelled;
+} ring_t;
+
+struct ring_client_s {
+    int fd;
+    ring_header_t *header;
+    size_t map_len;
+    char *data;
+    uint64_t length;        // the geometry, as first published
+    uint32_t slot_size;
+    uint32_t slots;
+    uint32_t chunks;
+    uint32_t chunk;         // the next chunk to return
+    int held;               // whether the previous chunk is still ours
+};
+
+// a slot usually turns over in microseconds, so spin for a while before
+// sleeping on the futex -- unless there's only one CPU, where spinning
+// just keeps the other side from running
+#define SPIN_LIMIT 4096
+static int spin_limit = -1;
+
+static void futex_wait(uint32_t *word, uint32_t value) {
+    struct timespec timeout = { 0, WAIT_NS };
+    int spin;
+    if (spin_limit < 0) {
+        spin_limit = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SPIN_LIMIT : 0;
+    }
+    for (spin=0; spin<spin_limit; spin++) {
+        if (__atomic_load_n(word, __ATOMIC_ACQUIRE) != value) {
+            return;
+        }
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+    syscall(SYS_futex, word, FUTEX_WAIT, value, &timeout, NULL, 0);
+}
+
+static void futex_wake(uint32_t *word) {
+    syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/*
+ * Claim chunks in turn, wait for each one's slot to be handed back,
+ * generate into it, and publish it once every chunk before it is out.
+ */
+static void *producer_thread(void *arg) {
+    ring_t *ring = arg;
+    ring_header_t *h = ring->header;
+    for (;;) {
+        uint32_t chunk = __atomic_fetch_add(&ring->next_chunk, 1, __ATOMIC_RELAXED);
+        if (chunk >= ring->chunks) {
+            break;
+        }
+        for (;;) {
+            // the client can't have handed back chunks it hasn't been given
+            uint32_t seen = __atomic_load_n(&h->tail, __ATOMIC_ACQUIRE);
+            uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+            uint32_t tail = (int32_t)(seen - head) > 0 ? head : seen;
+            if (chunk - tail < ring->slots) {
+                break;
+            }
+            if (__atomic_load_n(&ring->cancelled, __ATOMIC_RELAXED)) {
+                return NULL;
+            }
+            futex_wait(&h->tail, seen);
+        }
+        uint64_t pos = (uint64_t)chunk * ring->slot_size;
+        size_t len = ring->length - pos < ring->slot_size ? ring->length - pos : ring->slot_size;
+        char *slot = ring->data + (size_t)(chunk % ring->slots) * ring->slot_size;
+        gen_stream_range(&ring->stream, slot, len, ring->offset + pos);
+        node_account(slot, len);
+        uint32_t seen;
+        while ((seen = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) != chunk) {
+            if (__atomic_load_n(&ring->cancelled, __ATOMIC_RELAXED)) {
+                return NULL;
+            }
+            futex_wait(&ring->head, seen);
+        }
+        // publish before passing the turn on, so head only ever grows
+        __atomic_store_n(&h->head, chunk + 1, __ATOMIC_RELEASE);
+        futex_wake(&h->head);
+        __atomic_store_n(&ring->head, chunk + 1, __ATOMIC_RELEASE);
+        futex_wake(&ring->head);
+    }
+    return NULL;
+}
+
+static void send_reply(int fd, const ring_reply_t *reply, int memfd) {
+    struct iovec iov = { (void *)reply, sizeof(*reply) };
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (memfd >= 0) {
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cm), &memfd, sizeof(int));
+    }
+    sendmsg(fd, &msg, MSG_NOSIGNAL);
+}
+
+/*
+ * Set up the ring a client asked for and run its producers until the
+ * client hangs up.
+ */
+static void *ring_thread(void *arg) {
+    ring_server_t *server = ((void **)arg)[0];
+    ring_t ring;
+    memset(&ring, 0, sizeof(ring));
+    ring.fd = (int)(intptr_t)((void **)arg)[1];
+    free(arg);
+
+    ring_request_t req;
+    ring_reply_t reply;
+    memset(&reply, 0, sizeof(reply));
+    ssize_t n = recv(ring.fd, &req, sizeof(req), 0);
+    if (n != sizeof(req) || memcmp(req.magic, RING_MAGIC, sizeof(req.magic)) != 0) {
+        close(ring.fd);
+        return NULL;
+    }
+    req.name[RING_NAME_MAX-1] = '\0';
+    if (req.slot_size == 0) {
+        req.slot_size = RING_SLOT_SIZE;
+    }
+    if (req.slots == 0) {
+        req.slots = RING_SLOTS;
+    }
+    if (req.threads == 0 || req.threads > server->max_threads) {
+        req.threads = req.threads ? server->max_threads : RING_THREADS;
+    }
+    if (req.threads > req.slots) {
+        req.threads = req.slots;
+    }
+
+    if (server->lookup(req.name, &reply.size, &ring.stream, server->arg) != 0) {
+        reply.status = -ENOENT;
+    } else if (req.offset > reply.size || req.length > reply.size - req.offset) {
+        reply.status = -EINVAL;
+    } else if (req.slot_size % 4096 || req.slots < 2 ||
+        (uint64_t)req.slot_size * req.slots > RING_MAX) {
+        reply.status = -EINVAL;
+    }
+    reply.seed = ring.stream.seed;
+    reply.format = ring.stream.format;
+    if (req.length == 0 && reply.status == 0) {
+        req.length = reply.size - req.offset;
+    }
+    if (reply.status == 0 && (req.length + req.slot_size - 1) / req.slot_size >= UINT32_MAX) {
+        reply.status = -EFBIG;
+    }
+    int memfd = -1;
+    if (reply.status == 0) {
+        ring.map_len = 4096 + (size_t)req.slot_size * req.slots;
+        memfd = memfd_create("testfuse-ring", MFD_CLOEXEC);
+        if (memfd < 0 || ftruncate(memfd, ring.map_len) != 0 ||
+            (ring.header = mmap(NULL, ring.map_len, PROT_READ | PROT_WRITE, MAP_SHARED,
+                memfd, 0)) == MAP_FAILED) {
+            reply.status = -errno;
+            ring.header = NULL;
+        }
+    }
+    if (reply.status != 0) {
+        send_reply(ring.fd, &reply, -1);
+        if (memfd >= 0) {
+            close(memfd);
+        }
+        close(ring.fd);
+        return NULL;
+    }
+
+    ring.offset = req.offset;
+    ring.length = req.length;
+    ring.slot_size = req.slot_size;
+    ring.slots = req.slots;
+    ring.chunks = (req.length + req.slot_size - 1) / req.slot_size;
+    ring.data = (char *)ring.header + 4096;
+    ring_header_t *h = ring.header;
+    memcpy(h->magic, RING_MAGIC, sizeof(h->magic));
+    h->offset = ring.offset;
+    h->length = ring.length;
+    h->slot_size = ring.slot_size;
+    h->slots = ring.slots;
+    h->chunks = ring.chunks;
+    h->data_offset = 4096;
+    send_reply(ring.fd, &reply, memfd);
+    close(memfd);
+
+    pthread_t tids[req.threads];
+    uint32_t started;
+    for (started=0; started<req.threads; started++) {
+        if (pthread_create(&tids[started], NULL, producer_thread, &ring) != 0) {
+            break;
+        }
+    }
+
+    // the client hangs up when it's done with the ring, or dies
+    char byte;
+    ssize_t got;
+    while ((got = recv(ring.fd, &byte, 1, 0)) > 0 || (got < 0 && errno == EINTR)) {
+    }
+    __atomic_store_n(&ring.cancelled, 1, __ATOMIC_RELAXED);
+    futex_wake(&ring.head);
+    futex_wake(&h->tail);
+    uint32_t i;
+    for (i=0; i<started; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    munmap(ring.header, ring.map_len);
+    close(ring.fd);
+    return NULL;
+}
+
+static void *accept_thread(void *arg) {
+    ring_server_t *server = arg;
+    for (;;) {
+        int fd = accept4(server->lfd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            perror("testfuse: ring accept");
+            return NULL;
+        }
+        void **args = malloc(2 * sizeof(void *));
+        pthread_t tid;
+        if (args == NULL) {
+            close(fd);
+            continue;
+        }
+        args[0] = server;
+        args[1] = (void *)(intptr_t)fd;
+        if (pthread_create(&tid, NULL, ring_thread, args) != 0) {
+            close(fd);
+            free(args);
+            continue;
+        }
+        pthread_detach(tid);
+    }
+}
+
+int ring_serve(const char *path, ring_lookup_t lookup, void *arg, int max_threads) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "error: ring socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    ring_server_t *server = malloc(sizeof(ring_server_t));
+    if (server == NULL) {
+        fprintf(stderr, "error: out of memory\n");
+        return -1;
+    }
+    server->lookup = lookup;
+    server->arg = arg;
+    server->max_threads = max_threads < 1 ? 1 : max_threads;
+    server->lfd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    unlink(path);
+    if (server->lfd < 0 || bind(server->lfd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(server->lfd, 64) != 0) {
+        fprintf(stderr, "error: can't listen on %s: %s\n", path, strerror(errno));
+        if (server->lfd >= 0) {
+            close(server->lfd);
+        }
+        free(server);
+        return -1;
+    }
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, accept_thread, server) != 0) {
+        fprintf(stderr, "error: can't start the ring thread\n");
+        close(server->lfd);
+        free(server);
+        return -1;
+    }
+    pthread_detach(tid);
+    return 0;
+}
+
+ring_client_t *ring_open(const char *path, const char *name, uint64_t offset, uint64_t length,
+    uint32_t slot_size, uint32_t slots, uint32_t threads, ring_reply_t *reply_out) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    ring_request_t req;
+    memset(&req, 0, sizeof(req));
+    if (strlen(path) >= sizeof(addr.sun_path) || strlen(name) >= RING_NAME_MAX) {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    strcpy(addr.sun_path, path);
+    memcpy(req.magic, RING_MAGIC, sizeof(req.magic));
+    req.offset = offset;
+    req.length = length;
+    req.slot_size = slot_size;
+    req.slots = slots;
+    req.threads = threads;
+    strcpy(req.name, name);
+
+    ring_client_t *ring = calloc(1, sizeof(ring_client_t));
+    if (ring == NULL) {
+        return NULL;
+    }
+    ring->fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (ring->fd < 0 || connect(ring->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        send(ring->fd, &req, sizeof(req), MSG_NOSIGNAL) != sizeof(req)) {
+        goto fail;
+    }
+
+    ring_reply_t reply;
+    struct iovec iov = { &reply, sizeof(reply) };
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    if (recvmsg(ring->fd, &msg, MSG_CMSG_CLOEXEC) != sizeof(reply)) {
+        errno = errno ? errno : EPROTO;
+        goto fail;
+    }
+    if (reply.status != 0) {
+        errno = -reply.status;
+        goto fail;
+    }
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+    int memfd;
+    if (cm == NULL || cm->cmsg_type != SCM_RIGHTS) {
+        errno = EPROTO;
+        goto fail;
+    }
+    memcpy(&memfd, CMSG_DATA(cm), sizeof(int));
+
+    // map the header to find the size, then the whole ring, writable
+    // since we hand slots back by advancing tail
+    ring_header_t *h = mmap(NULL, sizeof(ring_header_t), PROT_READ, MAP_SHARED, memfd, 0);
+    size_t data_offset = 0;
+    if (h != MAP_FAILED) {
+        ring->length = h->length;
+        ring->slot_size = h->slot_size;
+        ring->slots = h->slots;
+        ring->chunks = h->chunks;
+        data_offset = h->data_offset;
+        ring->map_len = data_offset + (size_t)h->slot_size * h->slots;
+        munmap(h, sizeof(ring_header_t));
+        ring->header = mmap(NULL, ring->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    }
+    close(memfd);
+    if (h == MAP_FAILED || ring->header == MAP_FAILED) {
+        ring->header = NULL;
+        goto fail;
+    }
+    ring->data = (char *)ring->header + data_offset;
+    if (reply_out) {
+        *reply_out = reply;
+    }
+    return ring;
+
+fail:
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+    free(ring);
+    return NULL;
+}
+
+const void *ring_next(ring_client_t *ring, size_t *len) {
+    ring_header_t *h = ring->header;
+    if (ring->held) {
+        __atomic_store_n(&h->tail, ring->chunk, __ATOMIC_RELEASE);
+        futex_wake(&h->tail);
+        ring->held = 0;
+    }
+    *len = 0;
+    if (ring->chunk == ring->chunks) {
+        return NULL;
+    }
+    uint32_t seen;
+    while ((seen = __atomic_load_n(&h->head, __ATOMIC_ACQUIRE)) <= ring->chunk) {
+        // the daemon only hangs up if it's going away
+        struct pollfd pfd = { ring->fd, POLLIN, 0 };
+        if (poll(&pfd, 1, 0) > 0) {
+            errno = EPIPE;
+            return NULL;
+        }
+        futex_wait(&h->head, seen);
+    }
+    uint64_t pos = (uint64_t)ring->chunk * ring->slot_size;
+    *len = ring->length - pos < ring->slot_size ? ring->length - pos : ring->slot_size;
+    const void *data = ring->data + (size_t)(ring->chunk % ring->slots) * ring->slot_size;
+    ring->chunk++;
+    ring->held = 1;
+    return data;
+}
+
+void ring_close(ring_client_t *ring) {
+    if (ring) {
+        munmap(ring->header, ring->map_len);
+        close(ring->fd);
+        free(ring);
+    }
+}
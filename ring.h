@@ -0,0 +1,133 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Shared-memory rings, the fastest way to deliver test file content to
+ * a local consumer: the client asks testfuse for a range of a file over
+ * a unix socket and gets back a memfd, which the daemon's generator
+ * threads fill with the range a slot at a time, in order.  The client
+ * reads each slot in place and hands it back, so the data is never
+ * copied, and the daemon waits for free slots, so a slow client is
+ * never overrun.
+ *
+ *     ring_client_t *ring = ring_open("/run/testfuse.ring", "testfile_1G",
+ *         0, 0, 0, 0, 0, NULL);
+ *     while ((data = ring_next(ring, &len)) != NULL) {
+ *         ...
+ *     }
+ *     ring_close(ring);
+ */
+
+#ifndef RING_H
+#define RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gen.h"
+
+#define RING_MAGIC "TFRING01"
+#define RING_NAME_MAX 256
+
+#define RING_SLOT_SIZE (1024*1024)
+#define RING_SLOTS 16
+#define RING_THREADS 4
+// the largest ring (all its slots together) a client may ask for
+#define RING_MAX (1024*1024*1024)
+
+/*
+ * The start of the shared memory.  The range is split into chunks of
+ * slot_size bytes (the last may be shorter), and chunk k is put in slot
+ * k % slots.  head and tail are also futex words: the daemon publishes
+ * chunks in order by advancing head, and the client hands back slots by
+ * advancing tail.
+ */
+typedef struct ring_header_s {
+    char magic[8];
+    uint64_t offset;
+    uint64_t length;
+    uint32_t slot_size;
+    uint32_t slots;
+    uint32_t chunks;
+    uint32_t data_offset;   // of slot 0, from the start of the mapping
+
+    uint32_t head __attribute__((aligned(64)));     // chunks published
+    uint32_t tail __attribute__((aligned(64)));     // chunks handed back
+} ring_header_t;
+
+/*
+ * The client's request, as one SOCK_SEQPACKET message.  A length of 0
+ * means to the end of the file, and other zero fields the defaults.
+ */
+typedef struct ring_request_s {
+    char magic[8];
+    uint64_t offset;
+    uint64_t length;
+    uint32_t slot_size;
+    uint32_t slots;
+    uint32_t threads;
+    char name[RING_NAME_MAX];
+} ring_request_t;
+
+/*
+ * The daemon's reply, which carries the memfd if status is 0.
+ */
+typedef struct ring_reply_s {
+    int32_t status;         // 0, or a negative errno
+    uint32_t seed;
+    uint64_t size;          // of the whole file
+    uint32_t format;        // of the content, GEN_FORMAT_XORSHIFT unless a plugin's
+    uint32_t reserved;
+} ring_reply_t;
+
+/*
+ * Find a file by name for the server.  Returns 0 and sets *size and
+ * *stream, or -1 if there's no such file.
+ */
+typedef int (*ring_lookup_t)(const char *name, uint64_t *size, gen_stream_t *stream, void *arg);
+
+/*
+ * Listen on a unix socket at path (replacing any stale one) and serve
+ * rings from a background thread, with up to max_threads generator
+ * threads per ring.  Returns 0, or -1 after reporting the error.
+ */
+int ring_serve(const char *path, ring_lookup_t lookup, void *arg, int max_threads);
+
+typedef struct ring_client_s ring_client_t;
+
+/*
+ * Ask the daemon at path for a ring carrying length bytes (0 for the
+ * rest of the file) of the named file from offset.  Zero slot_size,
+ * slots and threads take the defaults.  If reply isn't NULL it gets the
+ * file's size, seed and format.  Returns NULL, with errno set, on failure.
+ */
+ring_client_t *ring_open(const char *path, const char *name, uint64_t offset, uint64_t length,
+    uint32_t slot_size, uint32_t slots, uint32_t threads, ring_reply_t *reply);
+
+/*
+ * Hand back the previous chunk, if any, and wait for the next.  Returns
+ * the chunk in place, setting *len, or NULL at the end of the range (or
+ * with errno set, if the daemon went away).
+ */
+const void *ring_next(ring_client_t *ring, size_t *len);
+
+void ring_close(ring_client_t *ring);
+
+#endif
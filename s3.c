@@ -0,0 +1,353 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <inttypes.h>
+
+#include "s3.h"
+
+// test files never change, so they were all last modified at the epoch
+#define LAST_MODIFIED "Thu, 01 Jan 1970 00:00:00 GMT"
+#define LAST_MODIFIED_ISO "1970-01-01T00:00:00.000Z"
+
+#define MAX_KEYS 1000
+#define KEY_MAX 1024
+
+#define XML_HEADER "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+#define XML_NS "http://s3.amazonaws.com/doc/2006-03-01/"
+
+/*
+ * A growable buffer for building response bodies.
+ */
+typedef struct strbuf_s {
+    char *buf;
+    size_t len;
+    size_t alloc;
+} strbuf_t;
+
+static void sb_printf(strbuf_t *sb, const char *fmt, ...) {
+    va_list ap;
+    for (;;) {
+        va_start(ap, fmt);
+        int n = vsnprintf(sb->buf + sb->len, sb->alloc - sb->len, fmt, ap);
+        va_end(ap);
+        if (n >= 0 && sb->len + n < sb->alloc) {
+            sb->len += n;
+            return;
+        }
+        size_t alloc = sb->alloc ? sb->alloc * 2 : 4096;
+        while (n >= 0 && alloc <= sb->len + n) {
+            alloc *= 2;
+        }
+        char *buf = realloc(sb->buf, alloc);
+        if (buf == NULL) {
+            fprintf(stderr, "error: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        sb->buf = buf;
+        sb->alloc = alloc;
+    }
+}
+
+/*
+ * Append a key or prefix, escaped for XML, or URL-encoded if the client
+ * asked for encoding-type=url.
+ */
+static void sb_key(strbuf_t *sb, const char *s, int url) {
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (url) {
+            if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+                (c >= '0' && c <= '9') || strchr("-_.~/", c)) {
+                sb_printf(sb, "%c", c);
+            } else {
+                sb_printf(sb, "%%%02X", c);
+            }
+        } else if (c == '&') {
+            sb_printf(sb, "&amp;");
+        } else if (c == '<') {
+            sb_printf(sb, "&lt;");
+        } else if (c == '>') {
+            sb_printf(sb, "&gt;");
+        } else if (c == '"') {
+            sb_printf(sb, "&quot;");
+        } else if (c == '\'') {
+            sb_printf(sb, "&apos;");
+        } else {
+            sb_printf(sb, "%c", c);
+        }
+    }
+}
+
+static void send_xml(http_conn_t *conn, int status, strbuf_t *sb) {
+    http_send(conn, status, "Content-Type: application/xml\r\n", sb->buf, sb->len);
+    free(sb->buf);
+}
+
+static void send_error(http_conn_t *conn, int status, const char *code, const char *resource) {
+    strbuf_t sb = { NULL, 0, 0 };
+    sb_printf(&sb, XML_HEADER "<Error><Code>%s</Code><Message>%s</Message><Resource>",
+        code, code);
+    sb_key(&sb, resource, 0);
+    sb_printf(&sb, "</Resource><RequestId>0</RequestId></Error>\n");
+    send_xml(conn, status, &sb);
+}
+
+/*
+ * Continuation tokens are opaque to clients, so they're simply the hex
+ * of where to resume: 'K' and the last key returned, or 'P' and the
+ * last common prefix returned, all of whose keys are to be skipped.
+ */
+static void make_token(char *token, char kind, const char *key) {
+    char *p = token + sprintf(token, "%02x", kind);
+    for (; *key; key++) {
+        p += sprintf(p, "%02x", (unsigned char)*key);
+    }
+}
+
+static int parse_token(const char *token, char *kind, char *key) {
+    size_t len = strlen(token);
+    if (len < 2 || len % 2 || len / 2 > KEY_MAX) {
+        return -1;
+    }
+    size_t i;
+    for (i=0; i<len/2; i++) {
+        unsigned int c;
+        if (sscanf(token + 2*i, "%2x", &c) != 1) {
+            return -1;
+        }
+        if (i == 0) {
+            *kind = c;
+        } else {
+            key[i-1] = c;
+        }
+    }
+    key[len/2 - 1] = '\0';
+    return *kind == 'K' || *kind == 'P' ? 0 : -1;
+}
+
+/*
+ * Set from to the first name after every name beginning with prefix.
+ */
+static void skip_prefix(char *from, const char *prefix) {
+    size_t len = strlen(prefix);
+    memmove(from, prefix, len + 1);
+    while (len && (unsigned char)from[len-1] == 0xff) {
+        len--;
+    }
+    if (len) {
+        from[len-1]++;
+        from[len] = '\0';
+    } else {
+        // every name; nothing is after that
+        strcpy(from, "\xff\xff\xff\xff");
+    }
+}
+
+static void list_objects(http_conn_t *conn, const http_request_t *req, s3_t *s3) {
+    char prefix[KEY_MAX+1] = "", delimiter[16] = "", start_after[KEY_MAX+1] = "";
+    char token[2*KEY_MAX+8] = "", encoding[16] = "", value[32];
+    int v2 = http_query(req, "list-type", value, sizeof(value)) && strcmp(value, "2") == 0;
+    int max_keys = MAX_KEYS;
+    http_query(req, "prefix", prefix, sizeof(prefix));
+    http_query(req, "delimiter", delimiter, sizeof(delimiter));
+    http_query(req, v2 ? "start-after" : "marker", start_after, sizeof(start_after));
+    http_query(req, "encoding-type", encoding, sizeof(encoding));
+    int url = strcmp(encoding, "url") == 0;
+    if (http_query(req, "max-keys", value, sizeof(value))) {
+        max_keys = atoi(value);
+        if (max_keys < 0 || max_keys > MAX_KEYS) {
+            max_keys = MAX_KEYS;
+        }
+    }
+
+    // work out where to start: after the token, the start key, or at
+    // the prefix, whichever is furthest
+    char from[KEY_MAX+8] = "";
+    int inclusive = 1;
+    if (v2 && http_query(req, "continuation-token", token, sizeof(token))) {
+        char kind;
+        if (parse_token(token, &kind, from) != 0) {
+            send_error(conn, 400, "InvalidArgument", req->path);
+            return;
+        }
+        if (kind == 'P') {
+            skip_prefix(from, from);
+        } else {
+            inclusive = 0;
+        }
+    } else if (*start_after) {
+        strcpy(from, start_after);
+        inclusive = 0;
+    }
+    if (strcmp(from, prefix) < 0) {
+        strcpy(from, prefix);
+        inclusive = 1;
+    }
+
+    strbuf_t sb = { NULL, 0, 0 };
+    strbuf_t entries = { NULL, 0, 0 };
+    sb_printf(&entries, "");
+    char name[KEY_MAX+1], last[KEY_MAX+1] = "";
+    char last_kind = 'K';
+    int count = 0, truncated = 0;
+    size_t prefix_len = strlen(prefix);
+    uint64_t size;
+    uint32_t seed;
+    while (ns_next(s3->ns, from, inclusive, name, sizeof(name), &size, &seed) == 0 &&
+        strncmp(name, prefix, prefix_len) == 0) {
+        if (count == max_keys) {
+            truncated = 1;
+            break;
+        }
+        char *delim = *delimiter ? strstr(name + prefix_len, delimiter) : NULL;
+        if (delim) {
+            // roll up everything under this common prefix
+            delim[strlen(delimiter)] = '\0';
+            sb_printf(&entries, "<CommonPrefixes><Prefix>");
+            sb_key(&entries, name, url);
+            sb_printf(&entries, "</Prefix></CommonPrefixes>");
+            skip_prefix(from, name);
+            inclusive = 1;
+            last_kind = 'P';
+        } else {
+            char etag[HTTP_ETAG_MAX];
+            http_etag(etag, size, seed);
+            sb_printf(&entries, "<Contents><Key>");
+            sb_key(&entries, name, url);
+            sb_printf(&entries, "</Key><LastModified>" LAST_MODIFIED_ISO "</LastModified>"
+                "<ETag>&quot;%.*s&quot;</ETag><Size>%" PRIu64 "</Size>"
+                "<StorageClass>STANDARD</StorageClass></Contents>",
+                (int)strlen(etag) - 2, etag + 1, size);
+            strcpy(from, name);
+            inclusive = 0;
+            last_kind = 'K';
+        }
+        strcpy(last, name);
+        count++;
+    }
+
+    sb_printf(&sb, XML_HEADER "<ListBucketResult xmlns=\"" XML_NS "\"><Name>%s</Name><Prefix>",
+        s3->bucket);
+    sb_key(&sb, prefix, url);
+    sb_printf(&sb, "</Prefix>");
+    if (*delimiter) {
+        sb_printf(&sb, "<Delimiter>");
+        sb_key(&sb, delimiter, url);
+        sb_printf(&sb, "</Delimiter>");
+    }
+    if (url) {
+        sb_printf(&sb, "<EncodingType>url</EncodingType>");
+    }
+    sb_printf(&sb, "<MaxKeys>%d</MaxKeys><IsTruncated>%s</IsTruncated>",
+        max_keys, truncated ? "true" : "false");
+    if (v2) {
+        sb_printf(&sb, "<KeyCount>%d</KeyCount>", count);
+        if (*token) {
+            sb_printf(&sb, "<ContinuationToken>%s</ContinuationToken>", token);
+        }
+        if (*start_after) {
+            sb_printf(&sb, "<StartAfter>");
+            sb_key(&sb, start_after, url);
+            sb_printf(&sb, "</StartAfter>");
+        }
+        if (truncated) {
+            char next[2*KEY_MAX+8];
+            make_token(next, last_kind, last);
+            sb_printf(&sb, "<NextContinuationToken>%s</NextContinuationToken>", next);
+        }
+    } else {
+        sb_printf(&sb, "<Marker>");
+        sb_key(&sb, start_after, url);
+        sb_printf(&sb, "</Marker>");
+        if (truncated) {
+            sb_printf(&sb, "<NextMarker>");
+            sb_key(&sb, last, url);
+            sb_printf(&sb, "</NextMarker>");
+        }
+    }
+    sb_printf(&sb, "%s</ListBucketResult>\n", entries.buf);
+    free(entries.buf);
+    send_xml(conn, 200, &sb);
+}
+
+void s3_handle(http_conn_t *conn, const http_request_t *req, void *arg) {
+    s3_t *s3 = arg;
+    const char *path = req->path;
+    char value[8];
+
+    // virtual-hosted style requests name the bucket in the host
+    const char *host = http_header(req, "Host");
+    size_t bucket_len = strlen(s3->bucket);
+    int virtual_host = host && strncmp(host, s3->bucket, bucket_len) == 0 &&
+        host[bucket_len] == '.';
+
+    if (strcmp(req->method, "GET") != 0 && !req->head) {
+        send_error(conn, 405, "MethodNotAllowed", path);
+        return;
+    }
+    if (!virtual_host && strcmp(path, "/") == 0) {
+        strbuf_t sb = { NULL, 0, 0 };
+        sb_printf(&sb, XML_HEADER "<ListAllMyBucketsResult xmlns=\"" XML_NS "\">"
+            "<Owner><ID>testfuse</ID><DisplayName>testfuse</DisplayName></Owner>"
+            "<Buckets><Bucket><Name>%s</Name><CreationDate>" LAST_MODIFIED_ISO "</CreationDate>"
+            "</Bucket></Buckets></ListAllMyBucketsResult>\n", s3->bucket);
+        send_xml(conn, 200, &sb);
+        return;
+    }
+
+    // split /bucket/key
+    const char *key;
+    if (virtual_host) {
+        key = path + 1;
+    } else {
+        if (strncmp(path + 1, s3->bucket, bucket_len) != 0 ||
+            (path[bucket_len+1] != '/' && path[bucket_len+1] != '\0')) {
+            send_error(conn, 404, "NoSuchBucket", path);
+            return;
+        }
+        key = path[bucket_len+1] ? path + bucket_len + 2 : "";
+    }
+
+    if (*key == '\0') {
+        if (req->head) {
+            http_send(conn, 200, "x-amz-bucket-region: us-east-1\r\n", "", 0);
+        } else if (http_query(req, "location", value, sizeof(value))) {
+            strbuf_t sb = { NULL, 0, 0 };
+            sb_printf(&sb, XML_HEADER "<LocationConstraint xmlns=\"" XML_NS "\"/>\n");
+            send_xml(conn, 200, &sb);
+        } else {
+            list_objects(conn, req, s3);
+        }
+        return;
+    }
+
+    uint64_t size;
+    uint32_t seed;
+    if (ns_lookup(s3->ns, key, &size, &seed) != 0) {
+        send_error(conn, 404, "NoSuchKey", path);
+        return;
+    }
+    http_send_file(conn, req, size, seed, "Last-Modified: " LAST_MODIFIED "\r\n");
+}
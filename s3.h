@@ -0,0 +1,44 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * A minimal S3-compatible API over a namespace of test files, as a
+ * local stand-in endpoint for object store client benchmarks.
+ */
+
+#ifndef S3_H
+#define S3_H
+
+#include "httpd.h"
+#include "ns.h"
+
+typedef struct s3_s {
+    const char *bucket;
+    ns_t *ns;
+} s3_t;
+
+/*
+ * Answer an S3 request: ListObjectsV2 (and V1), HeadBucket,
+ * GetBucketLocation and ListBuckets on the bucket, and GetObject (with
+ * Range) and HeadObject on its objects.  arg is the s3_t.
+ */
+void s3_handle(http_conn_t *conn, const http_request_t *req, void *arg);
+
+#endif
@@ -0,0 +1,209 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <pthread.h>
+#include <string.h>
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#include "sha1.h"
+
+#define ROL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+static void sha1_compress_one(uint32_t h[5], const uint8_t *p) {
+    uint32_t w[80];
+    int i;
+    for (i=0; i<16; i++) {
+        w[i] = ((uint32_t)p[4*i] << 24) | ((uint32_t)p[4*i+1] << 16) |
+               ((uint32_t)p[4*i+2] << 8) | p[4*i+3];
+    }
+    for (i=16; i<80; i++) {
+        w[i] = ROL(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+    }
+
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for (i=0; i<80; i++) {
+        uint32_t f, k;
+        if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5A827999;
+        } else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ED9EBA1;
+        } else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8F1BBCDC;
+        } else {
+            f = b ^ c ^ d;
+            k = 0xCA62C1D6;
+        }
+        uint32_t t = ROL(a, 5) + f + e + k + w[i];
+        e = d; d = c; c = ROL(b, 30); b = a; a = t;
+    }
+    h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+}
+
+static void sha1_compress_sw(uint32_t h[5], const uint8_t *p, size_t nblocks) {
+    while (nblocks--) {
+        sha1_compress_one(h, p);
+        p += SHA1_BLOCK_SIZE;
+    }
+}
+
+#if defined(__x86_64__)
+/*
+ * Four rounds using the SHA extensions, while also advancing the
+ * message schedule for later rounds.  k is the group of four rounds,
+ * and m0..m3 are the message registers rotated so that m0 holds this
+ * group's words.  The constant k tests fold away.
+ */
+#define SHANI_ROUNDS4(k, ea, eb, m0, m1, m2, m3) do { \
+    ea = _mm_sha1nexte_epu32(ea, m0); \
+    eb = abcd; \
+    if (k >= 3 && k <= 18) m1 = _mm_sha1msg2_epu32(m1, m0); \
+    abcd = _mm_sha1rnds4_epu32(abcd, ea, (k) / 5); \
+    if (k >= 1 && k <= 16) m3 = _mm_sha1msg1_epu32(m3, m0); \
+    if (k >= 2 && k <= 17) m2 = _mm_xor_si128(m2, m0); \
+} while (0)
+
+__attribute__((target("sha,sse4.1")))
+static void sha1_compress_shani(uint32_t h[5], const uint8_t *p, size_t nblocks) {
+    const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+    __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)h), 0x1B);
+    __m128i e0 = _mm_set_epi32(h[4], 0, 0, 0);
+    __m128i e1, msg0, msg1, msg2, msg3;
+
+    while (nblocks--) {
+        __m128i abcd_save = abcd;
+        __m128i e0_save = e0;
+
+        msg0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 0)), mask);
+        e0 = _mm_add_epi32(e0, msg0);
+        e1 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+        msg1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 16)), mask);
+        SHANI_ROUNDS4(1, e1, e0, msg1, msg2, msg3, msg0);
+        msg2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 32)), mask);
+        SHANI_ROUNDS4(2, e0, e1, msg2, msg3, msg0, msg1);
+        msg3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 48)), mask);
+        SHANI_ROUNDS4(3, e1, e0, msg3, msg0, msg1, msg2);
+        SHANI_ROUNDS4(4, e0, e1, msg0, msg1, msg2, msg3);
+        SHANI_ROUNDS4(5, e1, e0, msg1, msg2, msg3, msg0);
+        SHANI_ROUNDS4(6, e0, e1, msg2, msg3, msg0, msg1);
+        SHANI_ROUNDS4(7, e1, e0, msg3, msg0, msg1, msg2);
+        SHANI_ROUNDS4(8, e0, e1, msg0, msg1, msg2, msg3);
+        SHANI_ROUNDS4(9, e1, e0, msg1, msg2, msg3, msg0);
+        SHANI_ROUNDS4(10, e0, e1, msg2, msg3, msg0, msg1);
+        SHANI_ROUNDS4(11, e1, e0, msg3, msg0, msg1, msg2);
+        SHANI_ROUNDS4(12, e0, e1, msg0, msg1, msg2, msg3);
+        SHANI_ROUNDS4(13, e1, e0, msg1, msg2, msg3, msg0);
+        SHANI_ROUNDS4(14, e0, e1, msg2, msg3, msg0, msg1);
+        SHANI_ROUNDS4(15, e1, e0, msg3, msg0, msg1, msg2);
+        SHANI_ROUNDS4(16, e0, e1, msg0, msg1, msg2, msg3);
+        SHANI_ROUNDS4(17, e1, e0, msg1, msg2, msg3, msg0);
+        SHANI_ROUNDS4(18, e0, e1, msg2, msg3, msg0, msg1);
+        SHANI_ROUNDS4(19, e1, e0, msg3, msg0, msg1, msg2);
+
+        e0 = _mm_sha1nexte_epu32(e0, e0_save);
+        abcd = _mm_add_epi32(abcd, abcd_save);
+        p += SHA1_BLOCK_SIZE;
+    }
+
+    _mm_storeu_si128((__m128i *)h, _mm_shuffle_epi32(abcd, 0x1B));
+    h[4] = _mm_extract_epi32(e0, 3);
+}
+#endif
+
+/*
+ * Use the SHA extensions when the CPU has them.
+ */
+static void (*sha1_compress)(uint32_t h[5], const uint8_t *p, size_t nblocks) = sha1_compress_sw;
+static pthread_once_t sha1_once = PTHREAD_ONCE_INIT;
+
+static void sha1_setup(void) {
+#if defined(__x86_64__)
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & bit_SHA) &&
+        __builtin_cpu_supports("sse4.1")) {
+        sha1_compress = sha1_compress_shani;
+    }
+#endif
+}
+
+void sha1_init(sha1_ctx_t *ctx) {
+    pthread_once(&sha1_once, sha1_setup);
+    ctx->h[0] = 0x67452301;
+    ctx->h[1] = 0xEFCDAB89;
+    ctx->h[2] = 0x98BADCFE;
+    ctx->h[3] = 0x10325476;
+    ctx->h[4] = 0xC3D2E1F0;
+    ctx->length = 0;
+    ctx->buf_len = 0;
+}
+
+void sha1_update(sha1_ctx_t *ctx, const void *data, size_t len) {
+    const uint8_t *p = data;
+    ctx->length += len;
+    if (ctx->buf_len) {
+        size_t n = SHA1_BLOCK_SIZE - ctx->buf_len;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(ctx->buf + ctx->buf_len, p, n);
+        ctx->buf_len += n;
+        p += n;
+        len -= n;
+        if (ctx->buf_len < SHA1_BLOCK_SIZE) {
+            return;
+        }
+        sha1_compress(ctx->h, ctx->buf, 1);
+        ctx->buf_len = 0;
+    }
+    if (len >= SHA1_BLOCK_SIZE) {
+        size_t nblocks = len / SHA1_BLOCK_SIZE;
+        sha1_compress(ctx->h, p, nblocks);
+        p += nblocks * SHA1_BLOCK_SIZE;
+        len -= nblocks * SHA1_BLOCK_SIZE;
+    }
+    memcpy(ctx->buf, p, len);
+    ctx->buf_len = len;
+}
+
+void sha1_final(sha1_ctx_t *ctx, uint8_t digest[SHA1_DIGEST_SIZE]) {
+    uint64_t bits = ctx->length * 8;
+    uint8_t pad[SHA1_BLOCK_SIZE + 8];
+    size_t pad_len = (ctx->buf_len < 56) ? (56 - ctx->buf_len) : (120 - ctx->buf_len);
+    int i;
+
+    memset(pad, 0, sizeof(pad));
+    pad[0] = 0x80;
+    for (i=0; i<8; i++) {
+        pad[pad_len + i] = bits >> (56 - 8*i);
+    }
+    sha1_update(ctx, pad, pad_len + 8);
+    for (i=0; i<5; i++) {
+        digest[4*i] = ctx->h[i] >> 24;
+        digest[4*i+1] = ctx->h[i] >> 16;
+        digest[4*i+2] = ctx->h[i] >> 8;
+        digest[4*i+3] = ctx->h[i];
+    }
+}
@@ -0,0 +1,136 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "spec.h"
+
+uint64_t parse_size(const char *str, char **endptr) {
+    errno = 0;
+    uint64_t size = strtoull(str, endptr, 0);
+    int shift = 0;
+    if (**endptr == 'k' || **endptr == 'K') {
+        shift = 10;
+    } else if (**endptr == 'm' || **endptr == 'M') {
+        shift = 20;
+    } else if (**endptr == 'g' || **endptr == 'G') {
+        shift = 30;
+    } else if (**endptr == 't' || **endptr == 'T') {
+        shift = 40;
+    }
+    if (errno == ERANGE || size > UINT64_MAX >> shift) {
+        // too big: leave *endptr at the start so that callers reject it
+        *endptr = (char *)str;
+        return 0;
+    }
+    if (shift) {
+        (*endptr)++;
+    }
+    return size << shift;
+}
+
+int parse_seed(const char *str, uint32_t *seed) {
+    char *endptr;
+    *seed = strtoll(str, &endptr, 0);
+    if (*seed == 0 || *endptr != '\0') {
+        return -1;
+    }
+    return 0;
+}
+
+static spec_t *parse_list(char *list, int generators) {
+    spec_t *head = NULL;
+    spec_t **tail = &head;
+    char *save_files;
+    char *save_fields;
+    char *file = strtok_r(list, "/", &save_files);
+    while (file != NULL) {
+        char *name = strtok_r(file, ",", &save_fields);
+        char *size_str = strtok_r(NULL, ",", &save_fields);
+        char *seed_str = strtok_r(NULL, ",", &save_fields);
+        char *generator = strtok_r(NULL, ",", &save_fields);
+
+        if ((! name) || (!size_str) || (!seed_str)) {
+            fprintf(stderr, "error: invalid file specification\n");
+            return NULL;
+        }
+
+        // parse name
+        if (*name == '\0') {
+            fprintf(stderr, "error: invalid name\n");
+            return NULL;
+        }
+
+        // parse size
+        char *endptr;
+        uint64_t size = parse_size(size_str, &endptr);
+        if (size == 0) {
+            fprintf(stderr, "error: invalid size\n");
+            return NULL;
+        }
+
+        // parse seed
+        uint32_t seed;
+        if (parse_seed(seed_str, &seed) != 0) {
+            fprintf(stderr, "error: invalid seed\n");
+            return NULL;
+        }
+
+        // the generator is looked up by the caller
+        if (generator && !generators) {
+            fprintf(stderr, "error: generator plugins are only supported by testfuse\n");
+            return NULL;
+        }
+        if (generator && strtok_r(NULL, ",", &save_fields)) {
+            fprintf(stderr, "error: invalid file specification\n");
+            return NULL;
+        }
+
+        spec_t *spec = malloc(sizeof(spec_t));
+        if (spec == NULL) {
+            fprintf(stderr, "error: out of memory\n");
+            return NULL;
+        }
+        spec->name = name;
+        spec->size = size;
+        spec->seed = seed;
+        spec->generator = generator;
+        spec->next = NULL;
+        *tail = spec;
+        tail = &spec->next;
+
+        file = strtok_r(NULL, "/", &save_files);
+    }
+    if (head == NULL) {
+        fprintf(stderr, "error: no test files specified\n");
+    }
+    return head;
+}
+
+spec_t *parse_spec_list(char *list) {
+    return parse_list(list, 0);
+}
+
+spec_t *parse_spec_list_generators(char *list) {
+    return parse_list(list, 1);
+}
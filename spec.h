@@ -0,0 +1,69 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Parsing of test file specifications, shared by testfuse and the
+ * standalone tools.
+ */
+
+#ifndef SPEC_H
+#define SPEC_H
+
+#include <stdint.h>
+
+/*
+ * One <name,size,seed[,generator]> tuple of a file-spec-list.
+ */
+typedef struct spec_s {
+    char *name;
+    uint64_t size;
+    uint32_t seed;
+    char *generator;        // a plugin's "<name>[:<params>]", or NULL
+    struct spec_s *next;
+} spec_t;
+
+/*
+ * Parse a byte count with an optional k/M/G/T suffix, leaving *endptr
+ * just past it.  A count too large for 64 bits gives 0, with *endptr
+ * left at the start of str.
+ */
+uint64_t parse_size(const char *str, char **endptr);
+
+/*
+ * Parse a nonzero 32-bit seed.  Returns 0 on success or -1 if the
+ * string isn't a valid seed.
+ */
+int parse_seed(const char *str, uint32_t *seed);
+
+/*
+ * Parse a slash-delimited file-spec-list, modifying it in place.
+ * Returns the specifications in the order given, or NULL after
+ * reporting the problem on stderr.  Only the built-in generator is
+ * accepted.
+ */
+spec_t *parse_spec_list(char *list);
+
+/*
+ * parse_spec_list(), also accepting generator plugins (see
+ * generator.h).
+ */
+spec_t *parse_spec_list_generators(char *list);
+
+#endif
@@ -0,0 +1,174 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * A character device streaming a test file's content endlessly, as a
+ * fast and reproducible stand-in for /dev/urandom in pipelines:
+ *
+ *     $ sudo ./testfuse-cuse 0x01 -o devname=testrand0
+ *     $ head -c 1M /dev/testrand0 | sha1sum
+ *     1625df500068aa8b85370ba8d488fd4233d59ec1  -
+ *
+ * Usage:
+ *     ./testfuse-cuse <seed> [-o devname=NAME] [-f] [-d]
+ *
+ * Every open of the device starts at the beginning of the stream for
+ * the seed, and reads carry on from wherever the last read on that open
+ * file left off.  The stream repeats after 256TB.  The device can't
+ * lseek(), but the TESTRAND_SEEK_BLOCK ioctl (see testrand.h) moves the
+ * position to any block.
+ */
+
+#define FUSE_USE_VERSION 29
+#include <cuse_lowlevel.h>
+#include <fuse_opt.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stddef.h>
+
+#include "gen.h"
+#include "spec.h"
+#include "testrand.h"
+
+#define DEVNAME "testrand0"
+
+/*
+ * The state of one open of the device.
+ */
+typedef struct dev_file_s {
+    uint64_t offset;
+} dev_file_t;
+
+typedef struct cuse_config_s {
+    char *devname;
+} cuse_config_t;
+static cuse_config_t config;
+
+static const struct fuse_opt cuse_opts[] = {
+    { "devname=%s", offsetof(cuse_config_t, devname), 0 },
+    FUSE_OPT_END
+};
+
+static uint32_t seed;
+
+static void dev_open(fuse_req_t req, struct fuse_file_info *fi) {
+    dev_file_t *file = calloc(1, sizeof(dev_file_t));
+    if (file == NULL) {
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+    fi->fh = (uintptr_t)file;
+    fi->direct_io = 1;
+    fi->nonseekable = 1;
+    fuse_reply_open(req, fi);
+}
+
+static void dev_release(fuse_req_t req, struct fuse_file_info *fi) {
+    free((dev_file_t *)(uintptr_t)fi->fh);
+    fuse_reply_err(req, 0);
+}
+
+/*
+ * Reads ignore off, which CUSE always passes as zero.  The position is
+ * claimed atomically, so concurrent reads on one open file each get
+ * their own part of the stream.
+ */
+static void dev_read(fuse_req_t req, size_t size, off_t off, struct fuse_file_info *fi) {
+    dev_file_t *file = (dev_file_t *)(uintptr_t)fi->fh;
+    char *buf = malloc(size);
+    if (buf == NULL) {
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+    uint64_t offset = __atomic_fetch_add(&file->offset, size, __ATOMIC_RELAXED);
+    get_range(buf, size, offset, seed);
+    fuse_reply_buf(req, buf, size);
+    free(buf);
+}
+
+static void dev_ioctl(fuse_req_t req, int cmd, void *arg, struct fuse_file_info *fi,
+    unsigned int flags, const void *in_buf, size_t in_bufsz, size_t out_bufsz) {
+    dev_file_t *file = (dev_file_t *)(uintptr_t)fi->fh;
+    uint64_t value;
+    switch ((unsigned int)cmd) {
+    case TESTRAND_SEEK_BLOCK:
+        if (in_bufsz != sizeof(value)) {
+            fuse_reply_err(req, EINVAL);
+            return;
+        }
+        memcpy(&value, in_buf, sizeof(value));
+        __atomic_store_n(&file->offset, value << BLOCK_SHIFT, __ATOMIC_RELAXED);
+        fuse_reply_ioctl(req, 0, NULL, 0);
+        return;
+    case TESTRAND_TELL:
+        if (out_bufsz != sizeof(value)) {
+            fuse_reply_err(req, EINVAL);
+            return;
+        }
+        value = __atomic_load_n(&file->offset, __ATOMIC_RELAXED);
+        fuse_reply_ioctl(req, 0, &value, sizeof(value));
+        return;
+    default:
+        fuse_reply_err(req, ENOTTY);
+        return;
+    }
+}
+
+static const struct cuse_lowlevel_ops cops = {
+    .open           = dev_open,
+    .read           = dev_read,
+    .release        = dev_release,
+    .ioctl          = dev_ioctl,
+};
+
+static void usage(void) {
+    fprintf(stderr, "usage: testfuse-cuse seed [-o devname=NAME] [-f] [-d]\n");
+    fprintf(stderr, "    -o devname=NAME   create /dev/NAME (default " DEVNAME ")\n");
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2 || parse_seed(argv[1], &seed) != 0) {
+        usage();
+        exit(EXIT_FAILURE);
+    }
+    argv[1] = argv[0];
+    argc--;
+    argv++;
+
+    // parse our own options, leaving the rest for CUSE
+    struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+    if (fuse_opt_parse(&args, &config, cuse_opts, NULL) == -1) {
+        usage();
+        exit(EXIT_FAILURE);
+    }
+    char devname[256];
+    snprintf(devname, sizeof(devname), "DEVNAME=%s", config.devname ? config.devname : DEVNAME);
+    const char *dev_info_argv[] = { devname };
+
+    // ioctls are restricted, so the kernel copies their arguments in
+    // and out by the sizes encoded in the commands
+    struct cuse_info ci;
+    memset(&ci, 0, sizeof(ci));
+    ci.dev_info_argc = 1;
+    ci.dev_info_argv = dev_info_argv;
+    return cuse_lowlevel_main(args.argc, args.argv, &ci, &cops, NULL);
+}
@@ -0,0 +1,151 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Serve test files over HTTP/1.1 straight from the generator, for
+ * download tests which would otherwise put a web server in front of a
+ * testfuse mount.
+ *
+ * Usage:
+ *     ./testfuse-http [-p port] [-t threads] [-b bucket] <file-spec-list>
+ *
+ * Each file is served as /<name>, with support for keep-alive, HEAD,
+ * single byte ranges, and an ETag derived from the size and seed.
+ * Names may be templates for numbered series of files (see ns.h).
+ * With -b, the files are instead served as the objects of an
+ * S3-compatible bucket.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#include "spec.h"
+#include "httpd.h"
+#include "ns.h"
+#include "s3.h"
+
+#define HTTP_PORT "8080"
+
+// a template can stand for billions of files; list only the first few
+#define INDEX_MAX 10000
+#define NAME_MAX_LEN 1024
+
+static ns_t *files;
+
+static void usage(void) {
+    fprintf(stderr, "usage: testfuse-http [-p port] [-t threads] [-b bucket] filename,size,seed[/...]\n");
+    fprintf(stderr, "    -p PORT     listen on this port (default " HTTP_PORT ")\n");
+    fprintf(stderr, "    -t N        serve with N threads (default: one per CPU)\n");
+    fprintf(stderr, "    -b BUCKET   serve an S3-compatible API with the files in BUCKET\n");
+}
+
+static void serve_index(http_conn_t *conn) {
+    size_t len = 0, max = 0;
+    char name[NAME_MAX_LEN+1] = "";
+    int inclusive = 1, count;
+    uint64_t size;
+    uint32_t seed;
+    char *body = NULL;
+    for (count=0; count<INDEX_MAX; count++) {
+        if (ns_next(files, name, inclusive, name, sizeof(name), &size, &seed) != 0) {
+            break;
+        }
+        inclusive = 0;
+        size_t n = strlen(name);
+        if (len + n + 1 > max) {
+            max = max ? max * 2 : 4096;
+            char *grown = realloc(body, max);
+            if (grown == NULL) {
+                free(body);
+                http_send(conn, 500, NULL, "", 0);
+                return;
+            }
+            body = grown;
+        }
+        memcpy(body + len, name, n);
+        body[len + n] = '\n';
+        len += n + 1;
+    }
+    http_send(conn, 200, "Content-Type: text/plain\r\n", body ? body : "", len);
+    free(body);
+}
+
+static void handle(http_conn_t *conn, const http_request_t *req, void *arg) {
+    if (strcmp(req->method, "GET") != 0 && !req->head) {
+        http_send(conn, 405, "Allow: GET, HEAD\r\n", "", 0);
+        return;
+    }
+    if (strcmp(req->path, "/") == 0) {
+        serve_index(conn);
+        return;
+    }
+    uint64_t size;
+    uint32_t seed;
+    if (ns_lookup(files, req->path + 1, &size, &seed) != 0) {
+        http_send(conn, 404, NULL, "", 0);
+        return;
+    }
+    http_send_file(conn, req, size, seed, NULL);
+}
+
+int main(int argc, char **argv) {
+    const char *port = HTTP_PORT;
+    const char *bucket = NULL;
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+    while ((opt = getopt(argc, argv, "p:t:b:")) != -1) {
+        switch (opt) {
+        case 'p':
+            port = optarg;
+            break;
+        case 't':
+            threads = atoi(optarg);
+            break;
+        case 'b':
+            bucket = optarg;
+            break;
+        default:
+            usage();
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (argc - optind != 1 || threads < 1) {
+        usage();
+        exit(EXIT_FAILURE);
+    }
+    spec_t *specs = parse_spec_list(argv[optind]);
+    if (specs == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    files = ns_new(specs);
+    if (files == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    if (bucket) {
+        s3_t s3 = { bucket, files };
+        http_serve(port, threads, s3_handle, &s3);
+    } else {
+        http_serve(port, threads, handle, NULL);
+    }
+    exit(EXIT_FAILURE);
+}
@@ -0,0 +1,211 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Identify where a sample of data came from: given a file-spec-list and
+ * a sample of at least 64 bytes (say, a bad sector found on a receiving
+ * host), report which test files hold that data and at what offset.
+ *
+ * No index or scan is needed.  Four consecutive words of generator
+ * output are the generator's whole state, which can be stepped backward
+ * to the start of its block (see gen_rewind()), and the block's seed
+ * word can be solved for the block number under each listed seed.  The
+ * whole sample is then compared against the regenerated content, so a
+ * sample which is only partly intact can still be placed.
+ *
+ * Usage:
+ *     ./testfuse-lookup [-s offset] [-n length] <file-spec-list> [sample-file]
+ *
+ * The sample is read from the given file or device (default stdin),
+ * starting at the given offset.  The exit status is 0 if the sample was
+ * found in a listed file, and 1 if not.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#include "gen.h"
+#include "spec.h"
+
+#define SAMPLE_MIN 64
+#define SAMPLE_MAX (1024*1024)
+
+// windows of four words are tried at least this far apart (at each of
+// the four byte alignments) until one rewinds to a block start, but no
+// more than WINDOWS_MAX of them, spread across the sample; short
+// samples are tried at every byte, so damage at the start or a block
+// boundary inside doesn't stop them being placed
+#define WINDOW_STRIDE 4
+#define WINDOWS_MAX 256
+
+static void usage(void) {
+    fprintf(stderr, "usage: testfuse-lookup [-s offset] [-n length] filename,size,seed[/...] [sample-file]\n");
+    fprintf(stderr, "    -s OFFSET   read the sample from this offset (default 0)\n");
+    fprintf(stderr, "    -n LENGTH   sample length (default: to end of file, up to 1M)\n");
+}
+
+/*
+ * Read up to len bytes, stopping early only at end of file.
+ */
+static ssize_t read_sample(int fd, char *buf, size_t len, uint64_t offset) {
+    size_t got = 0;
+    if (offset && lseek(fd, offset, SEEK_SET) == (off_t)-1) {
+        return -1;
+    }
+    while (got < len) {
+        ssize_t n = read(fd, buf + got, len - got);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        got += n;
+    }
+    return got;
+}
+
+/*
+ * Find a window of the sample that rewinds to a block start, giving the
+ * block's seed word and the stream offset of the window.  Returns the
+ * window's position in the sample, or -1.
+ */
+static ssize_t locate(const char *sample, size_t len, uint32_t *x0, uint64_t *word_offset) {
+    size_t stride = len / WINDOWS_MAX > WINDOW_STRIDE ? len / WINDOWS_MAX : WINDOW_STRIDE;
+    size_t pos;
+    int align;
+    for (pos=0; pos+4*sizeof(uint32_t)+3<=len; pos+=stride) {
+        for (align=0; align<4; align++) {
+            uint32_t words[4];
+            uint32_t index;
+            memcpy(words, sample + pos + align, sizeof(words));
+            if (gen_rewind(words, x0, &index) == 0) {
+                *word_offset = index * sizeof(uint32_t);
+                return pos + align;
+            }
+        }
+    }
+    return -1;
+}
+
+int main(int argc, char **argv) {
+    uint64_t offset = 0;
+    uint64_t length = SAMPLE_MAX;
+    char *endptr;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:n:")) != -1) {
+        switch (opt) {
+        case 's':
+            offset = parse_size(optarg, &endptr);
+            if (*endptr != '\0') {
+                usage();
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'n':
+            length = parse_size(optarg, &endptr);
+            if (*endptr != '\0' || length > SAMPLE_MAX) {
+                fprintf(stderr, "error: sample length must be at most %d bytes\n", SAMPLE_MAX);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        default:
+            usage();
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (argc - optind < 1 || argc - optind > 2) {
+        usage();
+        exit(EXIT_FAILURE);
+    }
+    spec_t *specs = parse_spec_list(argv[optind]);
+    if (specs == NULL) {
+        exit(EXIT_FAILURE);
+    }
+
+    int fd = STDIN_FILENO;
+    const char *path = "stdin";
+    if (argc - optind == 2) {
+        path = argv[optind+1];
+        fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            fprintf(stderr, "error: %s: %s\n", path, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+    char *sample = malloc(length);
+    char *expected = malloc(length);
+    if (sample == NULL || expected == NULL) {
+        fprintf(stderr, "error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    ssize_t len = read_sample(fd, sample, length, offset);
+    if (len < 0) {
+        fprintf(stderr, "error: %s: %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    if (len < SAMPLE_MIN) {
+        fprintf(stderr, "error: sample is %zd bytes, need at least %d\n", len, SAMPLE_MIN);
+        exit(EXIT_FAILURE);
+    }
+
+    uint32_t x0;
+    uint64_t word_offset;
+    ssize_t pos = locate(sample, len, &x0, &word_offset);
+    if (pos < 0) {
+        printf("not testfuse data\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // the same seed word gives the same block content, so the sample
+    // may be found in several files, even under different seeds
+    int found = 0;
+    spec_t *spec;
+    for (spec=specs; spec!=NULL; spec=spec->next) {
+        uint64_t block = gen_block_of(x0, spec->seed);
+        uint64_t at = (block << BLOCK_SHIFT) + word_offset;
+        if (at < pos || at - pos >= spec->size) {
+            continue;
+        }
+        at -= pos;
+        size_t n = spec->size - at < len ? spec->size - at : len;
+        size_t i, match = 0;
+        get_range(expected, n, at, spec->seed);
+        for (i=0; i<n; i++) {
+            match += sample[i] == expected[i];
+        }
+        printf("%s (seed 0x%" PRIx32 "): offset %" PRIu64 ", %zu of %zd bytes match\n",
+            spec->name, spec->seed, at, match, len);
+        found = 1;
+    }
+    if (!found) {
+        printf("testfuse data, but not from any listed file\n");
+        exit(EXIT_FAILURE);
+    }
+    return 0;
+}
@@ -0,0 +1,615 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Export test files as network block devices, for block-layer and
+ * filesystem benchmarks which need a device with known contents:
+ *
+ *     $ ./testfuse-nbd disk,16G,0x01 &
+ *     $ nbd-client -N disk localhost /dev/nbd0
+ *
+ * Usage:
+ *     ./testfuse-nbd [-p port] [-w] <file-spec-list>
+ *
+ * Each file is an export of the same name; clients which don't name
+ * one get the first.  This speaks the fixed newstyle handshake, with
+ * NBD_OPT_GO, NBD_OPT_INFO, NBD_OPT_LIST and the old
+ * NBD_OPT_EXPORT_NAME, and structured replies where the client asks for
+ * them.  Exports are read-only unless -w is given, in which case writes
+ * are accepted and discarded, so that reads always return the generated
+ * content.  Nothing is ever stored, so any number of connections may
+ * share an export.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <endian.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "gen.h"
+#include "spec.h"
+#include "net.h"
+
+#define NBD_PORT "10809"
+
+// reads are generated, and writes discarded, this much at a time
+#define CHUNK_SIZE (1024*1024)
+// the largest request we advertise; reads are streamed, so it's only a hint
+#define NBD_MAX_REQUEST (32*1024*1024)
+#define NBD_MAX_OPTION 4096
+
+// handshake
+#define NBD_MAGIC 0x4e42444d41474943ULL            // "NBDMAGIC"
+#define NBD_IHAVEOPT 0x49484156454f5054ULL         // "IHAVEOPT"
+#define NBD_REP_MAGIC 0x0003e889045565a9ULL
+#define NBD_FLAG_FIXED_NEWSTYLE (1 << 0)
+#define NBD_FLAG_NO_ZEROES (1 << 1)
+
+// options
+#define NBD_OPT_EXPORT_NAME 1
+#define NBD_OPT_ABORT 2
+#define NBD_OPT_LIST 3
+#define NBD_OPT_INFO 6
+#define NBD_OPT_GO 7
+#define NBD_OPT_STRUCTURED_REPLY 8
+
+// option replies
+#define NBD_REP_ACK 1
+#define NBD_REP_SERVER 2
+#define NBD_REP_INFO 3
+#define NBD_REP_ERR_UNSUP (0x80000000 + 1)
+#define NBD_REP_ERR_INVALID (0x80000000 + 3)
+#define NBD_REP_ERR_UNKNOWN (0x80000000 + 6)
+#define NBD_INFO_EXPORT 0
+#define NBD_INFO_BLOCK_SIZE 3
+
+// transmission flags
+#define NBD_FLAG_HAS_FLAGS (1 << 0)
+#define NBD_FLAG_READ_ONLY (1 << 1)
+#define NBD_FLAG_SEND_FLUSH (1 << 2)
+#define NBD_FLAG_SEND_TRIM (1 << 5)
+#define NBD_FLAG_SEND_WRITE_ZEROES (1 << 6)
+#define NBD_FLAG_SEND_DF (1 << 7)
+#define NBD_FLAG_CAN_MULTI_CONN (1 << 8)
+
+// transmission
+#define NBD_REQUEST_MAGIC 0x25609513
+#define NBD_SIMPLE_REPLY_MAGIC 0x67446698
+#define NBD_STRUCTURED_REPLY_MAGIC 0x668e33ef
+#define NBD_CMD_READ 0
+#define NBD_CMD_WRITE 1
+#define NBD_CMD_DISC 2
+#define NBD_CMD_FLUSH 3
+#define NBD_CMD_TRIM 4
+#define NBD_CMD_WRITE_ZEROES 6
+#define NBD_REPLY_FLAG_DONE (1 << 0)
+#define NBD_REPLY_TYPE_NONE 0
+#define NBD_REPLY_TYPE_OFFSET_DATA 1
+#define NBD_REPLY_TYPE_ERROR 32769
+
+#define NBD_EPERM 1
+#define NBD_EIO 5
+#define NBD_EINVAL 22
+#define NBD_ENOSPC 28
+
+typedef struct nbd_request_s {
+    uint32_t magic;
+    uint16_t flags;
+    uint16_t type;
+    uint64_t handle;
+    uint64_t offset;
+    uint32_t length;
+} __attribute__((packed)) nbd_request_t;
+
+typedef struct nbd_simple_reply_s {
+    uint32_t magic;
+    uint32_t error;
+    uint64_t handle;
+} __attribute__((packed)) nbd_simple_reply_t;
+
+typedef struct nbd_structured_reply_s {
+    uint32_t magic;
+    uint16_t flags;
+    uint16_t type;
+    uint64_t handle;
+    uint32_t length;
+} __attribute__((packed)) nbd_structured_reply_t;
+
+typedef struct nbd_conn_s {
+    int fd;
+    char peer[NI_MAXHOST];
+    int structured;         // the client negotiated structured replies
+    const spec_t *export;
+    char *buf;
+} nbd_conn_t;
+
+static spec_t *files;
+static int writable = 0;
+
+static void usage(void) {
+    fprintf(stderr, "usage: testfuse-nbd [-p port] [-w] filename,size,seed[/...]\n");
+    fprintf(stderr, "    -p PORT     listen on this port (default " NBD_PORT ")\n");
+    fprintf(stderr, "    -w          accept (and discard) writes\n");
+}
+
+static uint16_t export_flags(const nbd_conn_t *conn) {
+    uint16_t flags = NBD_FLAG_HAS_FLAGS | NBD_FLAG_CAN_MULTI_CONN;
+    if (writable) {
+        flags |= NBD_FLAG_SEND_FLUSH | NBD_FLAG_SEND_TRIM | NBD_FLAG_SEND_WRITE_ZEROES;
+    } else {
+        flags |= NBD_FLAG_READ_ONLY;
+    }
+    if (conn->structured) {
+        flags |= NBD_FLAG_SEND_DF;
+    }
+    return flags;
+}
+
+/*
+ * An empty name means the default export, which is the first.
+ */
+static const spec_t *find_export(const char *name) {
+    if (*name == '\0') {
+        return files;
+    }
+    const spec_t *file;
+    for (file=files; file!=NULL; file=file->next) {
+        if (strcmp(name, file->name) == 0) {
+            return file;
+        }
+    }
+    return NULL;
+}
+
+static int write_iov_full(int fd, struct iovec *iov, int iovcnt) {
+    while (iovcnt > 0) {
+        ssize_t n = writev(fd, iov, iovcnt);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+static int option_reply(nbd_conn_t *conn, uint32_t option, uint32_t type,
+    const void *data, uint32_t len) {
+    struct {
+        uint64_t magic;
+        uint32_t option;
+        uint32_t type;
+        uint32_t length;
+    } __attribute__((packed)) reply;
+    reply.magic = htobe64(NBD_REP_MAGIC);
+    reply.option = htobe32(option);
+    reply.type = htobe32(type);
+    reply.length = htobe32(len);
+    struct iovec iov[2] = {
+        { &reply, sizeof(reply) },
+        { (void *)data, len },
+    };
+    return write_iov_full(conn->fd, iov, 2);
+}
+
+/*
+ * Answer NBD_OPT_INFO or NBD_OPT_GO.  Returns 1 if the client may move
+ * on to transmission, 0 to carry on negotiating, or -1 on error.
+ */
+static int option_go(nbd_conn_t *conn, uint32_t option, const char *data, uint32_t len) {
+    uint32_t name_len;
+    uint16_t ninfo;
+    if (len < 6 || (name_len = be32toh(*(uint32_t *)data)) > len - 6 ||
+        (ninfo = be16toh(*(uint16_t *)(data + 4 + name_len))) * 2 != len - 6 - name_len) {
+        return option_reply(conn, option, NBD_REP_ERR_INVALID, NULL, 0);
+    }
+    char name[NBD_MAX_OPTION+1];
+    memcpy(name, data + 4, name_len);
+    name[name_len] = '\0';
+    const spec_t *export = find_export(name);
+    if (export == NULL) {
+        return option_reply(conn, option, NBD_REP_ERR_UNKNOWN, NULL, 0);
+    }
+
+    // the export size and flags must always be sent; block sizes are
+    // sent whether or not they're asked for, as clients may ignore them
+    struct {
+        uint16_t type;
+        uint64_t size;
+        uint16_t flags;
+    } __attribute__((packed)) info_export;
+    info_export.type = htobe16(NBD_INFO_EXPORT);
+    info_export.size = htobe64(export->size);
+    info_export.flags = htobe16(export_flags(conn));
+    struct {
+        uint16_t type;
+        uint32_t minimum;
+        uint32_t preferred;
+        uint32_t maximum;
+    } __attribute__((packed)) info_block_size;
+    info_block_size.type = htobe16(NBD_INFO_BLOCK_SIZE);
+    info_block_size.minimum = htobe32(1);
+    info_block_size.preferred = htobe32(BLOCK_SIZE);
+    info_block_size.maximum = htobe32(NBD_MAX_REQUEST);
+    if (option_reply(conn, option, NBD_REP_INFO, &info_export, sizeof(info_export)) != 0 ||
+        option_reply(conn, option, NBD_REP_INFO, &info_block_size, sizeof(info_block_size)) != 0 ||
+        option_reply(conn, option, NBD_REP_ACK, NULL, 0) != 0) {
+        return -1;
+    }
+    if (option == NBD_OPT_GO) {
+        conn->export = export;
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Negotiate an export with the client.  Returns 0 when transmission
+ * should begin, or -1 if the connection should be closed.
+ */
+static int handshake(nbd_conn_t *conn) {
+    struct {
+        uint64_t magic;
+        uint64_t ihaveopt;
+        uint16_t flags;
+    } __attribute__((packed)) hello;
+    hello.magic = htobe64(NBD_MAGIC);
+    hello.ihaveopt = htobe64(NBD_IHAVEOPT);
+    hello.flags = htobe16(NBD_FLAG_FIXED_NEWSTYLE | NBD_FLAG_NO_ZEROES);
+    uint32_t client_flags;
+    if (net_write_full(conn->fd, &hello, sizeof(hello)) != 0 ||
+        net_read_full(conn->fd, &client_flags, sizeof(client_flags)) != 0) {
+        return -1;
+    }
+    client_flags = be32toh(client_flags);
+
+    char data[NBD_MAX_OPTION+1];
+    for (;;) {
+        struct {
+            uint64_t ihaveopt;
+            uint32_t option;
+            uint32_t length;
+        } __attribute__((packed)) header;
+        if (net_read_full(conn->fd, &header, sizeof(header)) != 0 ||
+            be64toh(header.ihaveopt) != NBD_IHAVEOPT) {
+            return -1;
+        }
+        uint32_t option = be32toh(header.option);
+        uint32_t len = be32toh(header.length);
+        if (len > NBD_MAX_OPTION) {
+            fprintf(stderr, "%s: option %u too long\n", conn->peer, option);
+            return -1;
+        }
+        if (net_read_full(conn->fd, data, len) != 0) {
+            return -1;
+        }
+        data[len] = '\0';
+
+        int status = 0;
+        switch (option) {
+        case NBD_OPT_EXPORT_NAME:
+            // no way to refuse this but to hang up
+            conn->export = find_export(data);
+            if (conn->export == NULL) {
+                fprintf(stderr, "%s: no export named \"%s\"\n", conn->peer, data);
+                return -1;
+            }
+            struct {
+                uint64_t size;
+                uint16_t flags;
+                char zeroes[124];
+            } __attribute__((packed)) reply;
+            memset(&reply, 0, sizeof(reply));
+            reply.size = htobe64(conn->export->size);
+            reply.flags = htobe16(export_flags(conn));
+            return net_write_full(conn->fd, &reply,
+                client_flags & NBD_FLAG_NO_ZEROES ? 10 : sizeof(reply));
+        case NBD_OPT_ABORT:
+            option_reply(conn, option, NBD_REP_ACK, NULL, 0);
+            return -1;
+        case NBD_OPT_LIST:
+            if (len != 0) {
+                status = option_reply(conn, option, NBD_REP_ERR_INVALID, NULL, 0);
+                break;
+            }
+            const spec_t *file;
+            for (file=files; file!=NULL && status==0; file=file->next) {
+                char server[4 + NBD_MAX_OPTION];
+                uint32_t name_len = strlen(file->name);
+                if (name_len > NBD_MAX_OPTION) {
+                    continue;
+                }
+                *(uint32_t *)server = htobe32(name_len);
+                memcpy(server + 4, file->name, name_len);
+                status = option_reply(conn, option, NBD_REP_SERVER, server, 4 + name_len);
+            }
+            if (status == 0) {
+                status = option_reply(conn, option, NBD_REP_ACK, NULL, 0);
+            }
+            break;
+        case NBD_OPT_STRUCTURED_REPLY:
+            if (len != 0) {
+                status = option_reply(conn, option, NBD_REP_ERR_INVALID, NULL, 0);
+                break;
+            }
+            conn->structured = 1;
+            status = option_reply(conn, option, NBD_REP_ACK, NULL, 0);
+            break;
+        case NBD_OPT_INFO:
+        case NBD_OPT_GO:
+            status = option_go(conn, option, data, len);
+            if (status == 1) {
+                return 0;
+            }
+            break;
+        default:
+            status = option_reply(conn, option, NBD_REP_ERR_UNSUP, NULL, 0);
+            break;
+        }
+        if (status != 0) {
+            return -1;
+        }
+    }
+}
+
+/*
+ * Reply to a request with no payload: success, or an error.
+ */
+static int reply(nbd_conn_t *conn, const nbd_request_t *req, uint32_t error) {
+    if (!conn->structured) {
+        nbd_simple_reply_t simple;
+        simple.magic = htobe32(NBD_SIMPLE_REPLY_MAGIC);
+        simple.error = htobe32(error);
+        simple.handle = req->handle;
+        return net_write_full(conn->fd, &simple, sizeof(simple));
+    }
+    struct {
+        nbd_structured_reply_t header;
+        uint32_t error;
+        uint16_t message_length;
+    } __attribute__((packed)) structured;
+    structured.header.magic = htobe32(NBD_STRUCTURED_REPLY_MAGIC);
+    structured.header.flags = htobe16(NBD_REPLY_FLAG_DONE);
+    structured.header.handle = req->handle;
+    if (error == 0) {
+        structured.header.type = htobe16(NBD_REPLY_TYPE_NONE);
+        structured.header.length = 0;
+        return net_write_full(conn->fd, &structured.header, sizeof(structured.header));
+    }
+    structured.header.type = htobe16(NBD_REPLY_TYPE_ERROR);
+    structured.header.length = htobe32(6);
+    structured.error = htobe32(error);
+    structured.message_length = 0;
+    return net_write_full(conn->fd, &structured, sizeof(structured));
+}
+
+/*
+ * Send the requested range from the generator, a chunk at a time behind
+ * a single reply header.  Structured replies use one data chunk, so
+ * they satisfy NBD_CMD_FLAG_DF whether or not it was asked for.
+ */
+static int reply_read(nbd_conn_t *conn, const nbd_request_t *req) {
+    union {
+        nbd_simple_reply_t simple;
+        struct {
+            nbd_structured_reply_t header;
+            uint64_t offset;
+        } __attribute__((packed)) structured;
+    } header;
+    size_t header_len;
+    if (conn->structured) {
+        header.structured.header.magic = htobe32(NBD_STRUCTURED_REPLY_MAGIC);
+        header.structured.header.flags = htobe16(NBD_REPLY_FLAG_DONE);
+        header.structured.header.type = htobe16(NBD_REPLY_TYPE_OFFSET_DATA);
+        header.structured.header.handle = req->handle;
+        header.structured.header.length = htobe32(8 + req->length);
+        header.structured.offset = htobe64(req->offset);
+        header_len = sizeof(header.structured);
+    } else {
+        header.simple.magic = htobe32(NBD_SIMPLE_REPLY_MAGIC);
+        header.simple.error = 0;
+        header.simple.handle = req->handle;
+        header_len = sizeof(header.simple);
+    }
+    uint32_t done = 0;
+    do {
+        size_t len = req->length - done < CHUNK_SIZE ? req->length - done : CHUNK_SIZE;
+        get_range(conn->buf, len, req->offset + done, conn->export->seed);
+        struct iovec iov[2] = {
+            { &header, done == 0 ? header_len : 0 },
+            { conn->buf, len },
+        };
+        if (write_iov_full(conn->fd, iov, 2) != 0) {
+            return -1;
+        }
+        done += len;
+    } while (done < req->length);
+    return 0;
+}
+
+/*
+ * Read and throw away the payload of a write.
+ */
+static int discard(nbd_conn_t *conn, uint32_t length) {
+    while (length > 0) {
+        size_t len = length < CHUNK_SIZE ? length : CHUNK_SIZE;
+        if (net_read_full(conn->fd, conn->buf, len) != 0) {
+            return -1;
+        }
+        length -= len;
+    }
+    return 0;
+}
+
+static void transmission(nbd_conn_t *conn) {
+    uint64_t size = conn->export->size;
+    for (;;) {
+        nbd_request_t req;
+        if (net_read_full(conn->fd, &req, sizeof(req)) != 0) {
+            return;
+        }
+        if (be32toh(req.magic) != NBD_REQUEST_MAGIC) {
+            fprintf(stderr, "%s: bad request magic\n", conn->peer);
+            return;
+        }
+        uint16_t type = be16toh(req.type);
+        req.offset = be64toh(req.offset);
+        req.length = be32toh(req.length);
+        int in_range = req.offset <= size && req.length <= size - req.offset;
+        int status;
+        switch (type) {
+        case NBD_CMD_READ:
+            if (!in_range || req.length == 0) {
+                status = reply(conn, &req, NBD_EINVAL);
+            } else {
+                status = reply_read(conn, &req);
+            }
+            break;
+        case NBD_CMD_WRITE:
+            // the payload follows whether or not we want it
+            if (discard(conn, req.length) != 0) {
+                return;
+            }
+            // fall through
+        case NBD_CMD_TRIM:
+        case NBD_CMD_WRITE_ZEROES:
+            if (!writable) {
+                status = reply(conn, &req, NBD_EPERM);
+            } else if (!in_range) {
+                status = reply(conn, &req, NBD_ENOSPC);
+            } else {
+                status = reply(conn, &req, 0);
+            }
+            break;
+        case NBD_CMD_FLUSH:
+            status = reply(conn, &req, 0);
+            break;
+        case NBD_CMD_DISC:
+            return;
+        default:
+            status = reply(conn, &req, NBD_EINVAL);
+            break;
+        }
+        if (status != 0) {
+            return;
+        }
+    }
+}
+
+static void *nbd_thread(void *arg) {
+    nbd_conn_t *conn = arg;
+    if (handshake(conn) == 0) {
+        conn->buf = malloc(CHUNK_SIZE);
+        if (conn->buf == NULL) {
+            fprintf(stderr, "error: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        transmission(conn);
+        free(conn->buf);
+    }
+    close(conn->fd);
+    free(conn);
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    const char *port = NBD_PORT;
+    int opt;
+    while ((opt = getopt(argc, argv, "p:w")) != -1) {
+        switch (opt) {
+        case 'p':
+            port = optarg;
+            break;
+        case 'w':
+            writable = 1;
+            break;
+        default:
+            usage();
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (argc - optind != 1) {
+        usage();
+        exit(EXIT_FAILURE);
+    }
+    files = parse_spec_list(argv[optind]);
+    if (files == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    // a client disconnecting mid-reply fails that connection's write,
+    // rather than killing the server and every other connection
+    signal(SIGPIPE, SIG_IGN);
+    int lfd = net_listen(port, SOCK_STREAM);
+    if (lfd < 0) {
+        exit(EXIT_FAILURE);
+    }
+    for (;;) {
+        struct sockaddr_storage addr;
+        socklen_t addr_len = sizeof(addr);
+        int fd = accept(lfd, (struct sockaddr *)&addr, &addr_len);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            perror("testfuse-nbd: accept");
+            exit(EXIT_FAILURE);
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        nbd_conn_t *conn = calloc(1, sizeof(nbd_conn_t));
+        if (conn == NULL) {
+            fprintf(stderr, "error: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        conn->fd = fd;
+        if (getnameinfo((struct sockaddr *)&addr, addr_len, conn->peer, sizeof(conn->peer),
+                NULL, 0, NI_NUMERICHOST) != 0) {
+            strcpy(conn->peer, "?");
+        }
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, nbd_thread, conn) != 0) {
+            fprintf(stderr, "error: can't start a connection thread\n");
+            close(fd);
+            free(conn);
+            continue;
+        }
+        pthread_detach(tid);
+    }
+}
@@ -0,0 +1,63 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Network test modes which generate and verify testfuse content on the
+ * wire, so that no other tools are needed at either end.
+ *
+ * Usage:
+ *     ./testfuse-net recv [options]
+ *     ./testfuse-net send [options] <host> <size>,<seed>
+ *     ./testfuse-net udp-recv [options]
+ *     ./testfuse-net udp-send [options] <host> <size>,<seed>
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "net.h"
+
+static void usage(void) {
+    fprintf(stderr, "usage: testfuse-net recv [options]\n");
+    fprintf(stderr, "       testfuse-net send [options] <host> <size>,<seed>\n");
+    fprintf(stderr, "       testfuse-net udp-recv [options]\n");
+    fprintf(stderr, "       testfuse-net udp-send [options] <host> <size>,<seed>\n");
+    fprintf(stderr, "run \"testfuse-net <mode> -h\" for the options of each mode\n");
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        usage();
+        exit(EXIT_FAILURE);
+    }
+    // each mode parses its own options, with the mode as argv[0]
+    if (strcmp(argv[1], "send") == 0) {
+        return tcp_send_main(argc-1, argv+1);
+    } else if (strcmp(argv[1], "recv") == 0) {
+        return tcp_recv_main(argc-1, argv+1);
+    } else if (strcmp(argv[1], "udp-send") == 0) {
+        return udp_send_main(argc-1, argv+1);
+    } else if (strcmp(argv[1], "udp-recv") == 0) {
+        return udp_recv_main(argc-1, argv+1);
+    }
+    usage();
+    exit(EXIT_FAILURE);
+}
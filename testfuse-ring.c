@@ -0,0 +1,168 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Read a test file through a shared-memory ring served by a testfuse
+ * mount started with -o ring=PATH, without any copy through the kernel:
+ * the daemon generates straight into memory mapped by both processes,
+ * and this program consumes each chunk in place.
+ *
+ * Usage:
+ *     ./testfuse-ring [-s offset] [-n length] [-b slot-size] [-k slots]
+ *                     [-t threads] [-v] <socket> <name>
+ *
+ * The transfer rate is reported on stderr.  With -v, every byte is
+ * checked against the generator, and the exit status is 1 on mismatch.
+ * This is mostly a reference consumer; see ring.h to embed one.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#include "gen.h"
+#include "net.h"
+#include "ring.h"
+#include "spec.h"
+#include "verify.h"
+
+// keeps the unverified read loop from being optimized away
+static volatile uint64_t sink;
+
+static void usage(void) {
+    fprintf(stderr, "usage: testfuse-ring [-s offset] [-n length] [-b slot-size] [-k slots] [-t threads] [-v] socket name\n");
+    fprintf(stderr, "    -s OFFSET   start at this offset (default 0)\n");
+    fprintf(stderr, "    -n LENGTH   bytes to read (default: to end of file)\n");
+    fprintf(stderr, "    -b SIZE     ring slot size, a multiple of 4K (default 1M)\n");
+    fprintf(stderr, "    -k SLOTS    ring slots (default %d)\n", RING_SLOTS);
+    fprintf(stderr, "    -t THREADS  daemon threads filling the ring (default %d)\n", RING_THREADS);
+    fprintf(stderr, "    -v          verify the content\n");
+}
+
+static uint64_t parse_arg(const char *arg) {
+    char *endptr;
+    uint64_t value = parse_size(arg, &endptr);
+    if (*endptr != '\0') {
+        usage();
+        exit(EXIT_FAILURE);
+    }
+    return value;
+}
+
+int main(int argc, char **argv) {
+    uint64_t offset = 0;
+    uint64_t length = 0;
+    uint32_t slot_size = RING_SLOT_SIZE;
+    uint32_t slots = RING_SLOTS;
+    uint32_t threads = 0;
+    int verify = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:n:b:k:t:v")) != -1) {
+        switch (opt) {
+        case 's':
+            offset = parse_arg(optarg);
+            break;
+        case 'n':
+            length = parse_arg(optarg);
+            break;
+        case 'b':
+            slot_size = parse_arg(optarg);
+            break;
+        case 'k':
+            slots = parse_arg(optarg);
+            break;
+        case 't':
+            threads = parse_arg(optarg);
+            break;
+        case 'v':
+            verify = 1;
+            break;
+        default:
+            usage();
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (argc - optind != 2) {
+        usage();
+        exit(EXIT_FAILURE);
+    }
+
+    ring_reply_t reply;
+    ring_client_t *ring = ring_open(argv[optind], argv[optind+1], offset, length,
+        slot_size, slots, threads, &reply);
+    if (ring == NULL) {
+        fprintf(stderr, "error: %s: %s: %s\n", argv[optind], argv[optind+1], strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    if (verify && reply.format != GEN_FORMAT_XORSHIFT) {
+        fprintf(stderr, "error: %s comes from a generator plugin, and can't be verified\n",
+            argv[optind+1]);
+        exit(EXIT_FAILURE);
+    }
+    verify_ctx_t *ctx = NULL;
+    if (verify && (ctx = verify_new(reply.seed, offset)) == NULL) {
+        fprintf(stderr, "error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    double start = net_now();
+    uint64_t total = 0;
+    uint64_t sum = 0;
+    const void *data;
+    size_t len;
+    while ((data = ring_next(ring, &len)) != NULL) {
+        if (ctx) {
+            verify_update(ctx, data, len);
+        } else {
+            // touch every cache line, as a real consumer would
+            const uint64_t *words = data;
+            size_t i;
+            for (i=0; i<len/sizeof(uint64_t); i+=8) {
+                sum += words[i];
+            }
+        }
+        total += len;
+    }
+    int err = errno;
+    sink = sum;
+    double elapsed = net_now() - start;
+    ring_close(ring);
+
+    fprintf(stderr, "%" PRIu64 " bytes in %.3f s: %.2f GB/s\n", total, elapsed,
+        elapsed > 0 ? total / elapsed / 1e9 : 0.0);
+    if (total < (length ? length : reply.size - offset)) {
+        fprintf(stderr, "error: ring ended early: %s\n", strerror(err));
+        exit(EXIT_FAILURE);
+    }
+    if (ctx) {
+        uint64_t first;
+        uint64_t bad = verify_mismatched(ctx, &first);
+        verify_free(ctx);
+        if (bad) {
+            fprintf(stderr, "FAIL: %" PRIu64 " bytes mismatched, first at offset %" PRIu64 "\n", bad, first);
+            exit(EXIT_FAILURE);
+        }
+        fprintf(stderr, "OK\n");
+    }
+    return 0;
+}
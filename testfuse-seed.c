@@ -0,0 +1,780 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Seed test files to BitTorrent peers straight from the generator, for
+ * staging swarms without a torrent client reading through a testfuse
+ * mount.
+ *
+ * Usage:
+ *     ./testfuse-seed [options] <file-spec-list>
+ *
+ * Each file is seeded under the same metainfo testfuse serves in its
+ * /.torrent directory (for the same piece length and announce URL), so
+ * the info hashes match.  Peers connect to us, either given our address
+ * directly or through the tracker named by -a, which we announce to.
+ * Every peer is unchoked at once, and requested blocks are generated
+ * into a small ring of buffers per peer which are sent with
+ * MSG_ZEROCOPY where the kernel supports it.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <endian.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/errqueue.h>
+
+#include "gen.h"
+#include "spec.h"
+#include "cache.h"
+#include "torrent.h"
+#include "net.h"
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+
+#define SEED_PORT "6881"
+
+#define PROTOCOL "\x13" "BitTorrent protocol"
+#define PROTOCOL_LEN 20
+#define HANDSHAKE_LEN (PROTOCOL_LEN + 8 + TORRENT_HASH_SIZE)     // before the peer id
+#define PEER_ID_LEN 20
+
+// the longest tracker URL we'll announce to, which leaves room in a
+// request for everything else
+#define ANNOUNCE_URL_MAX 1024
+#define ANNOUNCE_REQUEST_MAX 2048
+
+#define MSG_CHOKE 0
+#define MSG_UNCHOKE 1
+#define MSG_INTERESTED 2
+#define MSG_NOT_INTERESTED 3
+#define MSG_HAVE 4
+#define MSG_BITFIELD 5
+#define MSG_REQUEST 6
+#define MSG_PIECE 7
+#define MSG_CANCEL 8
+#define PIECE_HEADER_LEN 13
+
+// clients request 16K blocks; anything over this is refused
+#define REQUEST_BLOCK_MAX (128*1024)
+// pipelined requests a peer may have outstanding
+#define REQUESTS_MAX 1024
+// the longest message we'll accept from a peer
+#define MESSAGE_MAX (PIECE_HEADER_LEN + REQUEST_BLOCK_MAX)
+
+// blocks are sent in batches of up to this much; zerocopy buffers are
+// reusable only once the kernel is done with them, so keep several
+#define BATCH_SIZE (256*1024)
+#define SEND_BATCHES 4
+
+#define EPOLL_EVENTS 64
+
+typedef struct seed_file_s {
+    torrent_t torrent;
+    const char *name;
+    struct seed_file_s *next;
+} seed_file_t;
+
+typedef struct request_s {
+    uint32_t index;
+    uint32_t begin;
+    uint32_t length;
+} request_t;
+
+typedef struct batch_s {
+    char *buf;
+    size_t len;
+    size_t pos;
+    uint32_t calls;         // zerocopy send calls (numbered per socket) using buf
+} batch_t;
+
+typedef enum {
+    PEER_HANDSHAKE,
+    PEER_ID,
+    PEER_ACTIVE
+} peer_state_t;
+
+typedef struct peer_s {
+    int fd;
+    int epfd;
+    uint32_t events;
+    peer_state_t state;
+    const torrent_t *torrent;
+
+    uint8_t in[MESSAGE_MAX + 4];
+    size_t in_len;
+
+    // our handshake, bitfield and unchoke, sent before any blocks
+    char *ctl;
+    size_t ctl_len;
+    size_t ctl_pos;
+
+    request_t queue[REQUESTS_MAX];
+    int queue_head;
+    int queue_len;
+
+    batch_t batches[SEND_BATCHES];
+    int batch;              // the batch being sent
+    int zerocopy;
+    uint32_t calls;
+    uint32_t completed;
+    uint32_t waiting;       // completed calls needed to send more
+} peer_t;
+
+static seed_file_t *files = NULL;
+static uint8_t peer_id[PEER_ID_LEN];
+static const char *listen_port = SEED_PORT;
+
+static const torrent_t *find_torrent(const uint8_t *info_hash) {
+    seed_file_t *file;
+    for (file=files; file!=NULL; file=file->next) {
+        if (memcmp(file->torrent.info_hash, info_hash, TORRENT_HASH_SIZE) == 0) {
+            return &file->torrent;
+        }
+    }
+    return NULL;
+}
+
+static void put_be32(char *p, uint32_t value) {
+    value = htobe32(value);
+    memcpy(p, &value, 4);
+}
+
+static uint32_t get_be32(const uint8_t *p) {
+    uint32_t value;
+    memcpy(&value, p, 4);
+    return be32toh(value);
+}
+
+/*
+ * Queue our side of the handshake, then a bitfield with every piece,
+ * then an unchoke: we have everything and serve everyone.
+ */
+static int start_peer(peer_t *peer, const torrent_t *t) {
+    size_t bitfield_len = (t->npieces + 7) / 8;
+    peer->ctl_len = HANDSHAKE_LEN + PEER_ID_LEN + 5 + bitfield_len + 5;
+    peer->ctl = malloc(peer->ctl_len);
+    if (peer->ctl == NULL) {
+        return -1;
+    }
+    char *p = peer->ctl;
+    memcpy(p, PROTOCOL, PROTOCOL_LEN);
+    memset(p + PROTOCOL_LEN, 0, 8);
+    memcpy(p + PROTOCOL_LEN + 8, t->info_hash, TORRENT_HASH_SIZE);
+    memcpy(p + HANDSHAKE_LEN, peer_id, PEER_ID_LEN);
+    p += HANDSHAKE_LEN + PEER_ID_LEN;
+    put_be32(p, 1 + bitfield_len);
+    p[4] = MSG_BITFIELD;
+    memset(p + 5, 0xff, bitfield_len);
+    if (t->npieces % 8) {
+        // spare bits at the end must be clear
+        p[5 + bitfield_len - 1] = 0xff << (8 - t->npieces % 8);
+    }
+    p += 5 + bitfield_len;
+    put_be32(p, 1);
+    p[4] = MSG_UNCHOKE;
+    peer->torrent = t;
+    return 0;
+}
+
+/*
+ * Handle one message (without its length prefix).  Returns 0, or -1 to
+ * drop the peer.
+ */
+static int handle_message(peer_t *peer, const uint8_t *msg, uint32_t len) {
+    const torrent_t *t = peer->torrent;
+    if (len == 0) {
+        // keep-alive
+        return 0;
+    }
+    if ((msg[0] == MSG_REQUEST || msg[0] == MSG_CANCEL) && len != 13) {
+        return -1;
+    }
+    request_t req;
+    if (msg[0] == MSG_REQUEST || msg[0] == MSG_CANCEL) {
+        req.index = get_be32(msg + 1);
+        req.begin = get_be32(msg + 5);
+        req.length = get_be32(msg + 9);
+    }
+    int i;
+    switch (msg[0]) {
+    case MSG_REQUEST:
+        if (req.index >= t->npieces || req.length == 0 || req.length > REQUEST_BLOCK_MAX) {
+            return -1;
+        }
+        uint64_t offset = (uint64_t)req.index * t->piece_len + req.begin;
+        uint64_t piece_end = (uint64_t)req.index * t->piece_len + t->piece_len;
+        if (piece_end > t->size) {
+            piece_end = t->size;
+        }
+        if (offset + req.length > piece_end) {
+            return -1;
+        }
+        if (peer->queue_len == REQUESTS_MAX) {
+            return -1;
+        }
+        peer->queue[(peer->queue_head + peer->queue_len) % REQUESTS_MAX] = req;
+        peer->queue_len++;
+        return 0;
+    case MSG_CANCEL:
+        // only requests not yet batched can be taken back
+        for (i=0; i<peer->queue_len; i++) {
+            request_t *q = &peer->queue[(peer->queue_head + i) % REQUESTS_MAX];
+            if (q->index == req.index && q->begin == req.begin && q->length == req.length) {
+                for (; i<peer->queue_len-1; i++) {
+                    peer->queue[(peer->queue_head + i) % REQUESTS_MAX] =
+                        peer->queue[(peer->queue_head + i + 1) % REQUESTS_MAX];
+                }
+                peer->queue_len--;
+                break;
+            }
+        }
+        return 0;
+    default:
+        // interest, haves and anything else make no difference to a seed
+        return 0;
+    }
+}
+
+/*
+ * Consume whatever complete handshake parts and messages have arrived.
+ * Returns 0, or -1 to drop the peer.
+ */
+static int parse_input(peer_t *peer) {
+    size_t pos = 0;
+    for (;;) {
+        size_t avail = peer->in_len - pos;
+        if (peer->state == PEER_HANDSHAKE) {
+            // answer as soon as we know the torrent; some clients wait
+            // for that before sending their peer id
+            if (avail < HANDSHAKE_LEN) {
+                break;
+            }
+            const uint8_t *hs = peer->in + pos;
+            if (memcmp(hs, PROTOCOL, PROTOCOL_LEN) != 0) {
+                return -1;
+            }
+            const torrent_t *t = find_torrent(hs + PROTOCOL_LEN + 8);
+            if (t == NULL || start_peer(peer, t) != 0) {
+                return -1;
+            }
+            pos += HANDSHAKE_LEN;
+            peer->state = PEER_ID;
+        } else if (peer->state == PEER_ID) {
+            if (avail < PEER_ID_LEN) {
+                break;
+            }
+            pos += PEER_ID_LEN;
+            peer->state = PEER_ACTIVE;
+        } else {
+            if (avail < 4) {
+                break;
+            }
+            uint32_t len = get_be32(peer->in + pos);
+            if (len > MESSAGE_MAX) {
+                return -1;
+            }
+            if (avail < 4 + len) {
+                break;
+            }
+            if (handle_message(peer, peer->in + pos + 4, len) != 0) {
+                return -1;
+            }
+            pos += 4 + len;
+        }
+    }
+    memmove(peer->in, peer->in + pos, peer->in_len - pos);
+    peer->in_len -= pos;
+    return 0;
+}
+
+/*
+ * Collect zerocopy completions from the socket's error queue.  TCP
+ * completes send calls in order, so the highest one done is enough.
+ * Returns 0, or -1 on error.
+ */
+static int reap_completions(peer_t *peer) {
+    for (;;) {
+        char control[128];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(peer->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN ? 0 : -1;
+        }
+        struct cmsghdr *cm;
+        for (cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+            struct sock_extended_err *serr = (struct sock_extended_err *)CMSG_DATA(cm);
+            if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY || serr->ee_errno != 0) {
+                continue;
+            }
+            if (serr->ee_data + 1 > peer->completed) {
+                peer->completed = serr->ee_data + 1;
+            }
+        }
+    }
+}
+
+/*
+ * Generate as many queued blocks as fit into a batch, each behind its
+ * piece message header.
+ */
+static int fill_batch(peer_t *peer, batch_t *b) {
+    const torrent_t *t = peer->torrent;
+    if (b->buf == NULL && (b->buf = malloc(BATCH_SIZE)) == NULL) {
+        return -1;
+    }
+    b->len = 0;
+    b->pos = 0;
+    while (peer->queue_len) {
+        request_t *req = &peer->queue[peer->queue_head];
+        if (b->len + PIECE_HEADER_LEN + req->length > BATCH_SIZE) {
+            break;
+        }
+        char *p = b->buf + b->len;
+        put_be32(p, 9 + req->length);
+        p[4] = MSG_PIECE;
+        put_be32(p + 5, req->index);
+        put_be32(p + 9, req->begin);
+        get_range(p + PIECE_HEADER_LEN, req->length,
+            (uint64_t)req->index * t->piece_len + req->begin, t->stream.seed);
+        b->len += PIECE_HEADER_LEN + req->length;
+        peer->queue_head = (peer->queue_head + 1) % REQUESTS_MAX;
+        peer->queue_len--;
+    }
+    return 0;
+}
+
+/*
+ * Send as much as the socket will take.  Returns 0, or -1 to drop the
+ * peer.
+ */
+static int send_output(peer_t *peer) {
+    while (peer->ctl) {
+        ssize_t n = send(peer->fd, peer->ctl + peer->ctl_pos, peer->ctl_len - peer->ctl_pos,
+            MSG_NOSIGNAL);
+        if (n < 0) {
+            return errno == EAGAIN || errno == EINTR ? 0 : -1;
+        }
+        peer->ctl_pos += n;
+        if (peer->ctl_pos == peer->ctl_len) {
+            free(peer->ctl);
+            peer->ctl = NULL;
+        }
+    }
+    if (peer->state != PEER_ACTIVE) {
+        return 0;
+    }
+    for (;;) {
+        batch_t *b = &peer->batches[peer->batch];
+        if (b->pos == b->len) {
+            if (peer->queue_len == 0) {
+                return 0;
+            }
+            // wait (for EPOLLERR) until the kernel lets go of the buffer
+            if (peer->zerocopy && peer->completed < b->calls &&
+                (reap_completions(peer) != 0 || peer->completed < b->calls)) {
+                return 0;
+            }
+            if (fill_batch(peer, b) != 0) {
+                return -1;
+            }
+        }
+        ssize_t n = send(peer->fd, b->buf + b->pos, b->len - b->pos,
+            MSG_NOSIGNAL | (peer->zerocopy ? MSG_ZEROCOPY : 0));
+        if (n < 0 && errno == ENOBUFS && peer->zerocopy) {
+            // out of pinned-page budget; wait for completions if there
+            // are any to come, or else give up on zerocopy
+            if (peer->completed < peer->calls) {
+                peer->waiting = peer->completed + 1;
+                return 0;
+            }
+            peer->zerocopy = 0;
+            continue;
+        }
+        if (n < 0) {
+            return errno == EAGAIN || errno == EINTR ? 0 : -1;
+        }
+        if (peer->zerocopy) {
+            peer->calls++;
+            b->calls = peer->calls;
+        }
+        b->pos += n;
+        if (b->pos == b->len) {
+            peer->batch = (peer->batch + 1) % SEND_BATCHES;
+        }
+    }
+}
+
+/*
+ * Whether there's output which the socket being writable would let us
+ * make progress on, rather than having to wait for zerocopy completions
+ * (which are signalled by EPOLLERR).
+ */
+static int want_output(const peer_t *peer) {
+    if (peer->ctl) {
+        return 1;
+    }
+    const batch_t *b = &peer->batches[peer->batch];
+    if (b->pos < b->len) {
+        return !peer->zerocopy || peer->completed >= peer->waiting;
+    }
+    return peer->queue_len && (!peer->zerocopy || peer->completed >= b->calls);
+}
+
+static int service(peer_t *peer, uint32_t events) {
+    if ((events & EPOLLERR) && peer->zerocopy && reap_completions(peer) != 0) {
+        return -1;
+    }
+    for (;;) {
+        ssize_t n = read(peer->fd, peer->in + peer->in_len, sizeof(peer->in) - peer->in_len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && errno == EAGAIN) {
+            break;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        peer->in_len += n;
+        if (parse_input(peer) != 0) {
+            return -1;
+        }
+    }
+    if (send_output(peer) != 0) {
+        return -1;
+    }
+    uint32_t wanted = EPOLLIN | (want_output(peer) ? EPOLLOUT : 0);
+    if (wanted != peer->events) {
+        struct epoll_event ev = { wanted, { .ptr = peer } };
+        epoll_ctl(peer->epfd, EPOLL_CTL_MOD, peer->fd, &ev);
+        peer->events = wanted;
+    }
+    return 0;
+}
+
+static void close_peer(peer_t *peer) {
+    int i;
+    close(peer->fd);
+    // closing the socket releases any pages still pinned for zerocopy
+    for (i=0; i<SEND_BATCHES; i++) {
+        free(peer->batches[i].buf);
+    }
+    free(peer->ctl);
+    free(peer);
+}
+
+static void *seed_thread(void *arg) {
+    int lfd = *(int *)arg;
+    int epfd = epoll_create1(0);
+    if (epfd < 0) {
+        perror("testfuse-seed: epoll_create1");
+        exit(EXIT_FAILURE);
+    }
+    // the listening socket is shared, and only one thread is woken for
+    // each connection
+    struct epoll_event lev = { EPOLLIN | EPOLLEXCLUSIVE, { .ptr = NULL } };
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, lfd, &lev) != 0) {
+        perror("testfuse-seed: epoll_ctl");
+        exit(EXIT_FAILURE);
+    }
+    struct epoll_event events[EPOLL_EVENTS];
+    for (;;) {
+        int n = epoll_wait(epfd, events, EPOLL_EVENTS, -1);
+        int i;
+        for (i=0; i<n; i++) {
+            if (events[i].data.ptr == NULL) {
+                int fd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if (fd < 0) {
+                    continue;
+                }
+                peer_t *peer = calloc(1, sizeof(peer_t));
+                if (peer == NULL) {
+                    close(fd);
+                    continue;
+                }
+                int one = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                peer->zerocopy = setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
+                peer->fd = fd;
+                peer->epfd = epfd;
+                peer->events = EPOLLIN;
+                struct epoll_event ev = { EPOLLIN, { .ptr = peer } };
+                epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+                continue;
+            }
+            peer_t *peer = events[i].data.ptr;
+            if (service(peer, events[i].events) != 0) {
+                close_peer(peer);
+            }
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Append formatted text to buf, which holds *len of size bytes.
+ * Returns 0, or -1 (leaving *len alone) if the text doesn't fit.
+ */
+static int append(char *buf, size_t size, size_t *len, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf + *len, size - *len, fmt, ap);
+    va_end(ap);
+    if (n < 0 || (size_t)n >= size - *len) {
+        return -1;
+    }
+    *len += n;
+    return 0;
+}
+
+/*
+ * Announce every file to an HTTP tracker now and then, so that peers
+ * can find us.  Failures are reported and retried later.
+ */
+static void *announce_thread(void *arg) {
+    const char *url = arg;
+    char host[256], port[16] = "80";
+    const char *path;
+    if (strncmp(url, "http://", 7) != 0 ||
+        (path = strchr(url + 7, '/')) == NULL || (size_t)(path - url - 7) >= sizeof(host)) {
+        fprintf(stderr, "warning: can't announce to %s; only http:// trackers are supported\n", url);
+        return NULL;
+    }
+    memcpy(host, url + 7, path - url - 7);
+    host[path - url - 7] = '\0';
+    char *colon = strrchr(host, ':');
+    if (colon && !strchr(colon, ']')) {
+        snprintf(port, sizeof(port), "%s", colon + 1);
+        *colon = '\0';
+    }
+    const char *event = "&event=started";
+    for (;;) {
+        unsigned int interval = 1800;
+        seed_file_t *file;
+        for (file=files; file!=NULL; file=file->next) {
+            char request[ANNOUNCE_REQUEST_MAX];
+            size_t len = 0;
+            int i, err = append(request, sizeof(request), &len, "GET %s%cinfo_hash=", path,
+                strchr(path, '?') ? '&' : '?');
+            for (i=0; i<TORRENT_HASH_SIZE; i++) {
+                err |= append(request, sizeof(request), &len, "%%%02x", file->torrent.info_hash[i]);
+            }
+            err |= append(request, sizeof(request), &len, "&peer_id=");
+            for (i=0; i<PEER_ID_LEN; i++) {
+                err |= append(request, sizeof(request), &len, "%%%02x", peer_id[i]);
+            }
+            err |= append(request, sizeof(request), &len,
+                "&port=%s&uploaded=0&downloaded=0&left=0&compact=1%s HTTP/1.0\r\n"
+                "Host: %s\r\n\r\n", listen_port, event, host);
+            if (err) {
+                fprintf(stderr, "warning: announce request to %s is too long\n", url);
+                return NULL;
+            }
+
+            char response[4096];
+            size_t got = 0;
+            int fd = net_connect(host, port, SOCK_STREAM);
+            if (fd >= 0 && net_write_full(fd, request, len) == 0) {
+                ssize_t n;
+                while (got < sizeof(response) - 1 &&
+                    (n = read(fd, response + got, sizeof(response) - 1 - got)) > 0) {
+                    got += n;
+                }
+            }
+            if (fd >= 0) {
+                close(fd);
+            }
+            response[got] = '\0';
+            char *failure = memmem(response, got, "14:failure reason", 17);
+            char *tracker_interval = memmem(response, got, "8:intervali", 11);
+            if (failure || got == 0) {
+                fprintf(stderr, "warning: announcing %s to %s failed\n", file->name, url);
+            } else if (tracker_interval && atoi(tracker_interval + 11) > 0) {
+                interval = atoi(tracker_interval + 11);
+            }
+        }
+        event = "";
+        sleep(interval);
+    }
+    return NULL;
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: testfuse-seed [options] filename,size,seed[/...]\n");
+    fprintf(stderr, "    -p PORT     listen for peers on this port (default " SEED_PORT ")\n");
+    fprintf(stderr, "    -t N        serve peers with N threads (default: one per CPU)\n");
+    fprintf(stderr, "    -l SIZE     piece length (default: by file size)\n");
+    fprintf(stderr, "    -a URL      announce to this HTTP tracker\n");
+    fprintf(stderr, "    -o DIR      write each file's metainfo to DIR/<name>.torrent\n");
+    fprintf(stderr, "    -c PATH     digest cache file (default ~/.cache/testfuse-cache)\n");
+}
+
+int main(int argc, char **argv) {
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    uint64_t piece_length = 0;
+    const char *announce = NULL;
+    const char *torrent_dir = NULL;
+    const char *hashcache = NULL;
+    char *endptr;
+    int opt;
+    while ((opt = getopt(argc, argv, "p:t:l:a:o:c:")) != -1) {
+        switch (opt) {
+        case 'p':
+            listen_port = optarg;
+            break;
+        case 't':
+            threads = atoi(optarg);
+            break;
+        case 'l':
+            piece_length = parse_size(optarg, &endptr);
+            if (*endptr != '\0' || piece_length < 16*1024 || piece_length > 1U<<31 ||
+                (piece_length & (piece_length - 1)) != 0) {
+                fprintf(stderr, "error: piece length must be a power of two of at least 16K\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'a':
+            announce = optarg;
+            if (strlen(announce) > ANNOUNCE_URL_MAX) {
+                fprintf(stderr, "error: announce URL is too long\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'o':
+            torrent_dir = optarg;
+            break;
+        case 'c':
+            hashcache = optarg;
+            break;
+        default:
+            usage();
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (argc - optind != 1 || threads < 1) {
+        usage();
+        exit(EXIT_FAILURE);
+    }
+    spec_t *spec = parse_spec_list(argv[optind]);
+    if (spec == NULL) {
+        exit(EXIT_FAILURE);
+    }
+
+    // share piece hashes with testfuse through its cache
+    char path[PATH_MAX];
+    if (hashcache == NULL && getenv("HOME")) {
+        snprintf(path, sizeof(path), "%s/.cache", getenv("HOME"));
+        mkdir(path, 0700);
+        strncat(path, "/testfuse-cache", sizeof(path)-strlen(path)-1);
+        hashcache = path;
+    }
+    if (hashcache && cache_open(hashcache) != 0) {
+        fprintf(stderr, "warning: can't open the cache %s\n", hashcache);
+    }
+
+    // an Azureus-style peer id: client, version, and random digits
+    char id[PEER_ID_LEN+1];
+    snprintf(id, sizeof(id), "-TF0001-%012" PRIu64, (uint64_t)(net_session_id() % 1000000000000ULL));
+    memcpy(peer_id, id, PEER_ID_LEN);
+
+    seed_file_t **tail = &files;
+    for (; spec != NULL; spec = spec->next) {
+        seed_file_t *file = calloc(1, sizeof(seed_file_t));
+        if (file == NULL) {
+            fprintf(stderr, "error: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        file->name = spec->name;
+        uint32_t len = piece_length ? piece_length : torrent_piece_length(spec->size);
+        gen_stream_t stream = GEN_STREAM(spec->seed);
+        if (torrent_init(&file->torrent, spec->name, spec->size, &stream, len, announce) != 0 ||
+            torrent_hash(&file->torrent, sysconf(_SC_NPROCESSORS_ONLN)) != 0) {
+            fprintf(stderr, "error: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        *tail = file;
+        tail = &file->next;
+
+        char hex[2*TORRENT_HASH_SIZE+1];
+        int i;
+        for (i=0; i<TORRENT_HASH_SIZE; i++) {
+            sprintf(hex + 2*i, "%02x", file->torrent.info_hash[i]);
+        }
+        printf("%s magnet:?xt=urn:btih:%s&dn=%s\n", spec->name, hex, spec->name);
+        if (torrent_dir) {
+            char torrent_path[PATH_MAX];
+            snprintf(torrent_path, sizeof(torrent_path), "%s/%s.torrent", torrent_dir, spec->name);
+            FILE *f = fopen(torrent_path, "w");
+            if (f == NULL || fwrite(file->torrent.data, 1, file->torrent.len, f) != file->torrent.len ||
+                fclose(f) != 0) {
+                fprintf(stderr, "error: can't write %s\n", torrent_path);
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    fflush(stdout);
+
+    int lfd = net_listen(listen_port, SOCK_STREAM);
+    if (lfd < 0) {
+        exit(EXIT_FAILURE);
+    }
+    fcntl(lfd, F_SETFL, O_NONBLOCK);
+    pthread_t tid;
+    if (announce && pthread_create(&tid, NULL, announce_thread, (void *)announce) == 0) {
+        pthread_detach(tid);
+    }
+    int i;
+    for (i=1; i<threads; i++) {
+        if (pthread_create(&tid, NULL, seed_thread, &lfd) != 0) {
+            fprintf(stderr, "error: can't start a peer thread\n");
+            exit(EXIT_FAILURE);
+        }
+        pthread_detach(tid);
+    }
+    seed_thread(&lfd);
+    exit(EXIT_FAILURE);
+}
@@ -0,0 +1,388 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Verify that a file or block device holds the content of a testfuse
+ * stream, without mounting testfuse or hashing either side.  The data
+ * is read across several threads and compared against content that is
+ * regenerated on the fly, reporting the mismatched byte ranges.
+ *
+ * Usage:
+ *     ./testfuse-verify [-t threads] [-d] [-v] <path> <size>,<seed>
+ *
+ * The exit status is 0 if the content matches, 1 if it doesn't, and 2
+ * if it couldn't be checked.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "gen.h"
+#include "spec.h"
+
+// from <linux/fs.h>, which clashes with our BLOCK_SIZE
+#ifndef BLKGETSIZE64
+#define BLKGETSIZE64 _IOR(0x12, 114, size_t)
+#endif
+
+#define EXIT_MISMATCH 1
+#define EXIT_ERROR 2
+
+// each thread claims this much of the data at a time
+#define CHUNK_SIZE (4*1024*1024)
+
+// matching runs shorter than this don't split a mismatched extent, so
+// that bytes which match by chance in corrupt data aren't reported
+#define EXTENT_GAP 64
+
+// O_DIRECT buffers and transfer sizes are aligned to this
+#define DIRECT_ALIGN 4096
+
+// extents listed without -v
+#define EXTENTS_SHOWN 20
+
+typedef struct extent_s {
+    uint64_t start;
+    uint64_t end;
+} extent_t;
+
+typedef struct verify_s {
+    int fd;
+    const char *map;
+    uint64_t size;
+    uint32_t seed;
+    uint64_t nchunks;
+    uint64_t next_chunk;
+    int error;
+    pthread_mutex_t lock;
+    extent_t *extents;
+    size_t nextents;
+    size_t extents_alloc;
+} verify_t;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: testfuse-verify [-t threads] [-d] [-v] <path> <size>,<seed>\n");
+    fprintf(stderr, "    -t N    verify with N threads (default: one per CPU)\n");
+    fprintf(stderr, "    -d      read with O_DIRECT rather than mmap\n");
+    fprintf(stderr, "    -v      list every mismatched extent\n");
+}
+
+static void add_extent(verify_t *v, uint64_t start, uint64_t end) {
+    pthread_mutex_lock(&v->lock);
+    if (v->nextents == v->extents_alloc) {
+        size_t alloc = v->extents_alloc ? 2*v->extents_alloc : 64;
+        extent_t *extents = realloc(v->extents, alloc*sizeof(extent_t));
+        if (extents == NULL) {
+            fprintf(stderr, "error: out of memory\n");
+            exit(EXIT_ERROR);
+        }
+        v->extents = extents;
+        v->extents_alloc = alloc;
+    }
+    v->extents[v->nextents].start = start;
+    v->extents[v->nextents].end = end;
+    v->nextents++;
+    pthread_mutex_unlock(&v->lock);
+}
+
+/*
+ * Find the mismatched extents within a chunk which is known to differ,
+ * block by block, and record them.
+ */
+static void scan_chunk(verify_t *v, const char *data, uint64_t offset, size_t len) {
+    char expected[BLOCK_SIZE];
+    uint64_t start = 0, end = 0;
+    int open = 0;
+    size_t pos = 0;
+    while (pos < len) {
+        uint32_t block = (offset + pos) >> BLOCK_SHIFT;
+        size_t bytes = len - pos < BLOCK_SIZE ? len - pos : BLOCK_SIZE;
+        if (bytes == BLOCK_SIZE && verify_blocks(block, 1, data + pos, v->seed)) {
+            pos += bytes;
+            continue;
+        }
+        get_block(block, expected, v->seed);
+        size_t i;
+        for (i=0; i<bytes; i++) {
+            if (data[pos+i] == expected[i]) {
+                continue;
+            }
+            uint64_t at = offset + pos + i;
+            if (open && at - end < EXTENT_GAP) {
+                end = at + 1;
+            } else {
+                if (open) {
+                    add_extent(v, start, end);
+                }
+                start = at;
+                end = at + 1;
+                open = 1;
+            }
+        }
+        pos += bytes;
+    }
+    if (open) {
+        add_extent(v, start, end);
+    }
+}
+
+/*
+ * Check one chunk, with a fused generate-and-compare over its whole
+ * blocks in the common case that it matches.
+ */
+static void verify_chunk(verify_t *v, const char *data, uint64_t offset, size_t len) {
+    uint32_t block = offset >> BLOCK_SHIFT;
+    uint32_t count = len >> BLOCK_SHIFT;
+    size_t tail = len & OFFSET_MASK;
+    if (verify_blocks(block, count, data, v->seed)) {
+        if (tail == 0) {
+            return;
+        }
+        char expected[BLOCK_SIZE];
+        get_block(block + count, expected, v->seed);
+        if (memcmp(data + ((size_t)count << BLOCK_SHIFT), expected, tail) == 0) {
+            return;
+        }
+    }
+    scan_chunk(v, data, offset, len);
+}
+
+static void *verify_thread(void *arg) {
+    verify_t *v = arg;
+    char *buf = NULL;
+    if (v->map == NULL) {
+        if (posix_memalign((void **)&buf, DIRECT_ALIGN, CHUNK_SIZE) != 0) {
+            fprintf(stderr, "error: out of memory\n");
+            exit(EXIT_ERROR);
+        }
+    }
+    for (;;) {
+        uint64_t chunk = __atomic_fetch_add(&v->next_chunk, 1, __ATOMIC_RELAXED);
+        if (chunk >= v->nchunks || __atomic_load_n(&v->error, __ATOMIC_RELAXED)) {
+            break;
+        }
+        uint64_t offset = chunk * CHUNK_SIZE;
+        size_t len = v->size - offset < CHUNK_SIZE ? v->size - offset : CHUNK_SIZE;
+        if (v->map) {
+            verify_chunk(v, v->map + offset, offset, len);
+            continue;
+        }
+        // O_DIRECT transfers must be whole sectors, even at the end
+        size_t want = (len + DIRECT_ALIGN - 1) & ~(size_t)(DIRECT_ALIGN - 1);
+        size_t got = 0;
+        while (got < len) {
+            ssize_t n = pread(v->fd, buf + got, want - got, offset + got);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                fprintf(stderr, "error: read at offset %" PRIu64 ": %s\n",
+                    offset + got, n < 0 ? strerror(errno) : "unexpected end of file");
+                __atomic_store_n(&v->error, 1, __ATOMIC_RELAXED);
+                break;
+            }
+            got += n;
+        }
+        if (got >= len) {
+            verify_chunk(v, buf, offset, len);
+        }
+    }
+    free(buf);
+    return NULL;
+}
+
+static int extent_cmp(const void *a, const void *b) {
+    const extent_t *ea = a, *eb = b;
+    return ea->start < eb->start ? -1 : ea->start > eb->start;
+}
+
+/*
+ * Sort the extents found by the threads and join those which meet
+ * across chunk boundaries.
+ */
+static void merge_extents(verify_t *v) {
+    size_t i, n = 0;
+    qsort(v->extents, v->nextents, sizeof(extent_t), extent_cmp);
+    for (i=0; i<v->nextents; i++) {
+        if (n && v->extents[i].start - v->extents[n-1].end < EXTENT_GAP) {
+            v->extents[n-1].end = v->extents[i].end;
+        } else {
+            v->extents[n++] = v->extents[i];
+        }
+    }
+    v->nextents = n;
+}
+
+int main(int argc, char **argv) {
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int direct = 0;
+    int verbose = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:dv")) != -1) {
+        switch (opt) {
+        case 't':
+            threads = atoi(optarg);
+            break;
+        case 'd':
+            direct = 1;
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        default:
+            usage();
+            exit(EXIT_ERROR);
+        }
+    }
+    if (argc - optind != 2 || threads < 1) {
+        usage();
+        exit(EXIT_ERROR);
+    }
+    const char *path = argv[optind];
+
+    // parse the <size>,<seed> spec
+    verify_t v;
+    memset(&v, 0, sizeof(v));
+    char *endptr;
+    v.size = parse_size(argv[optind+1], &endptr);
+    if (v.size == 0 || *endptr != ',') {
+        fprintf(stderr, "error: invalid size\n");
+        exit(EXIT_ERROR);
+    }
+    if (parse_seed(endptr+1, &v.seed) != 0) {
+        fprintf(stderr, "error: invalid seed\n");
+        exit(EXIT_ERROR);
+    }
+
+    v.fd = open(path, O_RDONLY | (direct ? O_DIRECT : 0));
+    if (v.fd < 0) {
+        fprintf(stderr, "error: %s: %s\n", path, strerror(errno));
+        exit(EXIT_ERROR);
+    }
+    struct stat st;
+    uint64_t actual;
+    if (fstat(v.fd, &st) != 0) {
+        fprintf(stderr, "error: %s: %s\n", path, strerror(errno));
+        exit(EXIT_ERROR);
+    }
+    if (S_ISBLK(st.st_mode)) {
+        if (ioctl(v.fd, BLKGETSIZE64, &actual) != 0) {
+            fprintf(stderr, "error: %s: %s\n", path, strerror(errno));
+            exit(EXIT_ERROR);
+        }
+    } else if (S_ISREG(st.st_mode)) {
+        actual = st.st_size;
+    } else {
+        fprintf(stderr, "error: %s: not a file or block device\n", path);
+        exit(EXIT_ERROR);
+    }
+
+    // a device may be larger than the stream written to it, but a file
+    // should be the same size; either way, check what's there
+    int size_mismatch = 0;
+    if (actual < v.size || (S_ISREG(st.st_mode) && actual != v.size)) {
+        fprintf(stderr, "%s: size is %" PRIu64 ", expected %" PRIu64 "\n",
+            path, actual, v.size);
+        size_mismatch = 1;
+        if (actual < v.size) {
+            v.size = actual;
+        }
+    }
+
+    if (v.size && !direct) {
+        v.map = mmap(NULL, v.size, PROT_READ, MAP_SHARED, v.fd, 0);
+        if (v.map == MAP_FAILED) {
+            fprintf(stderr, "error: mmap %s: %s\n", path, strerror(errno));
+            exit(EXIT_ERROR);
+        }
+        madvise((void *)v.map, v.size, MADV_SEQUENTIAL);
+    }
+    v.nchunks = (v.size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    if (threads > v.nchunks) {
+        threads = v.nchunks ? v.nchunks : 1;
+    }
+    pthread_mutex_init(&v.lock, NULL);
+
+    double start = now();
+    pthread_t *tids = malloc(threads * sizeof(pthread_t));
+    if (tids == NULL) {
+        fprintf(stderr, "error: out of memory\n");
+        exit(EXIT_ERROR);
+    }
+    int i;
+    for (i=0; i<threads; i++) {
+        if (pthread_create(&tids[i], NULL, verify_thread, &v) != 0) {
+            fprintf(stderr, "error: can't start verify threads\n");
+            exit(EXIT_ERROR);
+        }
+    }
+    for (i=0; i<threads; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    double elapsed = now() - start;
+    if (v.error) {
+        exit(EXIT_ERROR);
+    }
+
+    printf("verified %" PRIu64 " bytes in %.3f s, %.2f GB/s\n",
+        v.size, elapsed, elapsed > 0 ? v.size / elapsed / 1e9 : 0);
+    if (v.nextents == 0) {
+        if (size_mismatch) {
+            exit(EXIT_MISMATCH);
+        }
+        printf("content matches\n");
+        return 0;
+    }
+
+    merge_extents(&v);
+    uint64_t total = 0;
+    size_t e;
+    for (e=0; e<v.nextents; e++) {
+        total += v.extents[e].end - v.extents[e].start;
+    }
+    printf("first mismatch at offset %" PRIu64 "\n", v.extents[0].start);
+    printf("%zu mismatched extents, %" PRIu64 " bytes\n", v.nextents, total);
+    for (e=0; e<v.nextents && (verbose || e<EXTENTS_SHOWN); e++) {
+        printf("    %" PRIu64 "-%" PRIu64 " (%" PRIu64 " bytes)\n",
+            v.extents[e].start, v.extents[e].end - 1,
+            v.extents[e].end - v.extents[e].start);
+    }
+    if (e < v.nextents) {
+        printf("    ... (use -v to list all)\n");
+    }
+    exit(EXIT_MISMATCH);
+}
@@ -52,251 +52,103 @@
  * The file-spec-list argument is a slash-delimited list of file
  * specifications, each of which is a comma-delimited tuple indicating
  * the file name, the file size, and a 32-bit seed value.  Files of the
- * same size and seed value will always be identical.
+ * same size and seed value will always be identical.  An optional
+ * fourth field names a generator plugin to produce the content instead
+ * (see generator.h).
  */
 
-#define FUSE_USE_VERSION 26
-#include <fuse.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-#include <errno.h>
-#include <fcntl.h>
-#include <inttypes.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <limits.h>
+#include <sys/stat.h>
 
-/* uncomment this only to debug edge conditions dealing with blocks */
-//#define SMALL_BLOCK_TEST
-
-#ifdef SMALL_BLOCK_TEST
- #define BLOCK_SIZE (16)
- #define BLOCK_SHIFT 4
- #define OFFSET_MASK (BLOCK_SIZE-1)
-#else
- #define BLOCK_SIZE (64*1024)
- #define BLOCK_SHIFT 16
- #define OFFSET_MASK (BLOCK_SIZE-1)
-#endif
-
-/*
- * A testfile_t structure details a specific test file which will be
- * visible in the filesystem.
- */
-typedef struct testfile_s {
-    char *name;
-    uint64_t size;
-    uint32_t seed;
-    struct testfile_s *next;
-} testfile_t;
-testfile_t *testfile_list = NULL;
+#include "fs.h"
+#include "spec.h"
+#include "node.h"
+#include "prio.h"
 
 /*
- * FUSE operation for delivering stat(2) data about our files.
+ * Options which are parsed out of the FUSE command line (-o name=value).
  */
-static int fop_getattr(const char *path, struct stat *st) {
-    int ret = 0;
-
-    memset(st, 0, sizeof(struct stat));
-    if (strcmp(path, "/") == 0) {
-        st->st_mode = S_IFDIR | 0755;
-        st->st_nlink = 2;
-        return 0;
-    }
-
-    // skip the leading slash
-    if (path[0] == '/') {
-        path++;
-    }
-
-    testfile_t *testfile;
-    for (testfile = testfile_list; testfile!=NULL; testfile=testfile->next) {
-        if (strcmp(path, testfile->name) == 0) {
-            st->st_mode = S_IFREG | 0444;
-            st->st_nlink = 1;
-            st->st_size = testfile->size;
-            return ret;
-        }
-    }
-
-    return -ENOENT;
-}
-
-/*
- * The FUSE operation for delivering the directory list.
- */
-static int fop_readdir(
-    const char *path,
-    void *buf,
-    fuse_fill_dir_t filler,
-    off_t offset,
-    struct fuse_file_info *fi
-) {
-    if (strcmp(path, "/") != 0) {
-        return -ENOENT;
-    }
-
-    filler(buf, ".", NULL, 0);
-    filler(buf, "..", NULL, 0);
-    testfile_t *testfile;
-    for (testfile = testfile_list; testfile!=NULL; testfile=testfile->next) {
-        filler(buf, testfile->name, NULL, 0);
-    }
-
-    return 0;
-}
-
-/*
- * The FUSE operation for open().
- */
-static int fop_open(const char *path, struct fuse_file_info *fi) {
-    // skip the leading slash
-    if (path[0] == '/') {
-        path++;
-    }
+typedef struct testfuse_config_s {
+    char *hashcache;
+    unsigned int hash_threads;
+    unsigned int read_threads;
+    char *bulk_size;
+    unsigned int bulk_threads;
+    char *fair_key;
+    char *fair_weights;
+    char *piece_length;
+    char *announce;
+    char *ring;
+    char *plugin_dir;
+    char *numa_nodes;
+} testfuse_config_t;
+static testfuse_config_t config;
+
+static const struct fuse_opt testfuse_opts[] = {
+    { "hashcache=%s", offsetof(testfuse_config_t, hashcache), 0 },
+    { "hash_threads=%u", offsetof(testfuse_config_t, hash_threads), 0 },
+    { "read_threads=%u", offsetof(testfuse_config_t, read_threads), 0 },
+    { "bulk_size=%s", offsetof(testfuse_config_t, bulk_size), 0 },
+    { "bulk_threads=%u", offsetof(testfuse_config_t, bulk_threads), 0 },
+    { "fair_key=%s", offsetof(testfuse_config_t, fair_key), 0 },
+    { "fair_weights=%s", offsetof(testfuse_config_t, fair_weights), 0 },
+    { "piece_length=%s", offsetof(testfuse_config_t, piece_length), 0 },
+    { "announce=%s", offsetof(testfuse_config_t, announce), 0 },
+    { "ring=%s", offsetof(testfuse_config_t, ring), 0 },
+    { "plugin_dir=%s", offsetof(testfuse_config_t, plugin_dir), 0 },
+    { "numa_nodes=%s", offsetof(testfuse_config_t, numa_nodes), 0 },
+    FUSE_OPT_END
+};
 
-    testfile_t *testfile;
-    for (testfile = testfile_list; testfile!=NULL; testfile=testfile->next) {
-        if (strcmp(path, testfile->name) == 0) {
-            if ((fi->flags & 3) != O_RDONLY) {
-                return -EACCES;
-            } else {
-                return 0;
-            }
-        }
-    }
-    return -ENOENT;
+void usage() {
+    fprintf(stderr, "usage: testfuse filename,size,seed[,generator][/...] [-o options] /mnt/mntpoint\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "testfuse options:\n");
+    fprintf(stderr, "    -o hashcache=PATH      digest cache file (default ~/.cache/testfuse-cache)\n");
+    fprintf(stderr, "    -o hash_threads=N      background digest threads (default: one per CPU)\n");
+    fprintf(stderr, "    -o read_threads=N      threads helping with large reads (default: CPUs - 1)\n");
+    fprintf(stderr, "    -o bulk_size=SIZE      reads this large queue for bulk slots (default 128K)\n");
+    fprintf(stderr, "    -o bulk_threads=N      bulk reads served, and threads generating them, at once (default: CPUs / 2)\n");
+    fprintf(stderr, "    -o fair_key=pid|uid    share bulk reads fairly by process or by user (default pid)\n");
+    fprintf(stderr, "    -o fair_weights=LIST   weights of pids or uids, as ID:WEIGHT,... (default 1 each)\n");
+    fprintf(stderr, "    -o piece_length=SIZE   .torrent piece length (default: by file size)\n");
+    fprintf(stderr, "    -o announce=URL        .torrent tracker URL (default: none)\n");
+    fprintf(stderr, "    -o ring=PATH           serve shared-memory rings on this socket\n");
+    fprintf(stderr, "    -o plugin_dir=DIR      where to find generator plugins (default: beside testfuse)\n");
+    fprintf(stderr, "    -o numa_nodes=LIST     run on, and allocate from, these NUMA nodes (e.g. 0 or 0-1)\n");
 }
 
 /*
- * Combine the global seed, file seed, and the block number using a
- * CRC32 technique such that even a small change in one of the values
- * (i.e., file_seed=1 vs. file_seed=2, or the block number incrementing)
- * will result in a radical change to the output.
+ * Identify the client making the current request.
  */
-static uint32_t crc(uint32_t global_seed, uint32_t file_seed, uint32_t block) {
-    static const uint32_t polynomial = 0x04C11DB7U;
-    static const uint32_t msb_mask = 0x80000000U;
-    uint32_t input = global_seed;
-    uint32_t input_next = file_seed;
-    uint32_t divisor = msb_mask | (polynomial>>1);
-    uint32_t divisor_next = (polynomial&0x01)<<31;
-    int i;
-    for (i=0; i<(3*sizeof(uint32_t)*8); i++) {
-        // refill next
-        if (i == 1*sizeof(uint32_t)*8) {
-            input_next = block;
-        }
-        // xor
-        if (input & msb_mask) {
-            input ^= divisor;
-            input_next ^= divisor_next;
-        }
-        // shift
-        input <<= 1;
-        if (input_next & msb_mask) {
-            input |= 0x01;
-        }
-        input_next <<= 1;
-    }
-    return input;
+static uint32_t request_pid(void) {
+    return fuse_get_context()->pid;
 }
 
-/*
- * Use a xorshift algorithm to produce a deterministic pseudo-random
- * block of data.
- */
-static void get_block(int block, char *buf, uint32_t file_seed) {
-    static const uint32_t global_seed = 123456789;
-    uint32_t x = crc(global_seed, file_seed, block);
-    uint32_t y = 362436069;
-    uint32_t z = 521288629;
-    uint32_t w = 88675123;
-    uint32_t *buf32 = (uint32_t*)buf;
-    int i;
-    for (i=0; i<(BLOCK_SIZE/sizeof(uint32_t)); i++) {
-        uint32_t t = x ^ (x << 11);
-        x = y; y = z; z = w;
-        w = w ^ (w >> 19) ^ (t ^ (t >> 8));
-        buf32[i] = w;
-    }
+static uint32_t request_uid(void) {
+    return fuse_get_context()->uid;
 }
 
 /*
- * FUSE operation for fulfilling read() requests.
+ * Return path, or if it's relative, the equivalent absolute path.
  */
-static int fop_read(
-    const char *path,
-    char *buf,
-    size_t size,
-    off_t abs_offset,
-    struct fuse_file_info *fi
-) {
-    // skip the leading slash
+static char *absolute_path(char *path) {
+    char cwd[PATH_MAX];
+    char abs[2*PATH_MAX];
     if (path[0] == '/') {
-        path++;
+        return path;
     }
-
-    // lookup the file
-    testfile_t *testfile;
-    for (testfile = testfile_list; testfile!=NULL; testfile=testfile->next) {
-        if (strcmp(path, testfile->name) == 0) {
-            break;
-        }
-    }
-    if (testfile == NULL) {
-        return -ENOENT;
-    }
-
-    // limit to the size of the file
-    if (abs_offset + size > testfile->size) {
-        size = testfile->size - abs_offset;
-    }
-
-    size_t orig_size = size;
-    while (size) {
-        // consider the file to be made up of 64K blocks, each with its
-        // own predictable pseudorandom context.  The use of uint32_t's
-        // here limit the total size to 256TB.
-        uint32_t block = abs_offset>>BLOCK_SHIFT;
-        uint32_t offset = abs_offset & OFFSET_MASK;
-
-        if (offset==0 && size>=BLOCK_SIZE) {
-            // ideal case -- aligned buffer of our block size
-            get_block(block, buf, testfile->seed);
-            buf += BLOCK_SIZE;
-            size -= BLOCK_SIZE;
-            abs_offset += BLOCK_SIZE;
-        } else {
-            // fulfill partial-block reads
-            char block_buffer[BLOCK_SIZE];
-            get_block(block, block_buffer, testfile->seed);
-            int bytes;
-            if (size < (BLOCK_SIZE-offset)) {
-                bytes = size;
-            } else {
-                bytes = BLOCK_SIZE-offset;
-            }
-            memcpy(buf, block_buffer+offset, bytes);
-            buf += bytes;
-            size -= bytes;
-            abs_offset += bytes;
-        }
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        fprintf(stderr, "error: can't resolve %s\n", path);
+        exit(EXIT_FAILURE);
     }
-
-    return orig_size;
-}
-
-/*
- * Define our basic FUSE file operations.
- */
-static struct fuse_operations fops = {
-    .getattr        = fop_getattr,
-    .readdir        = fop_readdir,
-    .open           = fop_open,
-    .read           = fop_read,
-};
-
-void usage() {
-    fprintf(stderr, "usage: testfuse filename,size,seed[/...] /mnt/mntpoint\n");
+    snprintf(abs, sizeof(abs), "%s/%s", cwd, path);
+    return strdup(abs);
 }
 
 int main(int argc, char **argv) {
@@ -306,71 +158,110 @@ int main(int argc, char **argv) {
     }
 
     // parse the test file parameters
-    char *save_files;
-    char *save_fields;
-    char *file = strtok_r(argv[1], "/", &save_files);
-    do {
-        char *name = strtok_r(file, ",", &save_fields);
-        char *size_str = strtok_r(NULL, ",", &save_fields);
-        char *seed_str = strtok_r(NULL, ",", &save_fields);
+    spec_t *spec = parse_spec_list_generators(argv[1]);
+    if (spec == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    argc--;
+    argv++;
 
-        if ((! name) || (!size_str) || (!seed_str)) {
-            usage();
-            exit(EXIT_FAILURE);
-        }
+    // parse our own options, leaving the rest for FUSE
+    struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+    config.hash_threads = UINT_MAX;
+    config.read_threads = UINT_MAX;
+    config.bulk_threads = UINT_MAX;
+    if (fuse_opt_parse(&args, &config, testfuse_opts, NULL) == -1) {
+        usage();
+        exit(EXIT_FAILURE);
+    }
 
-        // parse name
-        if (name == '\0') {
-            fprintf(stderr, "error: invalid name\n");
+    // confine everything from here on, including the threads FUSE and
+    // the filesystem start, to the chosen nodes
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (config.numa_nodes) {
+        cpus = node_bind(config.numa_nodes);
+        if (cpus < 0) {
             exit(EXIT_FAILURE);
         }
-
-        // parse size
+    }
+    if (config.hash_threads == UINT_MAX) {
+        config.hash_threads = cpus;
+    }
+    if (config.read_threads == UINT_MAX) {
+        // the thread serving a read works on it too
+        config.read_threads = cpus - 1;
+    }
+    if (config.bulk_threads == UINT_MAX) {
+        // leaving the other half of the CPUs free for the small stuff:
+        // the pool helps bulk reads only up to this many threads
+        config.bulk_threads = cpus / 2;
+    }
+    if (config.bulk_threads == 0) {
+        config.bulk_threads = 1;
+    }
+    if (config.hash_threads == 0) {
+        config.hash_threads = 1;
+    }
+    if (config.piece_length) {
         char *endptr;
-        uint64_t size = strtoll(size_str, &endptr, 0);
-        if (*endptr == 'k' || *endptr == 'K') {
-            size *= 1024;
-        } else if (*endptr == 'm' || *endptr == 'M') {
-            size *= 1024*1024;
-        } else if (*endptr == 'g' || *endptr == 'G') {
-            size *= 1024*1024*1024;
-        }
-        if (size == 0) {
-            fprintf(stderr, "error: invalid size\n");
+        uint64_t piece_length = parse_size(config.piece_length, &endptr);
+        if (*endptr != '\0' || piece_length < 16*1024 || piece_length > 1U<<31 ||
+            (piece_length & (piece_length - 1)) != 0) {
+            fprintf(stderr, "error: piece length must be a power of two of at least 16K\n");
             exit(EXIT_FAILURE);
         }
-
-        // parse seed
-        uint32_t seed = strtoll(seed_str, &endptr, 0);
-        if (seed == 0 || *endptr != '\0') {
-            fprintf(stderr, "error: invalid seed\n");
+        fs_config.piece_length = piece_length;
+    }
+    if (config.fair_key == NULL || strcmp(config.fair_key, "pid") == 0) {
+        fs_config.client = request_pid;
+    } else if (strcmp(config.fair_key, "uid") == 0) {
+        fs_config.client = request_uid;
+    } else {
+        fprintf(stderr, "error: fair_key must be pid or uid\n");
+        exit(EXIT_FAILURE);
+    }
+    if (prio_fair(fs_config.client == request_pid ? "pid" : "uid", config.fair_weights) != 0) {
+        fprintf(stderr, "error: invalid fair weights: %s\n", config.fair_weights);
+        exit(EXIT_FAILURE);
+    }
+    if (config.bulk_size) {
+        char *endptr;
+        uint64_t bulk_size = parse_size(config.bulk_size, &endptr);
+        if (*endptr != '\0' || bulk_size == 0) {
+            fprintf(stderr, "error: invalid bulk size: %s\n", config.bulk_size);
             exit(EXIT_FAILURE);
         }
+        fs_config.bulk_size = bulk_size;
+    }
 
-        // add this <name,size,seed> tuple to the list
-        testfile_t *testfile = malloc(sizeof(testfile_t));
-        if (testfile == NULL) {
-            fprintf(stderr, "error: out of memory\n");
+    // add the test files, loading any generator plugins they name
+    for (; spec != NULL; spec = spec->next) {
+        if (fs_add_file(spec, config.plugin_dir) != 0) {
             exit(EXIT_FAILURE);
         }
-        testfile->name = strdup(name);
-        if (testfile->name == NULL) {
-            fprintf(stderr, "error: out of memory\n");
-            exit(EXIT_FAILURE);
-        }
-        testfile->size = size;
-        testfile->seed = seed;
-        testfile->next = testfile_list;
-        testfile_list = testfile;
-
-    } while ((file=strtok_r(NULL, "/", &save_files)) != NULL);
-    if (testfile_list == NULL) {
-        fprintf(stderr, "error: no test files specified\n");
-        exit(EXIT_FAILURE);
     }
-    argc--;
-    argv++;
 
-    return fuse_main(argc, argv, &fops, NULL);
+    // FUSE changes to the root directory when it daemonizes, so the
+    // cache and socket paths must be absolute
+    if (config.hashcache == NULL && getenv("HOME")) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/.cache", getenv("HOME"));
+        mkdir(path, 0700);
+        strncat(path, "/testfuse-cache", sizeof(path)-strlen(path)-1);
+        config.hashcache = strdup(path);
+    } else if (config.hashcache) {
+        config.hashcache = absolute_path(config.hashcache);
+    }
+    if (config.ring) {
+        config.ring = absolute_path(config.ring);
+    }
+    fs_config.hashcache = config.hashcache;
+    fs_config.hash_threads = config.hash_threads;
+    fs_config.read_threads = config.read_threads;
+    fs_config.bulk_threads = config.bulk_threads;
+    fs_config.announce = config.announce;
+    fs_config.ring = config.ring;
+
+    return fuse_main(args.argc, args.argv, &fs_operations, NULL);
 }
 
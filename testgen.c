@@ -0,0 +1,237 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Write the content of a test file (or a byte range of it) to stdout,
+ * for when a mount isn't needed at all:
+ *
+ *     ./testgen 1T,0x2 | nc host port
+ *
+ * Several threads generate consecutive chunks into a ring of buffers,
+ * which are written out in order.  They're copied out by write() rather
+ * than handed over with vmsplice(): the reader may splice the pipe
+ * onward (to a socket, say), which keeps the pages referenced long after
+ * they've left the pipe, so a buffer could never safely be reused.
+ *
+ * Usage:
+ *     ./testgen [-t threads] [-s offset] [-n length] <size>,<seed>
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "gen.h"
+#include "spec.h"
+
+#define CHUNK_SIZE (1024*1024)
+
+typedef struct testgen_s {
+    uint32_t seed;
+    uint64_t offset;
+    uint64_t length;
+    size_t chunk_size;
+    uint64_t nchunks;
+    int nbufs;
+    char **bufs;
+    uint64_t *ready;        // chunk number + 1 held by each buffer
+    uint64_t next_chunk;    // next chunk to be claimed by a generator
+    uint64_t released;      // chunks whose buffers may be reused
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} testgen_t;
+
+static void usage(void) {
+    fprintf(stderr, "usage: testgen [-t threads] [-s offset] [-n length] <size>,<seed>\n");
+    fprintf(stderr, "    -t N        generate with N threads (default: one per CPU)\n");
+    fprintf(stderr, "    -s OFFSET   start at this offset (default 0)\n");
+    fprintf(stderr, "    -n LENGTH   write this many bytes (default: to the end)\n");
+}
+
+static void *gen_thread(void *arg) {
+    testgen_t *g = arg;
+    pthread_mutex_lock(&g->lock);
+    for (;;) {
+        uint64_t chunk = g->next_chunk;
+        if (chunk >= g->nchunks) {
+            break;
+        }
+        g->next_chunk++;
+        // wait for the buffer's previous chunk to be released
+        while (chunk >= g->released + g->nbufs) {
+            pthread_cond_wait(&g->cond, &g->lock);
+        }
+        pthread_mutex_unlock(&g->lock);
+
+        int b = chunk % g->nbufs;
+        uint64_t pos = chunk * g->chunk_size;
+        size_t len = g->length - pos < g->chunk_size ? g->length - pos : g->chunk_size;
+        get_range(g->bufs[b], len, g->offset + pos, g->seed);
+
+        pthread_mutex_lock(&g->lock);
+        g->ready[b] = chunk + 1;
+        pthread_cond_broadcast(&g->cond);
+    }
+    pthread_mutex_unlock(&g->lock);
+    return NULL;
+}
+
+static int write_out(const char *buf, size_t len) {
+    while (len) {
+        ssize_t n = write(STDOUT_FILENO, buf, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    uint64_t offset = 0;
+    uint64_t length = UINT64_MAX;
+    char *endptr;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:s:n:")) != -1) {
+        switch (opt) {
+        case 't':
+            threads = atoi(optarg);
+            break;
+        case 's':
+            offset = parse_size(optarg, &endptr);
+            if (*endptr != '\0') {
+                usage();
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'n':
+            length = parse_size(optarg, &endptr);
+            if (*endptr != '\0') {
+                usage();
+                exit(EXIT_FAILURE);
+            }
+            break;
+        default:
+            usage();
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (argc - optind != 1 || threads < 1) {
+        usage();
+        exit(EXIT_FAILURE);
+    }
+
+    testgen_t g;
+    memset(&g, 0, sizeof(g));
+    uint64_t size = parse_size(argv[optind], &endptr);
+    if (size == 0 || *endptr != ',') {
+        fprintf(stderr, "error: invalid size\n");
+        exit(EXIT_FAILURE);
+    }
+    if (parse_seed(endptr+1, &g.seed) != 0) {
+        fprintf(stderr, "error: invalid seed\n");
+        exit(EXIT_FAILURE);
+    }
+    if (offset > size) {
+        fprintf(stderr, "error: offset is past the end of the file\n");
+        exit(EXIT_FAILURE);
+    }
+    g.offset = offset;
+    g.length = size - offset < length ? size - offset : length;
+
+    // for a pipe, make it as large as we can, so a chunk takes few writes
+    struct stat st;
+    g.chunk_size = CHUNK_SIZE;
+    if (fstat(STDOUT_FILENO, &st) == 0 && S_ISFIFO(st.st_mode)) {
+        fcntl(STDOUT_FILENO, F_SETPIPE_SZ, CHUNK_SIZE);
+    }
+    g.nchunks = (g.length + g.chunk_size - 1) / g.chunk_size;
+    if (threads > g.nchunks) {
+        threads = g.nchunks ? g.nchunks : 1;
+    }
+    g.nbufs = threads + 1;
+    g.bufs = calloc(g.nbufs, sizeof(char *));
+    g.ready = calloc(g.nbufs, sizeof(uint64_t));
+    if (g.bufs == NULL || g.ready == NULL) {
+        fprintf(stderr, "error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    long page_size = sysconf(_SC_PAGESIZE);
+    int i;
+    for (i=0; i<g.nbufs; i++) {
+        if (posix_memalign((void **)&g.bufs[i], page_size, g.chunk_size) != 0) {
+            fprintf(stderr, "error: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    pthread_mutex_init(&g.lock, NULL);
+    pthread_cond_init(&g.cond, NULL);
+
+    pthread_t *tids = malloc(threads * sizeof(pthread_t));
+    if (tids == NULL) {
+        fprintf(stderr, "error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (i=0; i<threads; i++) {
+        if (pthread_create(&tids[i], NULL, gen_thread, &g) != 0) {
+            fprintf(stderr, "error: can't start generator threads\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // write the chunks out in order as they become ready
+    uint64_t chunk;
+    for (chunk=0; chunk<g.nchunks; chunk++) {
+        int b = chunk % g.nbufs;
+        pthread_mutex_lock(&g.lock);
+        while (g.ready[b] != chunk + 1) {
+            pthread_cond_wait(&g.cond, &g.lock);
+        }
+        pthread_mutex_unlock(&g.lock);
+
+        uint64_t pos = chunk * g.chunk_size;
+        size_t len = g.length - pos < g.chunk_size ? g.length - pos : g.chunk_size;
+        if (write_out(g.bufs[b], len) != 0) {
+            perror("testgen: write");
+            exit(EXIT_FAILURE);
+        }
+
+        pthread_mutex_lock(&g.lock);
+        g.released = chunk + 1;
+        pthread_cond_broadcast(&g.cond);
+        pthread_mutex_unlock(&g.lock);
+    }
+    for (i=0; i<threads; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    return 0;
+}
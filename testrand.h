@@ -0,0 +1,39 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * ioctls understood by the testfuse-cuse character device.  Reads
+ * return consecutive bytes of the stream from the open file's own
+ * position, which these move and report since the device can't lseek().
+ */
+
+#ifndef TESTRAND_H
+#define TESTRAND_H
+
+#include <stdint.h>
+#include <sys/ioctl.h>
+
+// move this open file's position to the start of the given 64K block
+#define TESTRAND_SEEK_BLOCK _IOW('t', 1, uint64_t)
+
+// report this open file's position, in bytes from the start of the stream
+#define TESTRAND_TELL _IOR('t', 2, uint64_t)
+
+#endif
@@ -0,0 +1,242 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#include "torrent.h"
+#include "cache.h"
+#include "gen.h"
+#include "sha1.h"
+
+#define MIN_PIECE_LENGTH (256*1024)
+#define MAX_PIECE_LENGTH (16*1024*1024)
+#define TARGET_PIECES 2000
+
+uint32_t torrent_piece_length(uint64_t size) {
+    uint32_t piece_len = MIN_PIECE_LENGTH;
+    while (piece_len < MAX_PIECE_LENGTH && size / piece_len > TARGET_PIECES) {
+        piece_len *= 2;
+    }
+    return piece_len;
+}
+
+/*
+ * Append bencoded values to a buffer.  The buffer is sized by a first
+ * pass with a NULL buffer, which just counts.
+ */
+typedef struct bencode_s {
+    char *buf;
+    size_t len;
+} bencode_t;
+
+static void put_raw(bencode_t *b, const void *data, size_t len) {
+    if (b->buf) {
+        memcpy(b->buf + b->len, data, len);
+    }
+    b->len += len;
+}
+
+static void put_string(bencode_t *b, const char *s, size_t len) {
+    char prefix[32];
+    put_raw(b, prefix, snprintf(prefix, sizeof(prefix), "%zu:", len));
+    put_raw(b, s, len);
+}
+
+static void put_int(bencode_t *b, uint64_t value) {
+    char str[32];
+    put_raw(b, str, snprintf(str, sizeof(str), "i%" PRIu64 "e", value));
+}
+
+static void put_key(bencode_t *b, const char *key) {
+    put_string(b, key, strlen(key));
+}
+
+/*
+ * Keys must appear in sorted order.  The pieces string is left zeroed,
+ * to be filled in by torrent_hash().
+ */
+static void layout(torrent_t *t, bencode_t *b, const char *name, const char *announce) {
+    put_raw(b, "d", 1);
+    if (announce) {
+        put_key(b, "announce");
+        put_string(b, announce, strlen(announce));
+    }
+    put_key(b, "created by");
+    put_string(b, "testfuse", 8);
+    put_key(b, "info");
+    t->info_offset = b->len;
+    put_raw(b, "d", 1);
+    put_key(b, "length");
+    put_int(b, t->size);
+    put_key(b, "name");
+    put_string(b, name, strlen(name));
+    put_key(b, "piece length");
+    put_int(b, t->piece_len);
+    put_key(b, "pieces");
+    char prefix[32];
+    put_raw(b, prefix, snprintf(prefix, sizeof(prefix), "%" PRIu64 ":", t->npieces * TORRENT_HASH_SIZE));
+    t->pieces_offset = b->len;
+    if (b->buf) {
+        memset(b->buf + b->len, 0, t->npieces * TORRENT_HASH_SIZE);
+    }
+    b->len += t->npieces * TORRENT_HASH_SIZE;
+    put_raw(b, "e", 1);
+    t->info_len = b->len - t->info_offset;
+    put_raw(b, "e", 1);
+}
+
+int torrent_init(torrent_t *t, const char *name, uint64_t size, const gen_stream_t *stream,
+    uint32_t piece_len, const char *announce
+) {
+    memset(t, 0, sizeof(torrent_t));
+    t->size = size;
+    t->stream = *stream;
+    t->piece_len = piece_len;
+    t->npieces = (size + piece_len - 1) / piece_len;
+
+    bencode_t b = { NULL, 0 };
+    layout(t, &b, name, announce);
+    t->data = malloc(b.len);
+    if (t->data == NULL) {
+        return -ENOMEM;
+    }
+    b.buf = t->data;
+    b.len = 0;
+    layout(t, &b, name, announce);
+    t->len = b.len;
+    return 0;
+}
+
+typedef struct piece_job_s {
+    torrent_t *t;
+    uint64_t next_piece;
+} piece_job_t;
+
+/*
+ * Full pieces depend only on the stream and the piece length, so they're
+ * shared with any file of the same stream.  A short final piece isn't
+ * worth caching.
+ */
+static cache_key_t piece_key(const torrent_t *t, uint64_t piece) {
+    cache_key_t key = {
+        .type = CACHE_PIECE,
+        .format = t->stream.format,
+        .seed = t->stream.seed,
+        .key1 = t->piece_len,
+        .key2 = piece,
+    };
+    return key;
+}
+
+/*
+ * Claim pieces until there are none left, generating each a block at a
+ * time and hashing it into the metainfo.
+ */
+static void *piece_worker(void *arg) {
+    piece_job_t *job = arg;
+    torrent_t *t = job->t;
+    char *buf = malloc(BLOCK_SIZE);
+    if (buf == NULL) {
+        return NULL;
+    }
+    for (;;) {
+        uint64_t piece = __atomic_fetch_add(&job->next_piece, 1, __ATOMIC_RELAXED);
+        if (piece >= t->npieces) {
+            break;
+        }
+        uint8_t *hash = (uint8_t *)t->data + t->pieces_offset + piece * TORRENT_HASH_SIZE;
+        uint64_t offset = piece * t->piece_len;
+        uint64_t len = t->piece_len;
+        if (t->size - offset < len) {
+            len = t->size - offset;
+        }
+        cache_key_t key = piece_key(t, piece);
+        if (len == t->piece_len && cache_get(&key, hash, TORRENT_HASH_SIZE) == 0) {
+            continue;
+        }
+
+        sha1_ctx_t sha1;
+        uint64_t pos;
+        sha1_init(&sha1);
+        for (pos = 0; pos < len; pos += BLOCK_SIZE) {
+            size_t n = BLOCK_SIZE;
+            if (len - pos < n) {
+                n = len - pos;
+            }
+            gen_stream_range(&t->stream, buf, n, offset + pos);
+            sha1_update(&sha1, buf, n);
+        }
+        sha1_final(&sha1, hash);
+        if (len == t->piece_len) {
+            cache_put(&key, hash, TORRENT_HASH_SIZE);
+        }
+    }
+    free(buf);
+    return NULL;
+}
+
+int torrent_hash(torrent_t *t, int threads) {
+    piece_job_t job = { t, 0 };
+    pthread_t *workers = NULL;
+    int nworkers = 0;
+    int i;
+
+    if (t->hashed) {
+        return 0;
+    }
+    if (threads > t->npieces) {
+        threads = t->npieces;
+    }
+    if (threads > 1) {
+        workers = malloc((threads-1) * sizeof(pthread_t));
+    }
+    if (workers) {
+        for (nworkers = 0; nworkers < threads-1; nworkers++) {
+            if (pthread_create(&workers[nworkers], NULL, piece_worker, &job)) {
+                break;
+            }
+        }
+    }
+    piece_worker(&job);
+    for (i=0; i<nworkers; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+    if (job.next_piece < t->npieces) {
+        return -ENOMEM;
+    }
+
+    sha1_ctx_t sha1;
+    sha1_init(&sha1);
+    sha1_update(&sha1, t->data + t->info_offset, t->info_len);
+    sha1_final(&sha1, t->info_hash);
+    t->hashed = 1;
+    return 0;
+}
+
+void torrent_free(torrent_t *t) {
+    free(t->data);
+    t->data = NULL;
+}
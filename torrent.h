@@ -0,0 +1,74 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * BitTorrent (v1) metainfo for test files, with the piece hashes
+ * computed in parallel straight from the generator.
+ */
+
+#ifndef TORRENT_H
+#define TORRENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gen.h"
+
+#define TORRENT_HASH_SIZE 20
+
+typedef struct torrent_s {
+    uint64_t size;
+    gen_stream_t stream;
+    uint32_t piece_len;
+    uint64_t npieces;
+
+    // the bencoded metainfo, and where the interesting parts are in it
+    char *data;
+    size_t len;
+    size_t info_offset;
+    size_t info_len;
+    size_t pieces_offset;
+
+    int hashed;
+    uint8_t info_hash[TORRENT_HASH_SIZE];
+} torrent_t;
+
+/*
+ * Pick a piece length for a file of the given size: a power of two
+ * between 256KiB and 16MiB, aiming for no more than about 2000 pieces.
+ */
+uint32_t torrent_piece_length(uint64_t size);
+
+/*
+ * Lay out the metainfo for a test file, without computing the piece
+ * hashes yet.  The length of the metainfo is known at this point.
+ */
+int torrent_init(torrent_t *t, const char *name, uint64_t size, const gen_stream_t *stream,
+    uint32_t piece_len, const char *announce);
+
+/*
+ * Fill in the piece hashes (using the given number of threads, and the
+ * persistent cache) and the info hash.
+ */
+int torrent_hash(torrent_t *t, int threads);
+
+void torrent_free(torrent_t *t);
+
+#endif
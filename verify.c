@@ -0,0 +1,148 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "gen.h"
+#include "verify.h"
+
+/*
+ * Runs of whole, aligned blocks are checked by verify_blocks(), which
+ * regenerates and compares in one pass without storing anything.  The
+ * partial blocks at either end of a buffer are compared against a
+ * window of expected content instead, generated a few blocks at a time
+ * (which costs about the same as generating one block without SIMD),
+ * so that a stream of small buffers generates each block only once.
+ */
+#define WINDOW_BLOCKS 8
+
+struct verify_ctx_s {
+    uint32_t seed;
+    uint64_t offset;
+    uint64_t mismatched;
+    uint64_t first_mismatch;
+    char *window;
+    uint64_t window_start;
+    uint64_t window_end;
+};
+
+verify_ctx_t *verify_new(uint32_t seed, uint64_t offset) {
+    verify_ctx_t *ctx = calloc(1, sizeof(verify_ctx_t));
+    if (ctx == NULL) {
+        return NULL;
+    }
+    ctx->seed = seed;
+    ctx->offset = offset;
+    return ctx;
+}
+
+void verify_free(verify_ctx_t *ctx) {
+    if (ctx) {
+        free(ctx->window);
+        free(ctx);
+    }
+}
+
+void verify_seek(verify_ctx_t *ctx, uint64_t offset) {
+    ctx->offset = offset;
+}
+
+uint64_t verify_offset(const verify_ctx_t *ctx) {
+    return ctx->offset;
+}
+
+uint64_t verify_mismatched(const verify_ctx_t *ctx, uint64_t *first) {
+    if (ctx->mismatched && first) {
+        *first = ctx->first_mismatch;
+    }
+    return ctx->mismatched;
+}
+
+/*
+ * Compare data against the expected content at ctx->offset, through the
+ * window, counting any mismatched bytes.  Returns the number of bytes
+ * compared, which is at most the rest of the window.
+ */
+static size_t compare_window(verify_ctx_t *ctx, const char *data, size_t len) {
+    if (ctx->offset < ctx->window_start || ctx->offset >= ctx->window_end) {
+        uint64_t block = ctx->offset >> BLOCK_SHIFT;
+        get_blocks(block, WINDOW_BLOCKS, ctx->window, ctx->seed);
+        ctx->window_start = block << BLOCK_SHIFT;
+        ctx->window_end = ctx->window_start + WINDOW_BLOCKS*BLOCK_SIZE;
+    }
+    const char *expected = ctx->window + (ctx->offset - ctx->window_start);
+    size_t n = ctx->window_end - ctx->offset;
+    if (n > len) {
+        n = len;
+    }
+    if (memcmp(data, expected, n) != 0) {
+        size_t i;
+        for (i=0; i<n; i++) {
+            if (data[i] != expected[i]) {
+                if (ctx->mismatched++ == 0) {
+                    ctx->first_mismatch = ctx->offset + i;
+                }
+            }
+        }
+    }
+    return n;
+}
+
+int verify_update(verify_ctx_t *ctx, const void *buf, size_t len) {
+    const char *data = buf;
+    uint64_t mismatched = ctx->mismatched;
+    if (ctx->window == NULL) {
+        ctx->window = malloc(WINDOW_BLOCKS*BLOCK_SIZE);
+        if (ctx->window == NULL) {
+            return -1;
+        }
+    }
+    while (len) {
+        // only whole multiples of the window are worth a fused pass, as
+        // the SIMD kernels leave any other blocks to scalar code
+        if ((ctx->offset & OFFSET_MASK) == 0 && len >= WINDOW_BLOCKS*BLOCK_SIZE &&
+            (ctx->offset < ctx->window_start || ctx->offset >= ctx->window_end)) {
+            uint32_t count = (len >> BLOCK_SHIFT) & ~(WINDOW_BLOCKS - 1);
+            size_t n = (size_t)count << BLOCK_SHIFT;
+            if (verify_blocks(ctx->offset >> BLOCK_SHIFT, count, data, ctx->seed)) {
+                data += n;
+                len -= n;
+                ctx->offset += n;
+                continue;
+            }
+            // something in the run differs; go through the window to
+            // find out exactly what
+            while (n) {
+                size_t done = compare_window(ctx, data, n);
+                data += done;
+                len -= done;
+                n -= done;
+                ctx->offset += done;
+            }
+            continue;
+        }
+        size_t done = compare_window(ctx, data, len);
+        data += done;
+        len -= done;
+        ctx->offset += done;
+    }
+    return ctx->mismatched == mismatched ? 0 : -1;
+}
@@ -0,0 +1,76 @@
+/*
+ * testfuse - a FUSE filesystem driver for deterministic pseudo-random
+ *            files of various sizes.
+ *
+ * Copyright 2013 David Simmons
+ * http://cafbit.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Incremental verification of a testfuse stream, for programs which
+ * receive test file content (over HTTP, from an object store, ...) and
+ * want to check it as it arrives rather than saving it first.  The
+ * content may be fed in buffers of any size and alignment.
+ *
+ *     verify_ctx_t *ctx = verify_new(seed, 0);
+ *     while ((n = recv(sock, buf, sizeof(buf), 0)) > 0) {
+ *         verify_update(ctx, buf, n);
+ *     }
+ *     if (verify_mismatched(ctx, &first) != 0) {
+ *         ...
+ *     }
+ *     verify_free(ctx);
+ */
+
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct verify_ctx_s verify_ctx_t;
+
+/*
+ * Start verifying a stream with the given seed, from the given stream
+ * offset.  Returns NULL if out of memory.
+ */
+verify_ctx_t *verify_new(uint32_t seed, uint64_t offset);
+
+/*
+ * Check the next len bytes of the stream.  Returns 0 if they match, or
+ * -1 if any of them don't.
+ */
+int verify_update(verify_ctx_t *ctx, const void *buf, size_t len);
+
+/*
+ * Continue from a different stream offset, as for datagrams which
+ * arrive out of order.
+ */
+void verify_seek(verify_ctx_t *ctx, uint64_t offset);
+
+/*
+ * Return the stream offset of the next byte expected.
+ */
+uint64_t verify_offset(const verify_ctx_t *ctx);
+
+/*
+ * Return the number of mismatched bytes seen so far, and if there are
+ * any, set *first to the offset of the first.  first may be NULL.
+ */
+uint64_t verify_mismatched(const verify_ctx_t *ctx, uint64_t *first);
+
+void verify_free(verify_ctx_t *ctx);
+
+#endif